@@ -33,6 +33,23 @@ static inline void copy_user_page(void *to, void *from, unsigned long vaddr,
 	copy_page(to, from);
 }
 
+#ifdef CONFIG_X86_64
+/* Cache-bypassing variants, for the parts of huge pages not faulted on */
+static inline void clear_user_page_nocache(void *page, unsigned long vaddr,
+					   struct page *pg)
+{
+	clear_page_nocache(page);
+}
+
+static inline void copy_user_page_nocache(void *to, void *from,
+					  unsigned long vaddr,
+					  struct page *topage)
+{
+	copy_page_nocache(to, from);
+}
+#define __HAVE_ARCH_USER_PAGE_NOCACHE
+#endif
+
 #define __alloc_zeroed_user_highpage(movableflags, vma, vaddr) \
 	alloc_page_vma(GFP_HIGHUSER | __GFP_ZERO | movableflags, vma, vaddr)
 #define __HAVE_ARCH_ALLOC_ZEROED_USER_HIGHPAGE
@@ -36,6 +36,8 @@ extern unsigned long __phys_addr_symbol(unsigned long);
 
 void clear_page(void *page);
 void copy_page(void *to, void *from);
+void clear_page_nocache(void *page);
+void copy_page_nocache(void *to, void *from);
 
 #endif	/* !__ASSEMBLY__ */
 
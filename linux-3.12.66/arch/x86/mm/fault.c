@@ -1101,6 +1101,34 @@ __do_page_fault(struct pt_regs *regs, unsigned long error_code)
 	if (error_code & PF_WRITE)
 		flags |= FAULT_FLAG_WRITE;
 
+	/*
+	 * Try to handle user faults without mmap_sem first; anything the
+	 * speculative path cannot resolve comes back as VM_FAULT_RETRY and
+	 * is handled below.  A read of a present page is an access error,
+	 * which needs the vma checks done under mmap_sem.
+	 */
+	if ((error_code & PF_USER) &&
+	    !((error_code & PF_PROT) && !(error_code & PF_WRITE))) {
+		fault = handle_speculative_fault(mm, address, flags);
+		if (fault != VM_FAULT_RETRY) {
+			if (unlikely(fault & VM_FAULT_ERROR)) {
+				mm_fault_error(regs, error_code, address, fault);
+				return;
+			}
+			if (fault & VM_FAULT_MAJOR) {
+				tsk->maj_flt++;
+				perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MAJ, 1,
+					      regs, address);
+			} else {
+				tsk->min_flt++;
+				perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1,
+					      regs, address);
+			}
+			check_v8086_mode(regs, address, tsk);
+			return;
+		}
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -35,6 +35,20 @@ __initdata
 static int numa_distance_cnt;
 static u8 *numa_distance;
 
+/* "numa=nvm:<size>@<start>": a physical range given a CPU-less node */
+static u64 numa_nvm_start __initdata;
+static u64 numa_nvm_size __initdata;
+
+static __init void numa_nvm_cmdline(char *str)
+{
+	numa_nvm_size = memparse(str, &str);
+	if (*str != '@') {
+		numa_nvm_size = 0;
+		return;
+	}
+	numa_nvm_start = memparse(str + 1, &str);
+}
+
 static __init int numa_setup(char *opt)
 {
 	if (!opt)
@@ -49,6 +63,8 @@ static __init int numa_setup(char *opt)
 	if (!strncmp(opt, "noacpi", 6))
 		acpi_numa = -1;
 #endif
+	if (!strncmp(opt, "nvm:", 4))
+		numa_nvm_cmdline(opt + 4);
 	return 0;
 }
 early_param("numa", numa_setup);
@@ -549,6 +565,58 @@ static void __init numa_init_array(void)
 	}
 }
 
+/*
+ * Move the range given with numa=nvm: out of the nodes the firmware
+ * put it in and onto a new node of its own.  The range has to be usable
+ * RAM.  Having no CPUs, the node becomes a demotion target for reclaim.
+ */
+static int __init numa_carve_nvm_node(struct numa_meminfo *mi)
+{
+	u64 start = numa_nvm_start;
+	u64 end = numa_nvm_start + numa_nvm_size;
+	int nid, i, ret;
+
+	if (!numa_nvm_size)
+		return 0;
+
+	nid = first_unset_node(numa_nodes_parsed);
+	if (nid >= MAX_NUMNODES) {
+		pr_warn("NUMA: no free node id for NVM range\n");
+		return 0;
+	}
+
+	for (i = 0; i < mi->nr_blks; i++) {
+		struct numa_memblk *bi = &mi->blk[i];
+
+		if (bi->end <= start || bi->start >= end)
+			continue;
+
+		if (bi->start < start && bi->end > end) {
+			/* keep the part above the range as a new block */
+			ret = numa_add_memblk_to(bi->nid, end, bi->end, mi);
+			if (ret < 0)
+				return ret;
+			bi = &mi->blk[i];
+			bi->end = start;
+		} else if (bi->start < start) {
+			bi->end = start;
+		} else if (bi->end > end) {
+			bi->start = end;
+		} else {
+			numa_remove_memblk_from(i--, mi);
+		}
+	}
+
+	ret = numa_add_memblk_to(nid, start, end, mi);
+	if (ret < 0)
+		return ret;
+	node_set(nid, numa_nodes_parsed);
+
+	pr_info("NUMA: node %d [mem %#010Lx-%#010Lx] is NVM\n",
+		nid, start, end - 1);
+	return 0;
+}
+
 static int __init numa_init(int (*init_func)(void))
 {
 	int i;
@@ -565,6 +633,9 @@ static int __init numa_init(int (*init_func)(void))
 	numa_reset_distance();
 
 	ret = init_func();
+	if (ret < 0)
+		return ret;
+	ret = numa_carve_nvm_node(&numa_meminfo);
 	if (ret < 0)
 		return ret;
 	ret = numa_cleanup_meminfo(&numa_meminfo);
@@ -2748,6 +2748,33 @@ int blk_lld_busy(struct request_queue *q)
 }
 EXPORT_SYMBOL_GPL(blk_lld_busy);
 
+/**
+ * blk_poll - Poll a device for the completion of I/O being waited on
+ * @q : the queue the caller has I/O outstanding on
+ * @may_sleep : the caller has not polled yet during this wait
+ *
+ * Description:
+ *    Called by a task that has set its state and is about to sleep until
+ *    I/O it submitted to @q completes.  If the driver registered a polling
+ *    function with blk_queue_poll(), it may spin on its completion queue
+ *    instead, and on the first call of a wait may first sleep for part of
+ *    the expected latency.  Only waiters for reads and writes should call
+ *    this.
+ *
+ * Return:
+ *    true  - The caller should re-check its wait condition; it may be
+ *            TASK_RUNNING now
+ *    false - The caller should go to sleep as it intended
+ */
+bool blk_poll(struct request_queue *q, bool may_sleep)
+{
+	if (q->poll_fn)
+		return q->poll_fn(q, may_sleep);
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 /**
  * blk_rq_unprep_clone - Helper function to free all bios in a cloned request
  * @rq: the clone request to be cleaned up
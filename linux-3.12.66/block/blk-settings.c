@@ -99,6 +99,21 @@ void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn)
 }
 EXPORT_SYMBOL_GPL(blk_queue_lld_busy);
 
+/**
+ * blk_queue_poll - set a queue's completion polling function
+ * @q:		queue
+ * @fn:		function called by blk_poll()
+ *
+ * Lets tasks waiting for I/O on @q reap completions themselves instead of
+ * sleeping until the interrupt arrives.  The driver decides which of its
+ * hardware queues are worth polling.
+ */
+void blk_queue_poll(struct request_queue *q, poll_queue_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL_GPL(blk_queue_poll);
+
 /**
  * blk_set_default_limits - reset limits to default values
  * @lim:  the queue_limits structure to reset
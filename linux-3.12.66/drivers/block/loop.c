@@ -75,6 +75,7 @@
 #include <linux/sysfs.h>
 #include <linux/miscdevice.h>
 #include <linux/falloc.h>
+#include <linux/aio.h>
 #include "loop.h"
 
 #include <asm/uaccess.h>
@@ -84,6 +85,10 @@ static DEFINE_MUTEX(loop_index_mutex);
 
 static int max_part;
 static int part_shift;
+static int nr_workers = 1;
+
+/* upper bound for the per-device worker pool */
+#define LOOP_MAX_WORKERS	64
 
 /*
  * Transfer functions
@@ -410,6 +415,168 @@ lo_receive(struct loop_device *lo, struct bio *bio, int bsize, loff_t pos)
 	return 0;
 }
 
+static void loop_put_inflight(struct loop_device *lo)
+{
+	if (atomic_dec_and_test(&lo->lo_inflight))
+		wake_up(&lo->lo_idle_wait);
+}
+
+/*
+ * Direct I/O to the backing file.
+ *
+ * The bio pages are handed to an O_DIRECT view of the backing file as
+ * kernel iovecs, so the data is not cached a second time in the backing
+ * file's page cache.  Unless the caller needs the result right away, the
+ * request is completed asynchronously from the backing filesystem's I/O
+ * completion and the worker moves straight on to the next bio.
+ */
+struct loop_dio {
+	struct kiocb		iocb;
+	struct loop_device	*lo;
+	struct bio		*bio;
+	atomic_t		ref;	/* submitter + completion */
+	long			res;
+	struct iovec		iov[0];
+};
+
+static inline bool lo_use_dio(struct loop_device *lo, struct bio *bio,
+			      loff_t pos)
+{
+	unsigned mask = lo->lo_dio_align - 1;
+	struct bio_vec *bvec;
+	int i;
+
+	if (!(lo->lo_flags & LO_FLAGS_DIRECT_IO) ||
+	    lo->transfer != transfer_none || !bio->bi_size)
+		return false;
+
+	/* misaligned requests go through the page cache instead */
+	if (pos & mask)
+		return false;
+	bio_for_each_segment(bvec, bio, i)
+		if ((bvec->bv_offset | bvec->bv_len) & mask)
+			return false;
+	return true;
+}
+
+static int lo_dio_result(struct bio *bio, long res)
+{
+	struct bio_vec *bvec;
+	int i;
+
+	if (res < 0)
+		return res;
+	if (res == bio->bi_size)
+		return 0;
+	if (bio_data_dir(bio) == WRITE)
+		return -EIO;
+
+	/* short read at the end of the backing file */
+	bio_for_each_segment(bvec, bio, i) {
+		if (res >= bvec->bv_len) {
+			res -= bvec->bv_len;
+			continue;
+		}
+		zero_user(bvec->bv_page, bvec->bv_offset + res,
+			  bvec->bv_len - res);
+		res = 0;
+	}
+	return 0;
+}
+
+static void lo_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo;
+	struct bio *bio;
+	long res;
+
+	if (!atomic_dec_and_test(&dio->ref))
+		return;
+
+	lo = dio->lo;
+	bio = dio->bio;
+	res = dio->res;
+	kfree(dio);
+	bio_endio(bio, lo_dio_result(bio, res));
+	loop_put_inflight(lo);
+}
+
+static void lo_dio_complete(struct kiocb *iocb, long res, long res2)
+{
+	struct loop_dio *dio = container_of(iocb, struct loop_dio, iocb);
+
+	dio->res = res;
+	lo_dio_put(dio);
+}
+
+/*
+ * Returns -EIOCBQUEUED when @async is set: the bio is then ended from
+ * lo_dio_complete().  Returns -ENOMEM only if the request descriptor
+ * could not be allocated, in which case nothing was submitted.
+ */
+static int lo_rw_dio(struct loop_device *lo, struct bio *bio, loff_t pos,
+		     bool async)
+{
+	struct file *file = lo->lo_dio_file;
+	struct loop_dio *dio;
+	struct bio_vec *bvec;
+	mm_segment_t old_fs;
+	ssize_t ret;
+	int i, nr_segs = 0;
+
+	dio = kmalloc(sizeof(*dio) + bio_segments(bio) * sizeof(struct iovec),
+		      GFP_NOIO);
+	if (unlikely(!dio))
+		return -ENOMEM;
+
+	init_sync_kiocb(&dio->iocb, file);
+	dio->iocb.ki_pos = pos;
+	dio->iocb.ki_nbytes = bio->bi_size;
+	if (async)
+		dio->iocb.ki_complete = lo_dio_complete;
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->res = 0;
+	atomic_set(&dio->ref, 2);
+
+	bio_for_each_segment(bvec, bio, i) {
+		dio->iov[nr_segs].iov_base = (void __force __user *)
+			(kmap(bvec->bv_page) + bvec->bv_offset);
+		dio->iov[nr_segs].iov_len = bvec->bv_len;
+		nr_segs++;
+	}
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+	if (bio_data_dir(bio) == WRITE) {
+		file_start_write(file);
+		ret = file->f_op->aio_write(&dio->iocb, dio->iov, nr_segs, pos);
+		file_end_write(file);
+	} else {
+		ret = file->f_op->aio_read(&dio->iocb, dio->iov, nr_segs, pos);
+	}
+	set_fs(old_fs);
+
+	if (!async && ret == -EIOCBQUEUED)
+		ret = wait_on_sync_kiocb(&dio->iocb);
+
+	/* the pages are pinned by the backing fs from here on */
+	for (i = 0; i < nr_segs; i++)
+		kunmap(kmap_to_page((void __force *)dio->iov[i].iov_base));
+
+	if (!async) {
+		ret = lo_dio_result(bio, ret);
+		kfree(dio);
+		return ret;
+	}
+
+	/* completed (or failed) inline: the callback was not invoked */
+	if (ret != -EIOCBQUEUED)
+		lo_dio_complete(&dio->iocb, ret, 0);
+	lo_dio_put(dio);
+	return -EIOCBQUEUED;
+}
+
 static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 {
 	loff_t pos;
@@ -451,15 +618,29 @@ static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 			goto out;
 		}
 
-		ret = lo_send(lo, bio, pos);
+		ret = -ENOMEM;
+		if (lo_use_dio(lo, bio, pos)) {
+			/* FUA needs the data on stable storage before fsync */
+			ret = lo_rw_dio(lo, bio, pos,
+					!(bio->bi_rw & REQ_FUA));
+			if (ret == -EIOCBQUEUED)
+				goto out;
+		}
+		if (ret == -ENOMEM)
+			ret = lo_send(lo, bio, pos);
 
 		if ((bio->bi_rw & REQ_FUA) && !ret) {
 			ret = vfs_fsync(file, 0);
 			if (unlikely(ret && ret != -EINVAL))
 				ret = -EIO;
 		}
-	} else
-		ret = lo_receive(lo, bio, lo->lo_blocksize, pos);
+	} else {
+		ret = -ENOMEM;
+		if (lo_use_dio(lo, bio, pos))
+			ret = lo_rw_dio(lo, bio, pos, true);
+		if (ret == -ENOMEM)
+			ret = lo_receive(lo, bio, lo->lo_blocksize, pos);
+	}
 
 out:
 	return ret;
@@ -474,13 +655,32 @@ static void loop_add_bio(struct loop_device *lo, struct bio *bio)
 	bio_list_add(&lo->lo_bio_list, bio);
 }
 
+/*
+ * Can a worker take a bio off the pending list?  Nothing is handed out
+ * while a switch request waits for the bios in flight to drain.
+ */
+static inline bool loop_bio_ready(struct loop_device *lo)
+{
+	return !lo->lo_switching && !bio_list_empty(&lo->lo_bio_list);
+}
+
 /*
  * Grab first pending buffer
  */
 static struct bio *loop_get_bio(struct loop_device *lo)
 {
+	struct bio *bio;
+
+	if (!loop_bio_ready(lo))
+		return NULL;
+
 	lo->lo_bio_count--;
-	return bio_list_pop(&lo->lo_bio_list);
+	bio = bio_list_pop(&lo->lo_bio_list);
+	if (unlikely(!bio->bi_bdev))
+		lo->lo_switching = 1;
+	else
+		atomic_inc(&lo->lo_inflight);
+	return bio;
 }
 
 static void loop_make_request(struct request_queue *q, struct bio *old_bio)
@@ -514,6 +714,9 @@ out:
 
 struct switch_request {
 	struct file *file;
+	bool switch_dio;	/* install dio_file, NULL turns dio off */
+	struct file *dio_file;	/* returns the dio file replaced */
+	unsigned dio_align;
 	struct completion wait;
 };
 
@@ -524,9 +727,19 @@ static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 	if (unlikely(!bio->bi_bdev)) {
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
+
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_switching = 0;
+		spin_unlock_irq(&lo->lo_lock);
+		wake_up(&lo->lo_event);
 	} else {
 		int ret = do_bio_filebacked(lo, bio);
+
+		/* direct I/O in flight ends the bio on completion */
+		if (ret == -EIOCBQUEUED)
+			return;
 		bio_endio(bio, ret);
+		loop_put_inflight(lo);
 	}
 }
 
@@ -536,6 +749,10 @@ static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
  * on reads for block backed loop, as that is too heavy to do from
  * b_end_io context where irqs may be disabled.
  *
+ * A device may run a pool of these workers, all feeding off lo_bio_list.
+ * A switch request is handled by one worker once every bio taken before
+ * it has completed; loop_get_bio() hands out nothing meanwhile.
+ *
  * Loop explanation:  loop_clr_fd() sets lo_state to Lo_rundown before
  * calling kthread_stop().  Therefore once kthread_should_stop() is
  * true, make_request will not place any more requests.  Therefore
@@ -552,10 +769,10 @@ static int loop_thread(void *data)
 	while (!kthread_should_stop() || !bio_list_empty(&lo->lo_bio_list)) {
 
 		wait_event_interruptible(lo->lo_event,
-				!bio_list_empty(&lo->lo_bio_list) ||
+				loop_bio_ready(lo) ||
 				kthread_should_stop());
 
-		if (bio_list_empty(&lo->lo_bio_list))
+		if (!loop_bio_ready(lo))
 			continue;
 		spin_lock_irq(&lo->lo_lock);
 		bio = loop_get_bio(lo);
@@ -563,40 +780,89 @@ static int loop_thread(void *data)
 			wake_up(&lo->lo_req_wait);
 		spin_unlock_irq(&lo->lo_lock);
 
-		BUG_ON(!bio);
+		/* another worker got there first */
+		if (!bio)
+			continue;
 		loop_handle_bio(lo, bio);
 	}
 
 	return 0;
 }
 
+static void loop_stop_threads(struct loop_device *lo)
+{
+	int i;
+
+	for (i = 0; i < lo->lo_nr_threads; i++)
+		kthread_stop(lo->lo_threads[i]);
+	kfree(lo->lo_threads);
+	lo->lo_threads = NULL;
+	lo->lo_nr_threads = 0;
+}
+
+/*
+ * Create the worker pool.  The threads are left stopped until the
+ * device is bound, see loop_set_fd().
+ */
+static int loop_create_threads(struct loop_device *lo)
+{
+	int nr = clamp(nr_workers, 1, LOOP_MAX_WORKERS);
+	struct task_struct *t;
+	int i;
+
+	lo->lo_threads = kcalloc(nr, sizeof(*lo->lo_threads), GFP_KERNEL);
+	if (!lo->lo_threads)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		if (i == 0)
+			t = kthread_create(loop_thread, lo, "loop%d",
+					   lo->lo_number);
+		else
+			t = kthread_create(loop_thread, lo, "loop%d/%d",
+					   lo->lo_number, i);
+		if (IS_ERR(t)) {
+			loop_stop_threads(lo);
+			return PTR_ERR(t);
+		}
+		lo->lo_threads[i] = t;
+		lo->lo_nr_threads++;
+	}
+	return 0;
+}
+
 /*
  * loop_switch performs the hard work of switching a backing store.
  * First it needs to flush existing IO, it does this by sending a magic
  * BIO down the pipe. The completion of this BIO does the actual switch.
  */
-static int loop_switch(struct loop_device *lo, struct file *file)
+static int __loop_switch(struct loop_device *lo, struct switch_request *w)
 {
-	struct switch_request w;
 	struct bio *bio = bio_alloc(GFP_KERNEL, 0);
 	if (!bio)
 		return -ENOMEM;
-	init_completion(&w.wait);
-	w.file = file;
-	bio->bi_private = &w;
+	init_completion(&w->wait);
+	bio->bi_private = w;
 	bio->bi_bdev = NULL;
 	loop_make_request(lo->lo_queue, bio);
-	wait_for_completion(&w.wait);
+	wait_for_completion(&w->wait);
 	return 0;
 }
 
+static int loop_switch(struct loop_device *lo, struct file *file)
+{
+	struct switch_request w = { .file = file };
+
+	return __loop_switch(lo, &w);
+}
+
 /*
  * Helper to flush the IOs in loop, but keeping loop thread running
  */
 static int loop_flush(struct loop_device *lo)
 {
 	/* loop not yet configured, no running thread, nothing to flush */
-	if (!lo->lo_thread)
+	if (!lo->lo_threads)
 		return 0;
 
 	return loop_switch(lo, NULL);
@@ -611,6 +877,18 @@ static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
 	struct file *old_file = lo->lo_backing_file;
 	struct address_space *mapping;
 
+	/* bios taken by other workers may still be using the old setup */
+	wait_event(lo->lo_idle_wait, !atomic_read(&lo->lo_inflight));
+
+	if (p->switch_dio) {
+		swap(lo->lo_dio_file, p->dio_file);
+		lo->lo_dio_align = p->dio_align;
+		if (lo->lo_dio_file)
+			lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+		else
+			lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	}
+
 	/* if no new file, only flush of queued bios requested */
 	if (!file)
 		goto out;
@@ -627,6 +905,63 @@ out:
 }
 
 
+/*
+ * Open an O_DIRECT view of @file for direct I/O mode and report the
+ * alignment the backing store requires for it in @align.
+ */
+static struct file *loop_open_dio_file(struct loop_device *lo,
+				       struct file *file, unsigned *align)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev;
+
+	if (!file->f_mapping->a_ops->direct_IO ||
+	    !file->f_op->aio_read || !file->f_op->aio_write)
+		return ERR_PTR(-EINVAL);
+
+	bdev = S_ISBLK(inode->i_mode) ? inode->i_bdev : inode->i_sb->s_bdev;
+	*align = bdev ? bdev_logical_block_size(bdev) : 512;
+
+	return dentry_open(&file->f_path, file->f_flags | O_DIRECT,
+			   file->f_cred);
+}
+
+/*
+ * Turn direct I/O to the backing file on or off.  Queued and in-flight
+ * bios are drained before the mode changes.
+ */
+static int loop_set_dio(struct loop_device *lo, unsigned long arg)
+{
+	struct switch_request w = { .switch_dio = true };
+	int error;
+
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (!arg == !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+
+	if (arg) {
+		/* encrypted or transformed data can't bypass the copy */
+		if (lo->transfer != transfer_none)
+			return -EINVAL;
+		w.dio_file = loop_open_dio_file(lo, lo->lo_backing_file,
+						&w.dio_align);
+		if (IS_ERR(w.dio_file))
+			return PTR_ERR(w.dio_file);
+	}
+
+	error = __loop_switch(lo, &w);
+	/* the file replaced, or the new one if the switch failed */
+	if (w.dio_file)
+		fput(w.dio_file);
+
+	/* drop what buffered mode left in the backing file's page cache */
+	if (!error && arg)
+		invalidate_mapping_pages(lo->lo_backing_file->f_mapping,
+					 0, -1);
+	return error;
+}
+
 /*
  * loop_change_fd switched the backing store of a loopback device to
  * a new file. This is useful for operating system installers to free up
@@ -640,6 +975,7 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 {
 	struct file	*file, *old_file;
 	struct inode	*inode;
+	struct switch_request w = { };
 	int		error;
 
 	error = -ENXIO;
@@ -668,11 +1004,23 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (get_loop_size(lo, file) != get_loop_size(lo, old_file))
 		goto out_putf;
 
-	/* and ... switch */
-	error = loop_switch(lo, file);
-	if (error)
+	/* and ... switch, keeping direct I/O on if the new file allows it */
+	w.file = file;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		w.switch_dio = true;
+		w.dio_file = loop_open_dio_file(lo, file, &w.dio_align);
+		if (IS_ERR(w.dio_file))
+			w.dio_file = NULL;
+	}
+	error = __loop_switch(lo, &w);
+	if (error) {
+		if (w.dio_file)
+			fput(w.dio_file);
 		goto out_putf;
+	}
 
+	if (w.dio_file)
+		fput(w.dio_file);
 	fput(old_file);
 	if (lo->lo_flags & LO_FLAGS_PARTSCAN)
 		ioctl_by_bdev(bdev, BLKRRPART, 0);
@@ -758,11 +1106,25 @@ static ssize_t loop_attr_partscan_show(struct loop_device *lo, char *buf)
 	return sprintf(buf, "%s\n", partscan ? "1" : "0");
 }
 
+static ssize_t loop_attr_dio_show(struct loop_device *lo, char *buf)
+{
+	int dio = (lo->lo_flags & LO_FLAGS_DIRECT_IO);
+
+	return sprintf(buf, "%s\n", dio ? "1" : "0");
+}
+
+static ssize_t loop_attr_workers_show(struct loop_device *lo, char *buf)
+{
+	return sprintf(buf, "%d\n", lo->lo_nr_threads);
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
 LOOP_ATTR_RO(partscan);
+LOOP_ATTR_RO(dio);
+LOOP_ATTR_RO(workers);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
@@ -770,6 +1132,8 @@ static struct attribute *loop_attrs[] = {
 	&loop_attr_sizelimit.attr,
 	&loop_attr_autoclear.attr,
 	&loop_attr_partscan.attr,
+	&loop_attr_dio.attr,
+	&loop_attr_workers.attr,
 	NULL,
 };
 
@@ -829,6 +1193,7 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	int		lo_flags = 0;
 	int		error;
 	loff_t		size;
+	int		i;
 
 	/* This is safe, since we have a reference from open(). */
 	__module_get(THIS_MODULE);
@@ -889,6 +1254,9 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	lo->ioctl = NULL;
 	lo->lo_sizelimit = 0;
 	lo->lo_bio_count = 0;
+	lo->lo_dio_file = NULL;
+	lo->lo_switching = 0;
+	atomic_set(&lo->lo_inflight, 0);
 	lo->old_gfp_mask = mapping_gfp_mask(mapping);
 	mapping_set_gfp_mask(mapping, lo->old_gfp_mask & ~(__GFP_IO|__GFP_FS));
 
@@ -905,14 +1273,12 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 
 	set_blocksize(bdev, lo_blocksize);
 
-	lo->lo_thread = kthread_create(loop_thread, lo, "loop%d",
-						lo->lo_number);
-	if (IS_ERR(lo->lo_thread)) {
-		error = PTR_ERR(lo->lo_thread);
+	error = loop_create_threads(lo);
+	if (error)
 		goto out_clr;
-	}
 	lo->lo_state = Lo_bound;
-	wake_up_process(lo->lo_thread);
+	for (i = 0; i < lo->lo_nr_threads; i++)
+		wake_up_process(lo->lo_threads[i]);
 	if (part_shift)
 		lo->lo_flags |= LO_FLAGS_PARTSCAN;
 	if (lo->lo_flags & LO_FLAGS_PARTSCAN)
@@ -926,7 +1292,6 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 
 out_clr:
 	loop_sysfs_exit(lo);
-	lo->lo_thread = NULL;
 	lo->lo_device = NULL;
 	lo->lo_backing_file = NULL;
 	lo->lo_flags = 0;
@@ -984,6 +1349,7 @@ loop_init_xfer(struct loop_device *lo, struct loop_func_table *xfer,
 static int loop_clr_fd(struct loop_device *lo)
 {
 	struct file *filp = lo->lo_backing_file;
+	struct file *dio_filp;
 	gfp_t gfp = lo->old_gfp_mask;
 	struct block_device *bdev = lo->lo_device;
 
@@ -1013,10 +1379,14 @@ static int loop_clr_fd(struct loop_device *lo)
 	lo->lo_state = Lo_rundown;
 	spin_unlock_irq(&lo->lo_lock);
 
-	kthread_stop(lo->lo_thread);
+	loop_stop_threads(lo);
+	/* direct I/O still owned by the backing fs must finish first */
+	wait_event(lo->lo_idle_wait, !atomic_read(&lo->lo_inflight));
 
 	spin_lock_irq(&lo->lo_lock);
 	lo->lo_backing_file = NULL;
+	dio_filp = lo->lo_dio_file;
+	lo->lo_dio_file = NULL;
 	spin_unlock_irq(&lo->lo_lock);
 
 	loop_release_xfer(lo);
@@ -1027,7 +1397,6 @@ static int loop_clr_fd(struct loop_device *lo)
 	lo->lo_offset = 0;
 	lo->lo_sizelimit = 0;
 	lo->lo_encrypt_key_size = 0;
-	lo->lo_thread = NULL;
 	memset(lo->lo_encrypt_key, 0, LO_KEY_SIZE);
 	memset(lo->lo_crypt_name, 0, LO_NAME_SIZE);
 	memset(lo->lo_file_name, 0, LO_NAME_SIZE);
@@ -1058,6 +1427,8 @@ static int loop_clr_fd(struct loop_device *lo)
 	 * lock dependency possibility warning as fput can take
 	 * bd_mutex which is usually taken before lo_ctl_mutex.
 	 */
+	if (dio_filp)
+		fput(dio_filp);
 	fput(filp);
 	return 0;
 }
@@ -1327,6 +1698,11 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		err = -EPERM;
+		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
+			err = loop_set_dio(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1481,6 +1857,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -1559,6 +1936,8 @@ module_param(max_loop, int, S_IRUGO);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, S_IRUGO);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+module_param(nr_workers, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(nr_workers, "Number of I/O worker threads started for each bound loop device");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1663,9 +2042,10 @@ static int loop_add(struct loop_device **l, int i)
 	disk->flags |= GENHD_FL_EXT_DEVT;
 	mutex_init(&lo->lo_ctl_mutex);
 	lo->lo_number		= i;
-	lo->lo_thread		= NULL;
+	lo->lo_threads		= NULL;
 	init_waitqueue_head(&lo->lo_event);
 	init_waitqueue_head(&lo->lo_req_wait);
+	init_waitqueue_head(&lo->lo_idle_wait);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
@@ -45,6 +45,8 @@ struct loop_device {
 				 unsigned long arg); 
 
 	struct file *	lo_backing_file;
+	struct file *	lo_dio_file;	/* O_DIRECT view of lo_backing_file */
+	unsigned	lo_dio_align;	/* backing store alignment for dio */
 	struct block_device *lo_device;
 	unsigned	lo_blocksize;
 	void		*key_data; 
@@ -56,10 +58,15 @@ struct loop_device {
 	unsigned int		lo_bio_count;
 	int			lo_state;
 	struct mutex		lo_ctl_mutex;
-	struct task_struct	*lo_thread;
+	struct task_struct	**lo_threads;
+	int			lo_nr_threads;
 	wait_queue_head_t	lo_event;
 	/* wait queue for incoming requests */
 	wait_queue_head_t	lo_req_wait;
+	/* set while a switch request waits for in-flight bios to drain */
+	int			lo_switching;
+	atomic_t		lo_inflight;
+	wait_queue_head_t	lo_idle_wait;
 
 	struct request_queue	*lo_queue;
 	struct gendisk		*lo_disk;
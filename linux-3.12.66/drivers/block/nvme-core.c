@@ -24,9 +24,11 @@
 #include <linux/errno.h>
 #include <linux/fs.h>
 #include <linux/genhd.h>
+#include <linux/hrtimer.h>
 #include <linux/idr.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
+#include <linux/ioprio.h>
 #include <linux/io.h>
 #include <linux/kdev_t.h>
 #include <linux/kthread.h>
@@ -55,6 +57,21 @@ module_param(nvme_major, int, 0);
 static int use_threaded_interrupts;
 module_param(use_threaded_interrupts, int, 0);
 
+static unsigned int poll_queues;
+module_param(poll_queues, uint, 0444);
+MODULE_PARM_DESC(poll_queues,
+	"Number of I/O queues on which waiters poll for completions");
+
+static int poll_delay;
+module_param(poll_delay, int, 0644);
+MODULE_PARM_DESC(poll_delay,
+	"Sleep before polling: -1 spin only, 0 adaptive, >0 fixed microseconds");
+
+/* Give up polling and rely on the interrupt after this long */
+#define NVME_POLL_TIMEOUT_NS	(100 * NSEC_PER_USEC)
+/* Don't bother sleeping for less than this */
+#define NVME_POLL_MIN_SLEEP_NS	(2 * NSEC_PER_USEC)
+
 static DEFINE_SPINLOCK(dev_list_lock);
 static LIST_HEAD(dev_list);
 static struct task_struct *nvme_thread;
@@ -80,9 +97,17 @@ struct nvme_queue {
 	u16 sq_head;
 	u16 sq_tail;
 	u16 cq_head;
+	u16 qid;
 	u8 cq_phase;
 	u8 cqe_seen;
 	u8 q_suspended;
+	u8 q_poll;
+	u64 poll_lat_ns;	/* Moving average of polled I/O latency */
+	unsigned long poll_invoked;
+	unsigned long poll_success;
+	unsigned long poll_sleeps;
+	unsigned long poll_timeouts;
+	unsigned long irq_cqes;
 	unsigned long cmdid_data[];
 };
 
@@ -743,9 +768,13 @@ static int nvme_submit_bio_queue(struct nvme_queue *nvmeq, struct nvme_ns *ns,
 	return result;
 }
 
+/*
+ * Returns the number of completion queue entries processed.
+ */
 static int nvme_process_cq(struct nvme_queue *nvmeq)
 {
 	u16 head, phase;
+	int found = 0;
 
 	head = nvmeq->cq_head;
 	phase = nvmeq->cq_phase;
@@ -764,6 +793,7 @@ static int nvme_process_cq(struct nvme_queue *nvmeq)
 
 		ctx = free_cmdid(nvmeq, cqe.command_id, &fn);
 		fn(nvmeq->dev, ctx, &cqe);
+		found++;
 	}
 
 	/* If the controller ignores the cq head doorbell and continuously
@@ -780,7 +810,106 @@ static int nvme_process_cq(struct nvme_queue *nvmeq)
 	nvmeq->cq_phase = phase;
 
 	nvmeq->cqe_seen = 1;
-	return 1;
+	return found;
+}
+
+/*
+ * Hybrid polling: rather than spinning for the whole device round trip,
+ * sleep for about half of the expected latency first.  Waiters poll right
+ * after submitting, so the time already spent waiting is ignored.  Returns
+ * true if the task slept; it is TASK_RUNNING afterwards either way.
+ */
+static bool nvme_poll_sleep(struct nvme_queue *nvmeq)
+{
+	ktime_t kt;
+	u64 ns;
+
+	if (poll_delay < 0)
+		return false;
+	if (poll_delay > 0)
+		ns = (u64)poll_delay * NSEC_PER_USEC;
+	else
+		ns = ACCESS_ONCE(nvmeq->poll_lat_ns) / 2;
+	if (ns < NVME_POLL_MIN_SLEEP_NS)
+		return false;
+
+	kt = ns_to_ktime(ns);
+	schedule_hrtimeout(&kt, HRTIMER_MODE_REL);
+	return true;
+}
+
+/*
+ * Called through blk_poll() by a task that is about to sleep waiting for
+ * I/O it submitted, with its task state already set.  Completions are
+ * reaped from the queue of the caller's CPU, which is where the I/O went
+ * unless the task migrated; the interrupt still covers that case.
+ *
+ * A hybrid sleep, allowed once per wait by @may_sleep, leaves the task
+ * running, so after one we spin until the deadline and always tell the
+ * caller to re-check its wait condition.
+ */
+static bool nvme_poll(struct request_queue *q, bool may_sleep)
+{
+	struct nvme_ns *ns = q->queuedata;
+	struct nvme_queue *nvmeq;
+	struct io_context *ioc = current->io_context;
+	long state = current->state;
+	u64 start, deadline;
+	bool slept = false;
+
+	/* Idle class I/O is not worth a CPU */
+	if (ioc && IOPRIO_PRIO_CLASS(ioc->ioprio) == IOPRIO_CLASS_IDLE)
+		return false;
+
+	/* As in nvme_submit_io(), only the choice of queue needs the CPU */
+	nvmeq = get_nvmeq(ns->dev);
+	put_nvmeq(nvmeq);
+	if (!nvmeq || !ACCESS_ONCE(nvmeq->q_poll))
+		return false;
+
+	start = local_clock();
+	if (may_sleep)
+		slept = nvme_poll_sleep(nvmeq);
+	deadline = local_clock() + NVME_POLL_TIMEOUT_NS;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	if (slept)
+		nvmeq->poll_sleeps++;
+	for (;;) {
+		int found = 0;
+
+		if (nvmeq->q_poll && !nvmeq->q_suspended) {
+			nvmeq->poll_invoked++;
+			found = nvme_process_cq(nvmeq);
+		}
+		if (found) {
+			u64 lat = local_clock() - start;
+
+			nvmeq->poll_success++;
+			nvmeq->poll_lat_ns = nvmeq->poll_lat_ns ?
+				(nvmeq->poll_lat_ns * 7 + lat) >> 3 : lat;
+			spin_unlock_irq(&nvmeq->q_lock);
+			set_current_state(TASK_RUNNING);
+			return true;
+		}
+		if (!nvmeq->q_poll || need_resched() ||
+		    local_clock() > deadline) {
+			nvmeq->poll_timeouts++;
+			spin_unlock_irq(&nvmeq->q_lock);
+			return slept;
+		}
+		spin_unlock_irq(&nvmeq->q_lock);
+
+		if (!slept) {
+			if (signal_pending_state(state, current))
+				set_current_state(TASK_RUNNING);
+			/* Woken by a completion reaped elsewhere */
+			if (current->state == TASK_RUNNING)
+				return true;
+		}
+		cpu_relax();
+		spin_lock_irq(&nvmeq->q_lock);
+	}
 }
 
 static void nvme_make_request(struct request_queue *q, struct bio *bio)
@@ -814,7 +943,7 @@ static irqreturn_t nvme_irq(int irq, void *data)
 	irqreturn_t result;
 	struct nvme_queue *nvmeq = data;
 	spin_lock(&nvmeq->q_lock);
-	nvme_process_cq(nvmeq);
+	nvmeq->irq_cqes += nvme_process_cq(nvmeq);
 	result = nvmeq->cqe_seen ? IRQ_HANDLED : IRQ_NONE;
 	nvmeq->cqe_seen = 0;
 	spin_unlock(&nvmeq->q_lock);
@@ -1116,6 +1245,8 @@ static struct nvme_queue *nvme_alloc_queue(struct nvme_dev *dev, int qid,
 	nvmeq->q_db = &dev->dbs[qid << (dev->db_stride + 1)];
 	nvmeq->q_depth = depth;
 	nvmeq->cq_vector = vector;
+	nvmeq->qid = qid;
+	nvmeq->q_poll = qid && qid <= dev->poll_queues;
 	nvmeq->q_suspended = 1;
 	dev->queue_count++;
 
@@ -1680,6 +1811,7 @@ static struct nvme_ns *nvme_alloc_ns(struct nvme_dev *dev, unsigned nsid,
 	queue_flag_set_unlocked(QUEUE_FLAG_NOMERGES, ns->queue);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, ns->queue);
 	blk_queue_make_request(ns->queue, nvme_make_request);
+	blk_queue_poll(ns->queue, nvme_poll);
 	ns->dev = dev;
 	ns->queue->queuedata = ns;
 
@@ -2149,6 +2281,83 @@ static int nvme_dev_start(struct nvme_dev *dev)
 	return result;
 }
 
+static ssize_t nvme_poll_queues_show(struct device *d,
+				struct device_attribute *attr, char *buf)
+{
+	struct nvme_dev *dev = pci_get_drvdata(to_pci_dev(d));
+
+	return sprintf(buf, "%u\n", dev->poll_queues);
+}
+
+static ssize_t nvme_poll_queues_store(struct device *d,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct nvme_dev *dev = pci_get_drvdata(to_pci_dev(d));
+	unsigned int val;
+	int i, ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	spin_lock(&dev_list_lock);
+	dev->poll_queues = val;
+	for (i = 1; i < dev->queue_count; i++) {
+		struct nvme_queue *nvmeq = dev->queues[i];
+		if (!nvmeq)
+			continue;
+		spin_lock_irq(&nvmeq->q_lock);
+		nvmeq->q_poll = i <= val;
+		spin_unlock_irq(&nvmeq->q_lock);
+	}
+	spin_unlock(&dev_list_lock);
+	return count;
+}
+static DEVICE_ATTR(poll_queues, S_IRUGO | S_IWUSR, nvme_poll_queues_show,
+						nvme_poll_queues_store);
+
+/*
+ * One line per I/O queue: qid, polling enabled, poll loop iterations,
+ * polls that reaped a completion, hybrid sleeps, polls that gave up and
+ * left the waiter to the interrupt, completions found by the interrupt
+ * handler and the average polled latency in nanoseconds.
+ */
+static ssize_t nvme_poll_stats_show(struct device *d,
+				struct device_attribute *attr, char *buf)
+{
+	struct nvme_dev *dev = pci_get_drvdata(to_pci_dev(d));
+	ssize_t len = 0;
+	int i;
+
+	spin_lock(&dev_list_lock);
+	for (i = 1; i < dev->queue_count; i++) {
+		struct nvme_queue *nvmeq = dev->queues[i];
+		if (!nvmeq)
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"%u %u %lu %lu %lu %lu %lu %llu\n",
+				nvmeq->qid, nvmeq->q_poll,
+				nvmeq->poll_invoked, nvmeq->poll_success,
+				nvmeq->poll_sleeps, nvmeq->poll_timeouts,
+				nvmeq->irq_cqes,
+				(unsigned long long)nvmeq->poll_lat_ns);
+	}
+	spin_unlock(&dev_list_lock);
+	return len;
+}
+static DEVICE_ATTR(poll_stats, S_IRUGO, nvme_poll_stats_show, NULL);
+
+static struct attribute *nvme_dev_attrs[] = {
+	&dev_attr_poll_queues.attr,
+	&dev_attr_poll_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group nvme_dev_attr_group = {
+	.attrs = nvme_dev_attrs,
+};
+
 static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 {
 	int result = -ENOMEM;
@@ -2168,6 +2377,7 @@ static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 
 	INIT_LIST_HEAD(&dev->namespaces);
 	dev->pci_dev = pdev;
+	dev->poll_queues = poll_queues;
 	result = nvme_set_instance(dev);
 	if (result)
 		goto free;
@@ -2197,9 +2407,15 @@ static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	if (result)
 		goto remove;
 
+	result = sysfs_create_group(&pdev->dev.kobj, &nvme_dev_attr_group);
+	if (result)
+		goto deregister;
+
 	kref_init(&dev->kref);
 	return 0;
 
+ deregister:
+	misc_deregister(&dev->miscdev);
  remove:
 	nvme_dev_remove(dev);
  shutdown:
@@ -2219,6 +2435,7 @@ static int nvme_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 static void nvme_remove(struct pci_dev *pdev)
 {
 	struct nvme_dev *dev = pci_get_drvdata(pdev);
+	sysfs_remove_group(&pdev->dev.kobj, &nvme_dev_attr_group);
 	misc_deregister(&dev->miscdev);
 	kref_put(&dev->kref, nvme_free_dev);
 }
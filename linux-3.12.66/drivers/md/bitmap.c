@@ -186,12 +186,20 @@ static struct md_rdev *next_active_rdev(struct md_rdev *rdev, struct mddev *mdde
 	return NULL;
 }
 
-static int write_sb_page(struct bitmap *bitmap, struct page *page, int wait)
+/*
+ * write out nr bitmap pages that are consecutive in the bitmap (and so
+ * on disk) to every active device.  Each device gets a single request
+ * for the whole run where the queue allows it.
+ */
+static int write_sb_pages(struct bitmap *bitmap, struct page **pages,
+			  int nr, int wait)
 {
 	struct md_rdev *rdev = NULL;
 	struct block_device *bdev;
 	struct mddev *mddev = bitmap->mddev;
 	struct bitmap_storage *store = &bitmap->storage;
+	unsigned long first = pages[0]->index;
+	unsigned long last = pages[nr-1]->index;
 
 	while ((rdev = next_active_rdev(rdev, mddev)) != NULL) {
 		int size = PAGE_SIZE;
@@ -199,7 +207,7 @@ static int write_sb_page(struct bitmap *bitmap, struct page *page, int wait)
 
 		bdev = (rdev->meta_bdev) ? rdev->meta_bdev : rdev->bdev;
 
-		if (page->index == store->file_pages-1) {
+		if (last == store->file_pages-1) {
 			int last_page_size = store->bytes & (PAGE_SIZE-1);
 			if (last_page_size == 0)
 				last_page_size = PAGE_SIZE;
@@ -211,7 +219,7 @@ static int write_sb_page(struct bitmap *bitmap, struct page *page, int wait)
 		 */
 		if (mddev->external) {
 			/* Bitmap could be anywhere. */
-			if (rdev->sb_start + offset + (page->index
+			if (rdev->sb_start + offset + (last
 						       * (PAGE_SIZE/512))
 			    > rdev->data_offset
 			    &&
@@ -222,7 +230,7 @@ static int write_sb_page(struct bitmap *bitmap, struct page *page, int wait)
 		} else if (offset < 0) {
 			/* DATA  BITMAP METADATA  */
 			if (offset
-			    + (long)(page->index * (PAGE_SIZE/512))
+			    + (long)(last * (PAGE_SIZE/512))
 			    + size/512 > 0)
 				/* bitmap runs in to metadata */
 				goto bad_alignment;
@@ -234,18 +242,17 @@ static int write_sb_page(struct bitmap *bitmap, struct page *page, int wait)
 			/* METADATA BITMAP DATA */
 			if (rdev->sb_start
 			    + offset
-			    + page->index*(PAGE_SIZE/512) + size/512
+			    + last*(PAGE_SIZE/512) + size/512
 			    > rdev->data_offset)
 				/* bitmap runs in to data */
 				goto bad_alignment;
 		} else {
 			/* DATA METADATA BITMAP - no problems */
 		}
-		md_super_write(mddev, rdev,
-			       rdev->sb_start + offset
-			       + page->index * (PAGE_SIZE/512),
-			       size,
-			       page);
+		md_super_write_pages(mddev, rdev,
+				     rdev->sb_start + offset
+				     + first * (PAGE_SIZE/512),
+				     pages, nr, size);
 	}
 
 	if (wait)
@@ -256,6 +263,11 @@ static int write_sb_page(struct bitmap *bitmap, struct page *page, int wait)
 	return -EINVAL;
 }
 
+static int write_sb_page(struct bitmap *bitmap, struct page *page, int wait)
+{
+	return write_sb_pages(bitmap, &page, 1, wait);
+}
+
 static void bitmap_file_kick(struct bitmap *bitmap);
 /*
  * write out a page to a file
@@ -289,6 +301,17 @@ static void write_page(struct bitmap *bitmap, struct page *page, int wait)
 		bitmap_file_kick(bitmap);
 }
 
+/*
+ * write 'nr' dirty pages of an internal bitmap starting at 'pnum'
+ * without waiting for them
+ */
+static void bitmap_write_run(struct bitmap *bitmap, unsigned long pnum,
+			     unsigned long nr)
+{
+	if (write_sb_pages(bitmap, bitmap->storage.filemap + pnum, nr, 0))
+		set_bit(BITMAP_WRITE_ERROR, &bitmap->flags);
+}
+
 static void end_bitmap_write(struct buffer_head *bh, int uptodate)
 {
 	struct bitmap *bitmap = bh->b_private;
@@ -880,10 +903,15 @@ static void bitmap_file_clear_bit(struct bitmap *bitmap, sector_t block)
 
 /* this gets called when the md device is ready to unplug its underlying
  * (slave) device queues -- before we let any writes go down, we need to
- * sync the dirty pages of the bitmap file to disk */
+ * sync the dirty pages of the bitmap file to disk.
+ *
+ * Everything dirtied since the last unplug goes out together: for an
+ * internal bitmap each run of adjacent dirty pages becomes one request
+ * per device, and we wait once for the whole batch rather than per page.
+ */
 void bitmap_unplug(struct bitmap *bitmap)
 {
-	unsigned long i;
+	unsigned long i, run = 0;
 	int dirty, need_write;
 
 	if (!bitmap || !bitmap->storage.filemap ||
@@ -898,11 +926,20 @@ void bitmap_unplug(struct bitmap *bitmap)
 		dirty = test_and_clear_page_attr(bitmap, i, BITMAP_PAGE_DIRTY);
 		need_write = test_and_clear_page_attr(bitmap, i,
 						      BITMAP_PAGE_NEEDWRITE);
-		if (dirty || need_write) {
-			clear_page_attr(bitmap, i, BITMAP_PAGE_PENDING);
-			write_page(bitmap, bitmap->storage.filemap[i], 0);
+		if (!dirty && !need_write) {
+			if (run)
+				bitmap_write_run(bitmap, i - run, run);
+			run = 0;
+			continue;
 		}
+		clear_page_attr(bitmap, i, BITMAP_PAGE_PENDING);
+		if (bitmap->storage.file)
+			write_page(bitmap, bitmap->storage.filemap[i], 0);
+		else
+			run++;
 	}
+	if (run)
+		bitmap_write_run(bitmap, i - run, run);
 	if (bitmap->storage.file)
 		wait_event(bitmap->write_wait,
 			   atomic_read(&bitmap->pending_writes)==0);
@@ -8,6 +8,7 @@
 #include <linux/vmalloc.h>
 #include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/ktime.h>
 #include <linux/device-mapper.h>
 
 #include "dm.h"
@@ -29,14 +30,17 @@ struct dm_stat_percpu {
 	unsigned long long io_ticks[2];
 	unsigned long long io_ticks_total;
 	unsigned long long time_in_queue;
+	unsigned long long *histogram;
 };
 
 struct dm_stat_shared {
 	atomic_t in_flight[2];
-	unsigned long stamp;
+	unsigned long long stamp;
 	struct dm_stat_percpu tmp;
 };
 
+#define STAT_PRECISE_TIMESTAMPS		1
+
 struct dm_stat {
 	struct list_head list_entry;
 	int id;
@@ -44,11 +48,15 @@ struct dm_stat {
 	sector_t start;
 	sector_t end;
 	sector_t step;
+	unsigned stat_flags;
+	unsigned n_histogram_entries;
+	unsigned long long *histogram_boundaries;	/* in nanoseconds */
 	const char *program_id;
 	const char *aux_data;
 	struct rcu_head rcu_head;
 	size_t shared_alloc_size;
 	size_t percpu_alloc_size;
+	size_t histogram_alloc_size;
 	struct dm_stat_percpu *stat_percpu[NR_CPUS];
 	struct dm_stat_shared stat_shared[0];
 };
@@ -171,10 +179,16 @@ static void dm_stat_free(struct rcu_head *head)
 	int cpu;
 	struct dm_stat *s = container_of(head, struct dm_stat, rcu_head);
 
+	kfree(s->histogram_boundaries);
 	kfree(s->program_id);
 	kfree(s->aux_data);
-	for_each_possible_cpu(cpu)
+	for_each_possible_cpu(cpu) {
+		if (s->stat_percpu[cpu])
+			dm_kvfree(s->stat_percpu[cpu][0].histogram,
+				  s->histogram_alloc_size);
 		dm_kvfree(s->stat_percpu[cpu], s->percpu_alloc_size);
+	}
+	dm_kvfree(s->stat_shared[0].tmp.histogram, s->histogram_alloc_size);
 	dm_kvfree(s, s->shared_alloc_size);
 }
 
@@ -227,7 +241,10 @@ void dm_stats_cleanup(struct dm_stats *stats)
 }
 
 static int dm_stats_create(struct dm_stats *stats, sector_t start, sector_t end,
-			   sector_t step, const char *program_id, const char *aux_data,
+			   sector_t step, unsigned stat_flags,
+			   unsigned n_histogram_entries,
+			   unsigned long long *histogram_boundaries,
+			   const char *program_id, const char *aux_data,
 			   void (*suspend_callback)(struct mapped_device *),
 			   void (*resume_callback)(struct mapped_device *),
 			   struct mapped_device *md)
@@ -238,7 +255,9 @@ static int dm_stats_create(struct dm_stats *stats, sector_t start, sector_t end,
 	size_t ni;
 	size_t shared_alloc_size;
 	size_t percpu_alloc_size;
+	size_t histogram_alloc_size;
 	struct dm_stat_percpu *p;
+	unsigned long long *hi;
 	int cpu;
 	int ret_id;
 	int r;
@@ -261,7 +280,14 @@ static int dm_stats_create(struct dm_stats *stats, sector_t start, sector_t end,
 	if (percpu_alloc_size / sizeof(struct dm_stat_percpu) != n_entries)
 		return -EOVERFLOW;
 
-	if (!check_shared_memory(shared_alloc_size + num_possible_cpus() * percpu_alloc_size))
+	histogram_alloc_size = (n_histogram_entries + 1) * (size_t)n_entries * sizeof(unsigned long long);
+	if (histogram_alloc_size / (n_histogram_entries + 1) != (size_t)n_entries * sizeof(unsigned long long))
+		return -EOVERFLOW;
+	if (!n_histogram_entries)
+		histogram_alloc_size = 0;
+
+	if (!check_shared_memory(shared_alloc_size + histogram_alloc_size +
+				 num_possible_cpus() * (percpu_alloc_size + histogram_alloc_size)))
 		return -ENOMEM;
 
 	s = dm_kvzalloc(shared_alloc_size, NUMA_NO_NODE);
@@ -274,6 +300,19 @@ static int dm_stats_create(struct dm_stats *stats, sector_t start, sector_t end,
 	s->step = step;
 	s->shared_alloc_size = shared_alloc_size;
 	s->percpu_alloc_size = percpu_alloc_size;
+	s->histogram_alloc_size = histogram_alloc_size;
+
+	s->stat_flags = stat_flags;
+	s->n_histogram_entries = n_histogram_entries;
+	if (n_histogram_entries) {
+		s->histogram_boundaries = kmemdup(histogram_boundaries,
+						  n_histogram_entries * sizeof(unsigned long long),
+						  GFP_KERNEL);
+		if (!s->histogram_boundaries) {
+			r = -ENOMEM;
+			goto out;
+		}
+	}
 
 	s->program_id = kstrdup(program_id, GFP_KERNEL);
 	if (!s->program_id) {
@@ -291,6 +330,18 @@ static int dm_stats_create(struct dm_stats *stats, sector_t start, sector_t end,
 		atomic_set(&s->stat_shared[ni].in_flight[WRITE], 0);
 	}
 
+	if (n_histogram_entries) {
+		hi = dm_kvzalloc(histogram_alloc_size, NUMA_NO_NODE);
+		if (!hi) {
+			r = -ENOMEM;
+			goto out;
+		}
+		for (ni = 0; ni < n_entries; ni++) {
+			s->stat_shared[ni].tmp.histogram = hi;
+			hi += n_histogram_entries + 1;
+		}
+	}
+
 	for_each_possible_cpu(cpu) {
 		p = dm_kvzalloc(percpu_alloc_size, cpu_to_node(cpu));
 		if (!p) {
@@ -298,6 +349,17 @@ static int dm_stats_create(struct dm_stats *stats, sector_t start, sector_t end,
 			goto out;
 		}
 		s->stat_percpu[cpu] = p;
+		if (n_histogram_entries) {
+			hi = dm_kvzalloc(histogram_alloc_size, cpu_to_node(cpu));
+			if (!hi) {
+				r = -ENOMEM;
+				goto out;
+			}
+			for (ni = 0; ni < n_entries; ni++) {
+				p[ni].histogram = hi;
+				hi += n_histogram_entries + 1;
+			}
+		}
 	}
 
 	/*
@@ -375,9 +437,11 @@ static int dm_stats_delete(struct dm_stats *stats, int id)
 	 * vfree can't be called from RCU callback
 	 */
 	for_each_possible_cpu(cpu)
-		if (is_vmalloc_addr(s->stat_percpu))
+		if (is_vmalloc_addr(s->stat_percpu[cpu]) ||
+		    is_vmalloc_addr(s->stat_percpu[cpu][0].histogram))
 			goto do_sync_free;
-	if (is_vmalloc_addr(s)) {
+	if (is_vmalloc_addr(s) ||
+	    is_vmalloc_addr(s->stat_shared[0].tmp.histogram)) {
 do_sync_free:
 		synchronize_rcu_expedited();
 		dm_stat_free(&s->rcu_head);
@@ -398,18 +462,31 @@ static int dm_stats_list(struct dm_stats *stats, const char *program,
 	/*
 	 * Output format:
 	 *   <region_id>: <start_sector>+<length> <step> <program_id> <aux_data>
+	 *	[precise_timestamps] [histogram:<n1>ns,<n2>ns,...]
 	 */
 
 	mutex_lock(&stats->mutex);
 	list_for_each_entry(s, &stats->list, list_entry) {
 		if (!program || !strcmp(program, s->program_id)) {
 			len = s->end - s->start;
-			DMEMIT("%d: %llu+%llu %llu %s %s\n", s->id,
+			DMEMIT("%d: %llu+%llu %llu %s %s", s->id,
 				(unsigned long long)s->start,
 				(unsigned long long)len,
 				(unsigned long long)s->step,
 				s->program_id,
 				s->aux_data);
+			if (s->stat_flags & STAT_PRECISE_TIMESTAMPS)
+				DMEMIT(" precise_timestamps");
+			if (s->n_histogram_entries) {
+				unsigned i;
+				DMEMIT(" histogram:");
+				for (i = 0; i < s->n_histogram_entries; i++) {
+					if (i)
+						DMEMIT(",");
+					DMEMIT("%lluns", s->histogram_boundaries[i]);
+				}
+			}
+			DMEMIT("\n");
 		}
 	}
 	mutex_unlock(&stats->mutex);
@@ -417,15 +494,23 @@ static int dm_stats_list(struct dm_stats *stats, const char *program,
 	return 1;
 }
 
-static void dm_stat_round(struct dm_stat_shared *shared, struct dm_stat_percpu *p)
+static unsigned long long dm_stat_now(struct dm_stat *s)
+{
+	if (s->stat_flags & STAT_PRECISE_TIMESTAMPS)
+		return ktime_to_ns(ktime_get());
+	return jiffies;
+}
+
+static void dm_stat_round(struct dm_stat *s, struct dm_stat_shared *shared,
+			  struct dm_stat_percpu *p)
 {
 	/*
 	 * This is racy, but so is part_round_stats_single.
 	 */
-	unsigned long now = jiffies;
+	unsigned long long now = dm_stat_now(s);
 	unsigned in_flight_read;
 	unsigned in_flight_write;
-	unsigned long difference = now - shared->stamp;
+	unsigned long long difference = now - shared->stamp;
 
 	if (!difference)
 		return;
@@ -442,9 +527,30 @@ static void dm_stat_round(struct dm_stat_shared *shared, struct dm_stat_percpu *
 	shared->stamp = now;
 }
 
+/*
+ * Find the histogram bucket for an i/o that took 'duration_ns':
+ * bucket i counts the i/os with boundaries[i-1] <= duration < boundaries[i].
+ */
+static unsigned dm_stat_histogram_bucket(struct dm_stat *s,
+					 unsigned long long duration_ns)
+{
+	unsigned lo = 0, hi = s->n_histogram_entries + 1;
+
+	while (lo + 1 < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (s->histogram_boundaries[mid - 1] > duration_ns)
+			hi = mid;
+		else
+			lo = mid;
+	}
+
+	return lo;
+}
+
 static void dm_stat_for_entry(struct dm_stat *s, size_t entry,
-			      unsigned long bi_rw, sector_t len, bool merged,
-			      bool end, unsigned long duration)
+			      unsigned long bi_rw, sector_t len,
+			      struct dm_stats_aux *stats_aux, bool end,
+			      unsigned long duration_jiffies)
 {
 	unsigned long idx = bi_rw & REQ_WRITE;
 	struct dm_stat_shared *shared = &s->stat_shared[entry];
@@ -474,15 +580,27 @@ static void dm_stat_for_entry(struct dm_stat *s, size_t entry,
 	p = &s->stat_percpu[smp_processor_id()][entry];
 
 	if (!end) {
-		dm_stat_round(shared, p);
+		dm_stat_round(s, shared, p);
 		atomic_inc(&shared->in_flight[idx]);
 	} else {
-		dm_stat_round(shared, p);
+		unsigned long long duration, duration_ns;
+
+		dm_stat_round(s, shared, p);
 		atomic_dec(&shared->in_flight[idx]);
 		p->sectors[idx] += len;
 		p->ios[idx] += 1;
-		p->merges[idx] += merged;
+		p->merges[idx] += stats_aux->merged;
+		if (s->stat_flags & STAT_PRECISE_TIMESTAMPS) {
+			duration = stats_aux->duration_ns;
+			duration_ns = duration;
+		} else {
+			duration = duration_jiffies;
+			duration_ns = (unsigned long long)jiffies_to_msecs(duration_jiffies) *
+				      NSEC_PER_MSEC;
+		}
 		p->ticks[idx] += duration;
+		if (s->n_histogram_entries)
+			p->histogram[dm_stat_histogram_bucket(s, duration_ns)]++;
 	}
 
 #if BITS_PER_LONG == 32
@@ -523,7 +641,7 @@ static void __dm_stat_bio(struct dm_stat *s, unsigned long bi_rw,
 		if (fragment_len > s->step - offset)
 			fragment_len = s->step - offset;
 		dm_stat_for_entry(s, entry, bi_rw, fragment_len,
-				  stats_aux->merged, end, duration);
+				  stats_aux, end, duration);
 		todo -= fragment_len;
 		entry++;
 		offset = 0;
@@ -537,6 +655,7 @@ void dm_stats_account_io(struct dm_stats *stats, unsigned long bi_rw,
 	struct dm_stat *s;
 	sector_t end_sector;
 	struct dm_stats_last_position *last;
+	bool got_precise_time;
 
 	if (unlikely(!bi_sectors))
 		return;
@@ -560,8 +679,22 @@ void dm_stats_account_io(struct dm_stats *stats, unsigned long bi_rw,
 
 	rcu_read_lock();
 
-	list_for_each_entry_rcu(s, &stats->list, list_entry)
+	/*
+	 * Regions with precise timestamps share one ktime_get() per bio:
+	 * at submission duration_ns holds the start time, at completion it
+	 * is turned into the elapsed time.
+	 */
+	got_precise_time = false;
+	list_for_each_entry_rcu(s, &stats->list, list_entry) {
+		if (s->stat_flags & STAT_PRECISE_TIMESTAMPS && !got_precise_time) {
+			if (!end)
+				stats_aux->duration_ns = ktime_to_ns(ktime_get());
+			else
+				stats_aux->duration_ns = ktime_to_ns(ktime_get()) - stats_aux->duration_ns;
+			got_precise_time = true;
+		}
 		__dm_stat_bio(s, bi_rw, bi_sector, end_sector, end, duration, stats_aux);
+	}
 
 	rcu_read_unlock();
 }
@@ -570,14 +703,19 @@ static void __dm_stat_init_temporary_percpu_totals(struct dm_stat_shared *shared
 						   struct dm_stat *s, size_t x)
 {
 	int cpu;
+	unsigned i;
 	struct dm_stat_percpu *p;
+	unsigned long long *histogram = shared->tmp.histogram;
 
 	local_irq_disable();
 	p = &s->stat_percpu[smp_processor_id()][x];
-	dm_stat_round(shared, p);
+	dm_stat_round(s, shared, p);
 	local_irq_enable();
 
 	memset(&shared->tmp, 0, sizeof(shared->tmp));
+	shared->tmp.histogram = histogram;
+	if (s->n_histogram_entries)
+		memset(histogram, 0, (s->n_histogram_entries + 1) * sizeof(unsigned long long));
 	for_each_possible_cpu(cpu) {
 		p = &s->stat_percpu[cpu][x];
 		shared->tmp.sectors[READ] += ACCESS_ONCE(p->sectors[READ]);
@@ -592,6 +730,9 @@ static void __dm_stat_init_temporary_percpu_totals(struct dm_stat_shared *shared
 		shared->tmp.io_ticks[WRITE] += ACCESS_ONCE(p->io_ticks[WRITE]);
 		shared->tmp.io_ticks_total += ACCESS_ONCE(p->io_ticks_total);
 		shared->tmp.time_in_queue += ACCESS_ONCE(p->time_in_queue);
+		if (s->n_histogram_entries)
+			for (i = 0; i < s->n_histogram_entries + 1; i++)
+				histogram[i] += ACCESS_ONCE(p->histogram[i]);
 	}
 }
 
@@ -599,6 +740,7 @@ static void __dm_stat_clear(struct dm_stat *s, size_t idx_start, size_t idx_end,
 			    bool init_tmp_percpu_totals)
 {
 	size_t x;
+	unsigned i;
 	struct dm_stat_shared *shared;
 	struct dm_stat_percpu *p;
 
@@ -620,6 +762,9 @@ static void __dm_stat_clear(struct dm_stat *s, size_t idx_start, size_t idx_end,
 		p->io_ticks[WRITE] -= shared->tmp.io_ticks[WRITE];
 		p->io_ticks_total -= shared->tmp.io_ticks_total;
 		p->time_in_queue -= shared->tmp.time_in_queue;
+		if (s->n_histogram_entries)
+			for (i = 0; i < s->n_histogram_entries + 1; i++)
+				p->histogram[i] -= shared->tmp.histogram[i];
 		local_irq_enable();
 	}
 }
@@ -663,6 +808,17 @@ static unsigned long long dm_jiffies_to_msec64(unsigned long long j)
 	return result;
 }
 
+/*
+ * Regions with precise timestamps keep their times in nanoseconds and
+ * report them unconverted.
+ */
+static unsigned long long dm_stat_time(struct dm_stat *s, unsigned long long t)
+{
+	if (s->stat_flags & STAT_PRECISE_TIMESTAMPS)
+		return t;
+	return dm_jiffies_to_msec64(t);
+}
+
 static int dm_stats_print(struct dm_stats *stats, int id,
 			  size_t idx_start, size_t idx_len,
 			  bool clear, char *result, unsigned maxlen)
@@ -670,13 +826,14 @@ static int dm_stats_print(struct dm_stats *stats, int id,
 	unsigned sz = 0;
 	struct dm_stat *s;
 	size_t x;
+	unsigned i;
 	sector_t start, end, step;
 	size_t idx_end;
 	struct dm_stat_shared *shared;
 
 	/*
 	 * Output format:
-	 *   <start_sector>+<length> counters
+	 *   <start_sector>+<length> counters [<histogram_bucket>:...]
 	 */
 
 	mutex_lock(&stats->mutex);
@@ -706,22 +863,29 @@ static int dm_stats_print(struct dm_stats *stats, int id,
 
 		__dm_stat_init_temporary_percpu_totals(shared, s, x);
 
-		DMEMIT("%llu+%llu %llu %llu %llu %llu %llu %llu %llu %llu %d %llu %llu %llu %llu\n",
+		DMEMIT("%llu+%llu %llu %llu %llu %llu %llu %llu %llu %llu %d %llu %llu %llu %llu",
 		       (unsigned long long)start,
 		       (unsigned long long)step,
 		       shared->tmp.ios[READ],
 		       shared->tmp.merges[READ],
 		       shared->tmp.sectors[READ],
-		       dm_jiffies_to_msec64(shared->tmp.ticks[READ]),
+		       dm_stat_time(s, shared->tmp.ticks[READ]),
 		       shared->tmp.ios[WRITE],
 		       shared->tmp.merges[WRITE],
 		       shared->tmp.sectors[WRITE],
-		       dm_jiffies_to_msec64(shared->tmp.ticks[WRITE]),
+		       dm_stat_time(s, shared->tmp.ticks[WRITE]),
 		       dm_stat_in_flight(shared),
-		       dm_jiffies_to_msec64(shared->tmp.io_ticks_total),
-		       dm_jiffies_to_msec64(shared->tmp.time_in_queue),
-		       dm_jiffies_to_msec64(shared->tmp.io_ticks[READ]),
-		       dm_jiffies_to_msec64(shared->tmp.io_ticks[WRITE]));
+		       dm_stat_time(s, shared->tmp.io_ticks_total),
+		       dm_stat_time(s, shared->tmp.time_in_queue),
+		       dm_stat_time(s, shared->tmp.io_ticks[READ]),
+		       dm_stat_time(s, shared->tmp.io_ticks[WRITE]));
+
+		if (s->n_histogram_entries) {
+			for (i = 0; i < s->n_histogram_entries + 1; i++)
+				DMEMIT("%s%llu", !i ? " " : ":",
+				       shared->tmp.histogram[i]);
+		}
+		DMEMIT("\n");
 
 		if (unlikely(sz + 1 >= maxlen))
 			goto buffer_overflow;
@@ -763,6 +927,73 @@ static int dm_stats_set_aux(struct dm_stats *stats, int id, const char *aux_data
 	return 0;
 }
 
+/*
+ * Parse "<n1>[unit],<n2>[unit],..." into strictly increasing boundaries
+ * in nanoseconds.  The unit is one of ns, us, ms or s; milliseconds are
+ * assumed when it is omitted.
+ */
+static int parse_histogram(const char *h, unsigned *n_histogram_entries,
+			   unsigned long long **histogram_boundaries)
+{
+	const char *q;
+	char *copy, *p, *tok;
+	unsigned n = 1;
+	unsigned long long last = 0;
+	int r = -EINVAL;
+
+	for (q = h; *q; q++)
+		if (*q == ',')
+			n++;
+
+	*histogram_boundaries = kmalloc(n * sizeof(unsigned long long), GFP_KERNEL);
+	if (!*histogram_boundaries)
+		return -ENOMEM;
+
+	copy = p = kstrdup(h, GFP_KERNEL);
+	if (!copy) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	*n_histogram_entries = 0;
+	while ((tok = strsep(&p, ",")) != NULL) {
+		unsigned long long v, mult = NSEC_PER_MSEC;
+		char unit[3], dummy;
+		int c = sscanf(tok, "%llu%2s%c", &v, unit, &dummy);
+
+		if (c == 2) {
+			if (!strcmp(unit, "ns"))
+				mult = 1;
+			else if (!strcmp(unit, "us"))
+				mult = NSEC_PER_USEC;
+			else if (!strcmp(unit, "ms"))
+				mult = NSEC_PER_MSEC;
+			else if (!strcmp(unit, "s"))
+				mult = NSEC_PER_SEC;
+			else
+				goto out;
+		} else if (c != 1)
+			goto out;
+
+		if (v > ULLONG_MAX / mult)
+			goto out;
+		v *= mult;
+		if (v <= last)
+			goto out;
+		last = v;
+		(*histogram_boundaries)[(*n_histogram_entries)++] = v;
+	}
+	r = 0;
+
+out:
+	kfree(copy);
+	if (r) {
+		kfree(*histogram_boundaries);
+		*histogram_boundaries = NULL;
+	}
+	return r;
+}
+
 static int message_stats_create(struct mapped_device *md,
 				unsigned argc, char **argv,
 				char *result, unsigned maxlen)
@@ -772,13 +1003,22 @@ static int message_stats_create(struct mapped_device *md,
 	unsigned long long start, end, len, step;
 	unsigned divisor;
 	const char *program_id, *aux_data;
+	unsigned stat_flags = 0;
+	unsigned n_histogram_entries = 0;
+	unsigned long long *histogram_boundaries = NULL;
+	unsigned feature_args;
+	unsigned i = 3;
+	int r;
 
 	/*
 	 * Input format:
-	 *   <range> <step> [<program_id> [<aux_data>]]
+	 *   <range> <step> [<extra_parameters> <parameters>] [<program_id> [<aux_data>]]
+	 *
+	 * where the extra parameters are "precise_timestamps" and
+	 * "histogram:<n1>,<n2>,..."
 	 */
 
-	if (argc < 3 || argc > 5)
+	if (argc < 3)
 		return -EINVAL;
 
 	if (!strcmp(argv[1], "-")) {
@@ -806,14 +1046,37 @@ static int message_stats_create(struct mapped_device *md,
 		   step != (sector_t)step || !step)
 		return -EINVAL;
 
+	if (argc > 3 && sscanf(argv[3], "%u%c", &feature_args, &dummy) == 1) {
+		i = 4;
+		if (feature_args > argc - i)
+			return -EINVAL;
+		while (feature_args--) {
+			const char *a = argv[i++];
+
+			if (!strcasecmp(a, "precise_timestamps"))
+				stat_flags |= STAT_PRECISE_TIMESTAMPS;
+			else if (!strncasecmp(a, "histogram:", 10) &&
+				 !histogram_boundaries) {
+				r = parse_histogram(a + 10, &n_histogram_entries,
+						    &histogram_boundaries);
+				if (r)
+					return r;
+			} else
+				goto out_einval;
+		}
+	}
+
+	if (argc - i > 2)
+		goto out_einval;
+
 	program_id = "-";
 	aux_data = "-";
 
-	if (argc > 3)
-		program_id = argv[3];
+	if (argc > i)
+		program_id = argv[i];
 
-	if (argc > 4)
-		aux_data = argv[4];
+	if (argc > i + 1)
+		aux_data = argv[i + 1];
 
 	/*
 	 * If a buffer overflow happens after we created the region,
@@ -822,17 +1085,30 @@ static int message_stats_create(struct mapped_device *md,
 	 * leaked).  So we must detect buffer overflow in advance.
 	 */
 	snprintf(result, maxlen, "%d", INT_MAX);
-	if (dm_message_test_buffer_overflow(result, maxlen))
-		return 1;
+	if (dm_message_test_buffer_overflow(result, maxlen)) {
+		r = 1;
+		goto out;
+	}
 
-	id = dm_stats_create(dm_get_stats(md), start, end, step, program_id, aux_data,
+	id = dm_stats_create(dm_get_stats(md), start, end, step, stat_flags,
+			     n_histogram_entries, histogram_boundaries,
+			     program_id, aux_data,
 			     dm_internal_suspend, dm_internal_resume, md);
-	if (id < 0)
-		return id;
+	if (id < 0) {
+		r = id;
+		goto out;
+	}
 
 	snprintf(result, maxlen, "%d", id);
 
-	return 1;
+	r = 1;
+	goto out;
+
+out_einval:
+	r = -EINVAL;
+out:
+	kfree(histogram_boundaries);
+	return r;
 }
 
 static int message_stats_delete(struct mapped_device *md,
@@ -1465,6 +1465,30 @@ int dm_thin_insert_block(struct dm_thin_device *td, dm_block_t block,
 	return r;
 }
 
+int dm_pool_insert_blocks(struct dm_pool_metadata *pmd,
+			  struct dm_thin_insert *ins, unsigned nr,
+			  unsigned *nr_done)
+{
+	int r = -EINVAL;
+	unsigned i = 0;
+
+	down_write(&pmd->root_lock);
+	if (!pmd->fail_io) {
+		r = 0;
+		for (i = 0; i < nr; i++) {
+			r = __insert(ins[i].td, ins[i].virt_block,
+				     ins[i].data_block);
+			if (r)
+				break;
+		}
+	}
+	up_write(&pmd->root_lock);
+
+	*nr_done = i;
+
+	return r;
+}
+
 static int __remove(struct dm_thin_device *td, dm_block_t block)
 {
 	int r;
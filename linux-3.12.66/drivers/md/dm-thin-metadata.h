@@ -156,6 +156,21 @@ int dm_thin_insert_block(struct dm_thin_device *td, dm_block_t block,
 
 int dm_thin_remove_block(struct dm_thin_device *td, dm_block_t block);
 
+/*
+ * Insert a batch of mappings, possibly for different thin devices, taking
+ * the metadata lock only once.  Stops at the first error; *nr_done is set
+ * to the number of mappings inserted before it.
+ */
+struct dm_thin_insert {
+	struct dm_thin_device *td;
+	dm_block_t virt_block;
+	dm_block_t data_block;
+};
+
+int dm_pool_insert_blocks(struct dm_pool_metadata *pmd,
+			  struct dm_thin_insert *ins, unsigned nr,
+			  unsigned *nr_done);
+
 /*
  * Queries.
  */
@@ -176,8 +176,10 @@ struct pool {
 	unsigned long last_commit_jiffies;
 	unsigned ref_count;
 
+	struct mutex mode_lock;	/* serialises set_pool_mode() */
+
 	spinlock_t lock;
-	struct bio_list deferred_bios;
+	struct list_head active_thins;
 	struct bio_list deferred_flush_bios;
 	struct list_head prepared_mappings;
 	struct list_head prepared_discards;
@@ -187,7 +189,6 @@ struct pool {
 	struct dm_deferred_set *shared_read_ds;
 	struct dm_deferred_set *all_io_ds;
 
-	struct dm_thin_new_mapping *next_mapping;
 	mempool_t *mapping_pool;
 
 	process_bio_fn process_bio;
@@ -219,25 +220,61 @@ struct pool_c {
  * Target context for a thin.
  */
 struct thin_c {
+	struct list_head list;	/* on pool->active_thins */
 	struct dm_dev *pool_dev;
 	struct dm_dev *origin_dev;
 	dm_thin_id dev_id;
 
 	struct pool *pool;
 	struct dm_thin_device *td;
+
+	/*
+	 * Each thin device has its own deferred bio list and worker, so
+	 * bios for different thins are processed concurrently.
+	 */
+	spinlock_t lock;
+	struct bio_list deferred_bio_list;
+	struct work_struct worker;
+	struct dm_thin_new_mapping *next_mapping;
 };
 
 /*----------------------------------------------------------------*/
 
 /*
  * wake_worker() is used when new work is queued and when pool_resume is
- * ready to continue deferred IO processing.
+ * ready to continue deferred IO processing.  The pool worker completes
+ * prepared mappings and discards and commits the metadata; the bios
+ * themselves are handled by the per-thin workers.
  */
 static void wake_worker(struct pool *pool)
 {
 	queue_work(pool->wq, &pool->worker);
 }
 
+static void wake_thin_worker(struct thin_c *tc)
+{
+	queue_work(tc->pool->wq, &tc->worker);
+}
+
+/*
+ * Kick every thin that still has deferred bios, e.g. ones that backed
+ * off because the mapping pool was empty.
+ */
+static void wake_thin_workers(struct pool *pool)
+{
+	struct thin_c *tc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_for_each_entry(tc, &pool->active_thins, list)
+		if (!bio_list_empty(&tc->deferred_bio_list))
+			wake_thin_worker(tc);
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+static void thin_defer_bio(struct thin_c *tc, struct bio *bio);
+static void thin_defer_bios(struct bio_list *bios);
+
 /*----------------------------------------------------------------*/
 
 static int bio_detain(struct pool *pool, struct dm_cell_key *key, struct bio *bio,
@@ -282,14 +319,11 @@ static void cell_release_no_holder(struct pool *pool,
 static void cell_defer_no_holder_no_free(struct thin_c *tc,
 					 struct dm_bio_prison_cell *cell)
 {
-	struct pool *pool = tc->pool;
-	unsigned long flags;
-
-	spin_lock_irqsave(&pool->lock, flags);
-	dm_cell_release_no_holder(pool->prison, cell, &pool->deferred_bios);
-	spin_unlock_irqrestore(&pool->lock, flags);
+	struct bio_list bios;
 
-	wake_worker(pool);
+	bio_list_init(&bios);
+	dm_cell_release_no_holder(tc->pool->prison, cell, &bios);
+	thin_defer_bios(&bios);
 }
 
 static void cell_error(struct pool *pool,
@@ -392,8 +426,11 @@ static void requeue_io(struct thin_c *tc)
 	struct pool *pool = tc->pool;
 	unsigned long flags;
 
+	spin_lock_irqsave(&tc->lock, flags);
+	__requeue_bio_list(tc, &tc->deferred_bio_list);
+	spin_unlock_irqrestore(&tc->lock, flags);
+
 	spin_lock_irqsave(&pool->lock, flags);
-	__requeue_bio_list(tc, &pool->deferred_bios);
 	__requeue_bio_list(tc, &pool->retry_on_resume_list);
 	spin_unlock_irqrestore(&pool->lock, flags);
 }
@@ -481,11 +518,13 @@ static void issue(struct thin_c *tc, struct bio *bio)
 
 	/*
 	 * Batch together any bios that trigger commits and then issue a
-	 * single commit for them in process_deferred_bios().
+	 * single commit for them in process_deferred_flush_bios().
 	 */
 	spin_lock_irqsave(&pool->lock, flags);
 	bio_list_add(&pool->deferred_flush_bios, bio);
 	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
 }
 
 static void remap_to_origin_and_issue(struct thin_c *tc, struct bio *bio)
@@ -513,6 +552,7 @@ struct dm_thin_new_mapping {
 	unsigned prepared:1;
 	unsigned pass_discard:1;
 	unsigned definitely_not_shared:1;
+	unsigned inserted:1;
 
 	struct thin_c *tc;
 	dm_block_t virt_block;
@@ -580,18 +620,16 @@ static void overwrite_endio(struct bio *bio, int err)
  */
 
 /*
- * This sends the bios in the cell back to the deferred_bios list.
+ * This sends the bios in the cell back to the deferred lists of their
+ * thin devices.  A data block cell may hold bios from several thins.
  */
 static void cell_defer(struct thin_c *tc, struct dm_bio_prison_cell *cell)
 {
-	struct pool *pool = tc->pool;
-	unsigned long flags;
-
-	spin_lock_irqsave(&pool->lock, flags);
-	cell_release(pool, cell, &pool->deferred_bios);
-	spin_unlock_irqrestore(&tc->pool->lock, flags);
+	struct bio_list bios;
 
-	wake_worker(pool);
+	bio_list_init(&bios);
+	cell_release(tc->pool, cell, &bios);
+	thin_defer_bios(&bios);
 }
 
 /*
@@ -599,14 +637,11 @@ static void cell_defer(struct thin_c *tc, struct dm_bio_prison_cell *cell)
  */
 static void cell_defer_no_holder(struct thin_c *tc, struct dm_bio_prison_cell *cell)
 {
-	struct pool *pool = tc->pool;
-	unsigned long flags;
-
-	spin_lock_irqsave(&pool->lock, flags);
-	cell_release_no_holder(pool, cell, &pool->deferred_bios);
-	spin_unlock_irqrestore(&pool->lock, flags);
+	struct bio_list bios;
 
-	wake_worker(pool);
+	bio_list_init(&bios);
+	cell_release_no_holder(tc->pool, cell, &bios);
+	thin_defer_bios(&bios);
 }
 
 static void process_prepared_mapping_fail(struct dm_thin_new_mapping *m)
@@ -635,11 +670,13 @@ static void process_prepared_mapping(struct dm_thin_new_mapping *m)
 	}
 
 	/*
-	 * Commit the prepared block into the mapping btree.
+	 * Commit the prepared block into the mapping btree, unless
+	 * insert_prepared_mappings() already did.
 	 * Any I/O for this block arriving after this point will get
 	 * remapped to it directly.
 	 */
-	r = dm_thin_insert_block(tc->td, m->virt_block, m->data_block);
+	r = m->inserted ? 0 : dm_thin_insert_block(tc->td, m->virt_block,
+						   m->data_block);
 	if (r) {
 		DMERR_LIMIT("%s: dm_thin_insert_block() failed: error = %d",
 			    dm_device_name(pool->pool_md), r);
@@ -711,20 +748,85 @@ static void process_prepared_discard(struct dm_thin_new_mapping *m)
 	process_prepared_discard_passdown(m);
 }
 
+#define INSERT_BATCH 16
+
+static int insert_batch(struct pool *pool, struct dm_thin_insert *ins,
+			struct dm_thin_new_mapping **batch, unsigned nr)
+{
+	unsigned i, done;
+	int r;
+
+	r = dm_pool_insert_blocks(pool->pmd, ins, nr, &done);
+	for (i = 0; i < done; i++)
+		batch[i]->inserted = 1;
+	if (r) {
+		DMERR_LIMIT("%s: dm_pool_insert_blocks() failed: error = %d",
+			    dm_device_name(pool->pool_md), r);
+		set_pool_mode(pool, PM_READ_ONLY);
+	}
+
+	return r;
+}
+
+/*
+ * Add the btree entries for a list of prepared mappings, taking the
+ * metadata lock once per INSERT_BATCH mappings rather than once each.
+ * On failure the pool drops to read-only mode, which aborts the
+ * transaction, and an error is returned: the caller must then fail the
+ * whole list, including the mappings inserted before the failure.
+ */
+static int insert_prepared_mappings(struct pool *pool, struct list_head *maps)
+{
+	struct dm_thin_insert ins[INSERT_BATCH];
+	struct dm_thin_new_mapping *batch[INSERT_BATCH];
+	struct dm_thin_new_mapping *m;
+	unsigned nr = 0;
+
+	list_for_each_entry(m, maps, list) {
+		if (m->err)
+			continue;
+
+		ins[nr].td = m->tc->td;
+		ins[nr].virt_block = m->virt_block;
+		ins[nr].data_block = m->data_block;
+		batch[nr++] = m;
+
+		if (nr == INSERT_BATCH) {
+			if (insert_batch(pool, ins, batch, nr))
+				return -EIO;
+			nr = 0;
+		}
+	}
+
+	if (nr && insert_batch(pool, ins, batch, nr))
+		return -EIO;
+
+	return 0;
+}
+
 static void process_prepared(struct pool *pool, struct list_head *head,
 			     process_mapping_fn *fn)
 {
 	unsigned long flags;
 	struct list_head maps;
 	struct dm_thin_new_mapping *m, *tmp;
+	process_mapping_fn process = *fn;
 
 	INIT_LIST_HEAD(&maps);
 	spin_lock_irqsave(&pool->lock, flags);
 	list_splice_init(head, &maps);
 	spin_unlock_irqrestore(&pool->lock, flags);
 
+	if (process == process_prepared_mapping &&
+	    insert_prepared_mappings(pool, &maps))
+		/*
+		 * The failed insert switched the pool to read-only mode:
+		 * re-read the function so that the whole batch is failed.
+		 */
+		process = *fn;
+
 	list_for_each_entry_safe(m, tmp, &maps, list)
-		(*fn)(m);
+		process(m);
 }
 
 /*
@@ -748,27 +850,27 @@ static void save_and_set_endio(struct bio *bio, bio_end_io_t **save,
 	bio->bi_end_io = fn;
 }
 
-static int ensure_next_mapping(struct pool *pool)
+static int ensure_next_mapping(struct thin_c *tc)
 {
-	if (pool->next_mapping)
+	if (tc->next_mapping)
 		return 0;
 
-	pool->next_mapping = mempool_alloc(pool->mapping_pool, GFP_ATOMIC);
+	tc->next_mapping = mempool_alloc(tc->pool->mapping_pool, GFP_ATOMIC);
 
-	return pool->next_mapping ? 0 : -ENOMEM;
+	return tc->next_mapping ? 0 : -ENOMEM;
 }
 
-static struct dm_thin_new_mapping *get_next_mapping(struct pool *pool)
+static struct dm_thin_new_mapping *get_next_mapping(struct thin_c *tc)
 {
-	struct dm_thin_new_mapping *m = pool->next_mapping;
+	struct dm_thin_new_mapping *m = tc->next_mapping;
 
-	BUG_ON(!pool->next_mapping);
+	BUG_ON(!tc->next_mapping);
 
 	memset(m, 0, sizeof(struct dm_thin_new_mapping));
 	INIT_LIST_HEAD(&m->list);
 	m->bio = NULL;
 
-	pool->next_mapping = NULL;
+	tc->next_mapping = NULL;
 
 	return m;
 }
@@ -780,7 +882,7 @@ static void schedule_copy(struct thin_c *tc, dm_block_t virt_block,
 {
 	int r;
 	struct pool *pool = tc->pool;
-	struct dm_thin_new_mapping *m = get_next_mapping(pool);
+	struct dm_thin_new_mapping *m = get_next_mapping(tc);
 
 	m->tc = tc;
 	m->virt_block = virt_block;
@@ -846,7 +948,7 @@ static void schedule_zero(struct thin_c *tc, dm_block_t virt_block,
 			  struct bio *bio)
 {
 	struct pool *pool = tc->pool;
-	struct dm_thin_new_mapping *m = get_next_mapping(pool);
+	struct dm_thin_new_mapping *m = get_next_mapping(tc);
 
 	m->quiesced = 1;
 	m->prepared = 0;
@@ -1043,7 +1145,7 @@ static void process_discard(struct thin_c *tc, struct bio *bio)
 			 * IO may still be going to the destination block.  We must
 			 * quiesce before we can do the removal.
 			 */
-			m = get_next_mapping(pool);
+			m = get_next_mapping(tc);
 			m->tc = tc;
 			m->pass_discard = pool->pf.discard_passdown;
 			m->definitely_not_shared = !lookup_result.shared;
@@ -1308,33 +1410,34 @@ static int need_commit_due_to_time(struct pool *pool)
 	       jiffies > pool->last_commit_jiffies + COMMIT_PERIOD;
 }
 
-static void process_deferred_bios(struct pool *pool)
+static void process_thin_deferred_bios(struct thin_c *tc)
 {
+	struct pool *pool = tc->pool;
 	unsigned long flags;
 	struct bio *bio;
 	struct bio_list bios;
 
 	bio_list_init(&bios);
 
-	spin_lock_irqsave(&pool->lock, flags);
-	bio_list_merge(&bios, &pool->deferred_bios);
-	bio_list_init(&pool->deferred_bios);
-	spin_unlock_irqrestore(&pool->lock, flags);
+	spin_lock_irqsave(&tc->lock, flags);
+	bio_list_merge(&bios, &tc->deferred_bio_list);
+	bio_list_init(&tc->deferred_bio_list);
+	spin_unlock_irqrestore(&tc->lock, flags);
 
 	while ((bio = bio_list_pop(&bios))) {
-		struct dm_thin_endio_hook *h = dm_per_bio_data(bio, sizeof(struct dm_thin_endio_hook));
-		struct thin_c *tc = h->tc;
-
 		/*
 		 * If we've got no free new_mapping structs, and processing
 		 * this bio might require one, we pause until there are some
-		 * prepared mappings to process.
+		 * prepared mappings to process.  The pool worker wakes us
+		 * once it has freed some.
 		 */
-		if (ensure_next_mapping(pool)) {
-			spin_lock_irqsave(&pool->lock, flags);
-			bio_list_add(&pool->deferred_bios, bio);
-			bio_list_merge(&pool->deferred_bios, &bios);
-			spin_unlock_irqrestore(&pool->lock, flags);
+		if (ensure_next_mapping(tc)) {
+			spin_lock_irqsave(&tc->lock, flags);
+			bio_list_add_head(&bios, bio);
+			bio_list_merge(&bios, &tc->deferred_bio_list);
+			bio_list_init(&tc->deferred_bio_list);
+			bio_list_merge(&tc->deferred_bio_list, &bios);
+			spin_unlock_irqrestore(&tc->lock, flags);
 			break;
 		}
 
@@ -1343,6 +1446,13 @@ static void process_deferred_bios(struct pool *pool)
 		else
 			pool->process_bio(tc, bio);
 	}
+}
+
+static void process_deferred_flush_bios(struct pool *pool)
+{
+	unsigned long flags;
+	struct bio *bio;
+	struct bio_list bios;
 
 	/*
 	 * If there are any deferred flush bios, we must commit
@@ -1375,7 +1485,15 @@ static void do_worker(struct work_struct *ws)
 
 	process_prepared(pool, &pool->prepared_mappings, &pool->process_prepared_mapping);
 	process_prepared(pool, &pool->prepared_discards, &pool->process_prepared_discard);
-	process_deferred_bios(pool);
+	wake_thin_workers(pool);
+	process_deferred_flush_bios(pool);
+}
+
+static void do_thin_worker(struct work_struct *ws)
+{
+	struct thin_c *tc = container_of(ws, struct thin_c, worker);
+
+	process_thin_deferred_bios(tc);
 }
 
 /*
@@ -1386,6 +1504,7 @@ static void do_waker(struct work_struct *ws)
 {
 	struct pool *pool = container_of(to_delayed_work(ws), struct pool, waker);
 	wake_worker(pool);
+	wake_thin_workers(pool);
 	queue_delayed_work(pool->wq, &pool->waker, COMMIT_PERIOD);
 }
 
@@ -1396,7 +1515,7 @@ static enum pool_mode get_pool_mode(struct pool *pool)
 	return pool->pf.mode;
 }
 
-static void set_pool_mode(struct pool *pool, enum pool_mode new_mode)
+static void __set_pool_mode(struct pool *pool, enum pool_mode new_mode)
 {
 	int r;
 	enum pool_mode old_mode = pool->pf.mode;
@@ -1422,7 +1541,7 @@ static void set_pool_mode(struct pool *pool, enum pool_mode new_mode)
 			DMERR("%s: aborting transaction failed",
 			      dm_device_name(pool->pool_md));
 			new_mode = PM_FAIL;
-			set_pool_mode(pool, new_mode);
+			__set_pool_mode(pool, new_mode);
 		} else {
 			dm_pool_metadata_read_only(pool->pmd);
 			pool->process_bio = process_bio_read_only;
@@ -1447,6 +1566,17 @@ static void set_pool_mode(struct pool *pool, enum pool_mode new_mode)
 	pool->pf.mode = new_mode;
 }
 
+/*
+ * Several thin workers may hit metadata errors at once, so mode changes
+ * are serialised.
+ */
+static void set_pool_mode(struct pool *pool, enum pool_mode new_mode)
+{
+	mutex_lock(&pool->mode_lock);
+	__set_pool_mode(pool, new_mode);
+	mutex_unlock(&pool->mode_lock);
+}
+
 /*----------------------------------------------------------------*/
 
 /*
@@ -1454,18 +1584,31 @@ static void set_pool_mode(struct pool *pool, enum pool_mode new_mode)
  */
 
 /*
- * Called only while mapping a thin bio to hand it over to the workqueue.
+ * Hand a thin bio over to its device's worker.
  */
 static void thin_defer_bio(struct thin_c *tc, struct bio *bio)
 {
 	unsigned long flags;
-	struct pool *pool = tc->pool;
 
-	spin_lock_irqsave(&pool->lock, flags);
-	bio_list_add(&pool->deferred_bios, bio);
-	spin_unlock_irqrestore(&pool->lock, flags);
+	spin_lock_irqsave(&tc->lock, flags);
+	bio_list_add(&tc->deferred_bio_list, bio);
+	spin_unlock_irqrestore(&tc->lock, flags);
 
-	wake_worker(pool);
+	wake_thin_worker(tc);
+}
+
+/*
+ * Route each bio back to the thin device that it was issued to.
+ */
+static void thin_defer_bios(struct bio_list *bios)
+{
+	struct bio *bio;
+
+	while ((bio = bio_list_pop(bios))) {
+		struct dm_thin_endio_hook *h = dm_per_bio_data(bio, sizeof(struct dm_thin_endio_hook));
+
+		thin_defer_bio(h->tc, bio);
+	}
 }
 
 static void thin_hook_bio(struct thin_c *tc, struct bio *bio)
@@ -1603,9 +1746,9 @@ static int pool_is_congested(struct dm_target_callbacks *cb, int bdi_bits)
 	return r;
 }
 
-static void __requeue_bios(struct pool *pool)
+static void __requeue_bios(struct pool *pool, struct bio_list *bios)
 {
-	bio_list_merge(&pool->deferred_bios, &pool->retry_on_resume_list);
+	bio_list_merge(bios, &pool->retry_on_resume_list);
 	bio_list_init(&pool->retry_on_resume_list);
 }
 
@@ -1725,8 +1868,6 @@ static void __pool_destroy(struct pool *pool)
 	if (pool->wq)
 		destroy_workqueue(pool->wq);
 
-	if (pool->next_mapping)
-		mempool_free(pool->next_mapping, pool->mapping_pool);
 	mempool_destroy(pool->mapping_pool);
 	dm_deferred_set_destroy(pool->shared_read_ds);
 	dm_deferred_set_destroy(pool->all_io_ds);
@@ -1783,10 +1924,12 @@ static struct pool *pool_create(struct mapped_device *pool_md,
 	}
 
 	/*
-	 * Create singlethreaded workqueue that will service all devices
-	 * that use this metadata.
+	 * Create the workqueue that will service all devices that use this
+	 * metadata.  It is not ordered: the pool worker and the worker of
+	 * each thin device may run concurrently, though no work item ever
+	 * runs concurrently with itself.
 	 */
-	pool->wq = alloc_ordered_workqueue("dm-" DM_MSG_PREFIX, WQ_MEM_RECLAIM);
+	pool->wq = alloc_workqueue("dm-" DM_MSG_PREFIX, WQ_MEM_RECLAIM, 0);
 	if (!pool->wq) {
 		*error = "Error creating pool's workqueue";
 		err_p = ERR_PTR(-ENOMEM);
@@ -1795,8 +1938,9 @@ static struct pool *pool_create(struct mapped_device *pool_md,
 
 	INIT_WORK(&pool->worker, do_worker);
 	INIT_DELAYED_WORK(&pool->waker, do_waker);
+	mutex_init(&pool->mode_lock);
 	spin_lock_init(&pool->lock);
-	bio_list_init(&pool->deferred_bios);
+	INIT_LIST_HEAD(&pool->active_thins);
 	bio_list_init(&pool->deferred_flush_bios);
 	INIT_LIST_HEAD(&pool->prepared_mappings);
 	INIT_LIST_HEAD(&pool->prepared_discards);
@@ -1818,7 +1962,6 @@ static struct pool *pool_create(struct mapped_device *pool_md,
 		goto bad_all_io_ds;
 	}
 
-	pool->next_mapping = NULL;
 	pool->mapping_pool = mempool_create_slab_pool(MAPPING_POOL_SIZE,
 						      _new_mapping_cache);
 	if (!pool->mapping_pool) {
@@ -2316,13 +2459,18 @@ static void pool_resume(struct dm_target *ti)
 	struct pool_c *pt = ti->private;
 	struct pool *pool = pt->pool;
 	unsigned long flags;
+	struct bio_list bios;
+
+	bio_list_init(&bios);
 
 	spin_lock_irqsave(&pool->lock, flags);
 	pool->low_water_triggered = 0;
 	pool->no_free_space = 0;
-	__requeue_bios(pool);
+	__requeue_bios(pool, &bios);
 	spin_unlock_irqrestore(&pool->lock, flags);
 
+	thin_defer_bios(&bios);
+
 	do_waker(&pool->waker.work);
 }
 
@@ -2777,6 +2925,14 @@ static struct target_type pool_target = {
 static void thin_dtr(struct dm_target *ti)
 {
 	struct thin_c *tc = ti->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tc->pool->lock, flags);
+	list_del(&tc->list);
+	spin_unlock_irqrestore(&tc->pool->lock, flags);
+	flush_work(&tc->worker);
+	if (tc->next_mapping)
+		mempool_free(tc->next_mapping, tc->pool->mapping_pool);
 
 	mutex_lock(&dm_thin_pool_table.mutex);
 
@@ -2805,6 +2961,7 @@ static void thin_dtr(struct dm_target *ti)
 static int thin_ctr(struct dm_target *ti, unsigned argc, char **argv)
 {
 	int r;
+	unsigned long flags;
 	struct thin_c *tc;
 	struct dm_dev *pool_dev, *origin_dev;
 	struct mapped_device *pool_md;
@@ -2823,6 +2980,9 @@ static int thin_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		r = -ENOMEM;
 		goto out_unlock;
 	}
+	spin_lock_init(&tc->lock);
+	bio_list_init(&tc->deferred_bio_list);
+	INIT_WORK(&tc->worker, do_thin_worker);
 
 	if (argc == 3) {
 		r = dm_get_device(ti, argv[2], FMODE_READ, &origin_dev);
@@ -2892,6 +3052,10 @@ static int thin_ctr(struct dm_target *ti, unsigned argc, char **argv)
 
 	dm_put(pool_md);
 
+	spin_lock_irqsave(&tc->pool->lock, flags);
+	list_add_tail(&tc->list, &tc->pool->active_thins);
+	spin_unlock_irqrestore(&tc->pool->lock, flags);
+
 	mutex_unlock(&dm_thin_pool_table.mutex);
 
 	return 0;
@@ -795,6 +795,54 @@ void md_super_write(struct mddev *mddev, struct md_rdev *rdev,
 	submit_bio(WRITE_FLUSH_FUA, bio);
 }
 
+/*
+ * Write a run of pages that are contiguous on the device with as few
+ * bios as the queue limits allow.  Only the last page may be partial.
+ * Completion accounting is the same as for md_super_write.
+ */
+void md_super_write_pages(struct mddev *mddev, struct md_rdev *rdev,
+			  sector_t sector, struct page **pages, int nr,
+			  int last_size)
+{
+	struct block_device *bdev = rdev->meta_bdev ? rdev->meta_bdev
+						    : rdev->bdev;
+	struct bio *bio = NULL;
+	int i = 0;
+
+	while (i < nr) {
+		int size = (i == nr - 1) ? last_size : PAGE_SIZE;
+
+		if (!bio) {
+			bio = bio_alloc_mddev(GFP_NOIO,
+					      min(nr - i, BIO_MAX_PAGES),
+					      mddev);
+			bio->bi_bdev = bdev;
+			bio->bi_sector = sector;
+			bio->bi_private = rdev;
+			bio->bi_end_io = super_written;
+		}
+		if (bio_add_page(bio, pages[i], size, 0) == size) {
+			sector += size >> 9;
+			i++;
+			continue;
+		}
+		if (WARN_ON(!bio->bi_vcnt)) {
+			/* the queue cannot take even a single page */
+			bio_put(bio);
+			md_error(mddev, rdev);
+			return;
+		}
+		/* bio is full, send it and start another at this page */
+		atomic_inc(&mddev->pending_writes);
+		submit_bio(WRITE_FLUSH_FUA, bio);
+		bio = NULL;
+	}
+	if (bio) {
+		atomic_inc(&mddev->pending_writes);
+		submit_bio(WRITE_FLUSH_FUA, bio);
+	}
+}
+
 void md_super_wait(struct mddev *mddev)
 {
 	/* wait for all superblock writes that were scheduled to complete */
@@ -1638,6 +1686,9 @@ static int super_1_validate(struct mddev *mddev, struct md_rdev *rdev)
 
 		mddev->max_disks =  (4096-256)/2;
 
+		mddev->journal = !!(le32_to_cpu(sb->feature_map) &
+				    MD_FEATURE_JOURNAL);
+
 		if ((le32_to_cpu(sb->feature_map) & MD_FEATURE_BITMAP_OFFSET) &&
 		    mddev->bitmap_info.file == NULL) {
 			mddev->bitmap_info.offset =
@@ -1782,6 +1833,8 @@ static void super_1_sync(struct mddev *mddev, struct md_rdev *rdev)
 	if (test_bit(Replacement, &rdev->flags))
 		sb->feature_map |=
 			cpu_to_le32(MD_FEATURE_REPLACEMENT);
+	if (mddev->journal)
+		sb->feature_map |= cpu_to_le32(MD_FEATURE_JOURNAL);
 
 	if (mddev->reshape_position != MaxSector) {
 		sb->feature_map |= cpu_to_le32(MD_FEATURE_RESHAPE_ACTIVE);
@@ -2405,7 +2458,7 @@ static void sync_sbs(struct mddev * mddev, int nospares)
 	}
 }
 
-static void md_update_sb(struct mddev * mddev, int force_change)
+void md_update_sb(struct mddev * mddev, int force_change)
 {
 	struct md_rdev *rdev;
 	int sync_req;
@@ -2572,6 +2625,7 @@ repeat:
 		wake_up(&rdev->blocked_wait);
 	}
 }
+EXPORT_SYMBOL(md_update_sb);
 
 /* words written to sysfs files may, or may not, be \n terminated.
  * We want to accept with case. For this we use cmd_match.
@@ -4066,6 +4120,50 @@ new_dev_store(struct mddev *mddev, const char *buf, size_t len)
 static struct md_sysfs_entry md_new_device =
 __ATTR(new_dev, S_IWUSR, null_show, new_dev_store);
 
+static ssize_t
+journal_dev_show(struct mddev *mddev, char *page)
+{
+	if (!mddev->journal_dev)
+		return sprintf(page, "none\n");
+	return sprintf(page, "%d:%d\n", MAJOR(mddev->journal_dev),
+		       MINOR(mddev->journal_dev));
+}
+
+static ssize_t
+journal_dev_store(struct mddev *mddev, const char *buf, size_t len)
+{
+	/* buf is %d:%d\n? or "none", naming the device that the
+	 * personality binds as its journal when the array is started.
+	 * Journals are attached to and detached from a running array
+	 * through the personality's own attributes.
+	 */
+	char *e;
+	int major, minor;
+	dev_t dev;
+
+	if (mddev->pers)
+		return -EBUSY;
+	if (cmd_match(buf, "none")) {
+		mddev->journal_dev = 0;
+		return len;
+	}
+	major = simple_strtoul(buf, &e, 10);
+	if (!*buf || *e != ':' || !e[1] || e[1] == '\n')
+		return -EINVAL;
+	minor = simple_strtoul(e+1, &e, 10);
+	if (*e && *e != '\n')
+		return -EINVAL;
+	dev = MKDEV(major, minor);
+	if (major != MAJOR(dev) ||
+	    minor != MINOR(dev))
+		return -EOVERFLOW;
+	mddev->journal_dev = dev;
+	return len;
+}
+
+static struct md_sysfs_entry md_journal_dev =
+__ATTR(journal_dev, S_IRUGO|S_IWUSR, journal_dev_show, journal_dev_store);
+
 static ssize_t
 bitmap_store(struct mddev *mddev, const char *buf, size_t len)
 {
@@ -4691,6 +4789,7 @@ static struct attribute *md_default_attrs[] = {
 	&md_resync_start.attr,
 	&md_metadata.attr,
 	&md_new_device.attr,
+	&md_journal_dev.attr,
 	&md_safe_delay.attr,
 	&md_array_state.attr,
 	&md_reshape_position.attr,
@@ -5275,6 +5374,8 @@ static void md_clean(struct mddev *mddev)
 	mddev->degraded = 0;
 	mddev->safemode = 0;
 	mddev->merge_check_needed = 0;
+	mddev->journal = 0;
+	mddev->journal_dev = 0;
 	mddev->bitmap_info.offset = 0;
 	mddev->bitmap_info.default_offset = 0;
 	mddev->bitmap_info.default_space = 0;
@@ -17,6 +17,7 @@
 
 #include <linux/blkdev.h>
 #include <linux/kobject.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/mm.h>
 #include <linux/mutex.h>
@@ -97,6 +98,10 @@ struct md_rdev {
 	atomic_t	read_errors;	/* number of consecutive read errors that
 					 * we have tried to ignore.
 					 */
+	unsigned long	read_lat;	/* moving average of read completion
+					 * time in ns, for read balancing
+					 */
+	unsigned long	read_lat_stamp;	/* jiffies of last read_lat update */
 	struct timespec last_read_error;	/* monotonic time since our
 						 * last read error
 						 */
@@ -312,6 +317,13 @@ struct mddev {
 	int				parallel_resync;
 
 	int				ok_start_degraded;
+
+	/* The array has a write-back journal (raid5), recorded in the
+	 * superblock so that it is never started without it.
+	 * journal_dev is the device to bind as the journal at 'run'.
+	 */
+	int				journal;
+	dev_t				journal_dev;
 	/* recovery/resync flags 
 	 * NEEDED:   we might need to start a resync/recover
 	 * RUNNING:  a thread is running, or about to be started
@@ -447,6 +459,44 @@ static inline void rdev_dec_pending(struct md_rdev *rdev, struct mddev *mddev)
 		set_bit(MD_RECOVERY_NEEDED, &mddev->recovery);
 }
 
+/*
+ * Latency aware read balancing, shared by raid1 and raid10.  The cost of
+ * reading from a member is roughly how long a new request would take
+ * there: the number of requests ahead of it times its recent average
+ * completion time.
+ */
+enum md_read_balance {
+	MD_READ_BALANCE_AUTO,		/* latency on non-rotational members */
+	MD_READ_BALANCE_DISTANCE,	/* head position only */
+	MD_READ_BALANCE_LATENCY,	/* latency on every member */
+};
+
+static inline void md_rdev_read_done(struct md_rdev *rdev, ktime_t start)
+{
+	s64 lat = ktime_to_ns(ktime_sub(ktime_get(), start));
+	unsigned long avg = ACCESS_ONCE(rdev->read_lat);
+
+	lat = clamp_t(s64, lat, 0, LONG_MAX);
+	rdev->read_lat = avg ? avg - (avg >> 3) + ((unsigned long)lat >> 3)
+			     : (unsigned long)lat;
+	rdev->read_lat_stamp = jiffies;
+}
+
+static inline u64 md_rdev_read_cost(struct md_rdev *rdev, unsigned int pending)
+{
+	unsigned long avg = ACCESS_ONCE(rdev->read_lat);
+
+	/* Age the average of a member that hasn't been read from lately,
+	 * so that one slow spell doesn't keep it out of use for good.
+	 */
+	if (avg && time_after(jiffies, rdev->read_lat_stamp + HZ)) {
+		avg >>= 1;
+		rdev->read_lat = avg;
+		rdev->read_lat_stamp = jiffies;
+	}
+	return (u64)(pending + 1) * (avg + 1);
+}
+
 static inline void md_sync_acct(struct block_device *bdev, unsigned long nr_sectors)
 {
         atomic_add(nr_sectors, &bdev->bd_contains->bd_disk->sync_io);
@@ -583,6 +633,7 @@ extern void md_unregister_thread(struct md_thread **threadp);
 extern void md_wakeup_thread(struct md_thread *thread);
 extern void md_check_recovery(struct mddev *mddev);
 extern void md_reap_sync_thread(struct mddev *mddev);
+extern void md_update_sb(struct mddev *mddev, int force_change);
 extern void md_write_start(struct mddev *mddev, struct bio *bi);
 extern void md_write_end(struct mddev *mddev);
 extern void md_done_sync(struct mddev *mddev, int blocks, int ok);
@@ -593,6 +644,9 @@ extern int mddev_congested(struct mddev *mddev, int bits);
 extern void md_flush_request(struct mddev *mddev, struct bio *bio);
 extern void md_super_write(struct mddev *mddev, struct md_rdev *rdev,
 			   sector_t sector, int size, struct page *page);
+extern void md_super_write_pages(struct mddev *mddev, struct md_rdev *rdev,
+				 sector_t sector, struct page **pages, int nr,
+				 int last_size);
 extern void md_super_wait(struct mddev *mddev);
 extern int sync_page_io(struct md_rdev *rdev, sector_t sector, int size, 
 			struct page *page, int rw, bool metadata_op);
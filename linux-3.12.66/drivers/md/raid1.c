@@ -66,6 +66,9 @@
  */
 static int max_queued_requests = 1024;
 
+/* How read_balance() picks a mirror, see enum md_read_balance */
+static int read_balance_mode = MD_READ_BALANCE_AUTO;
+
 static void allow_barrier(struct r1conf *conf);
 static void lower_barrier(struct r1conf *conf);
 
@@ -315,6 +318,9 @@ static void raid1_end_read_request(struct bio *bio, int error)
 	 * this branch is our 'one mirror IO has finished' event handler:
 	 */
 	update_head_pos(mirror, r1_bio);
+	if (uptodate)
+		md_rdev_read_done(conf->mirrors[mirror].rdev,
+				  r1_bio->start_time);
 
 	if (uptodate)
 		set_bit(R1BIO_Uptodate, &r1_bio->state);
@@ -507,10 +513,12 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 	int sectors;
 	int best_good_sectors;
 	int best_disk, best_dist_disk, best_pending_disk;
+	int best_cost_disk, seq_disk;
 	int has_nonrot_disk;
 	int disk;
 	sector_t best_dist;
 	unsigned int min_pending;
+	u64 best_cost, seq_cost;
 	struct md_rdev *rdev;
 	int choose_first;
 	int choose_next_idle;
@@ -528,6 +536,10 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 	best_dist = MaxSector;
 	best_pending_disk = -1;
 	min_pending = UINT_MAX;
+	best_cost_disk = -1;
+	best_cost = ~0ULL;
+	seq_disk = -1;
+	seq_cost = ~0ULL;
 	best_good_sectors = 0;
 	has_nonrot_disk = 0;
 	choose_next_idle = 0;
@@ -576,7 +588,7 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 		 */
 		if (is_badblock(rdev, this_sector, sectors,
 				&first_bad, &bad_sectors)) {
-			if (best_dist < MaxSector)
+			if (best_dist < MaxSector || best_cost_disk >= 0)
 				/* already have a better device */
 				continue;
 			if (first_bad <= this_sector) {
@@ -611,6 +623,23 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 			best_disk = disk;
 			break;
 		}
+		if (read_balance_mode == MD_READ_BALANCE_LATENCY ||
+		    (read_balance_mode == MD_READ_BALANCE_AUTO && nonrot)) {
+			/* Seek distance means nothing here: go by how long
+			 * a read is likely to wait on each member.
+			 */
+			u64 cost = md_rdev_read_cost(rdev, pending);
+
+			if (conf->mirrors[disk].next_seq_sect == this_sector) {
+				seq_disk = disk;
+				seq_cost = cost;
+			}
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_cost_disk = disk;
+			}
+			continue;
+		}
 		/* Don't change to another disk for sequential reads */
 		if (conf->mirrors[disk].next_seq_sect == this_sector
 		    || dist == 0) {
@@ -661,6 +690,18 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 		}
 	}
 
+	/*
+	 * Keep a sequential stream on the member it started on, so that
+	 * readahead keeps streaming from one device, unless that member
+	 * has become clearly slower than the best one.
+	 */
+	if (best_disk == -1 && best_cost_disk >= 0) {
+		if (seq_disk >= 0 && seq_cost / 2 <= best_cost)
+			best_disk = seq_disk;
+		else
+			best_disk = best_cost_disk;
+	}
+
 	/*
 	 * If all disks are rotational, choose the closest disk. If any disk is
 	 * non-rotational, choose the disk with less pending request even the
@@ -692,6 +733,7 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 			conf->mirrors[best_disk].seq_start = this_sector;
 
 		conf->mirrors[best_disk].next_seq_sect = this_sector + sectors;
+		r1_bio->start_time = ktime_get();
 	}
 	rcu_read_unlock();
 	*max_sectors = sectors;
@@ -3116,3 +3158,5 @@ MODULE_ALIAS("md-raid1");
 MODULE_ALIAS("md-level-1");
 
 module_param(max_queued_requests, int, S_IRUGO|S_IWUSR);
+module_param(read_balance_mode, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(read_balance_mode, "0: latency on non-rotational mirrors (default), 1: head distance only, 2: latency on all mirrors");
@@ -123,6 +123,8 @@ struct r1bio {
 	 */
 	int			read_disk;
 
+	ktime_t			start_time;	/* of the read, for read_balance */
+
 	struct list_head	retry_list;
 	/* Next two are only valid when R1BIO_BehindIO is set */
 	struct bio_vec		*behind_bvecs;
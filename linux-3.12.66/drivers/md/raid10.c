@@ -95,6 +95,9 @@
  */
 static int max_queued_requests = 1024;
 
+/* How read_balance() picks a copy, see enum md_read_balance */
+static int read_balance_mode = MD_READ_BALANCE_AUTO;
+
 static void allow_barrier(struct r10conf *conf);
 static void lower_barrier(struct r10conf *conf);
 static int _enough(struct r10conf *conf, int previous, int ignore);
@@ -374,6 +377,8 @@ static void raid10_end_read_request(struct bio *bio, int error)
 	 * this branch is our 'one mirror IO has finished' event handler:
 	 */
 	update_head_pos(slot, r10_bio);
+	if (uptodate)
+		md_rdev_read_done(rdev, r10_bio->start_time);
 
 	if (uptodate) {
 		/*
@@ -791,7 +796,9 @@ static struct md_rdev *read_balance(struct r10conf *conf,
 	sector_t new_distance, best_dist;
 	struct md_rdev *best_rdev, *rdev = NULL;
 	int do_balance;
-	int best_slot;
+	int best_slot, seq_slot;
+	struct md_rdev *seq_rdev;
+	u64 best_cost, seq_cost;
 	struct geom *geo = &conf->geo;
 
 	raid10_find_phys(conf, r10_bio);
@@ -801,6 +808,10 @@ retry:
 	best_slot = -1;
 	best_rdev = NULL;
 	best_dist = MaxSector;
+	best_cost = ~0ULL;
+	seq_slot = -1;
+	seq_rdev = NULL;
+	seq_cost = ~0ULL;
 	best_good_sectors = 0;
 	do_balance = 1;
 	/*
@@ -869,6 +880,30 @@ retry:
 		if (!do_balance)
 			break;
 
+		if (read_balance_mode == MD_READ_BALANCE_LATENCY ||
+		    (read_balance_mode == MD_READ_BALANCE_AUTO &&
+		     blk_queue_nonrot(bdev_get_queue(rdev->bdev)))) {
+			/* Seek distance means nothing here: go by how long
+			 * a read is likely to wait on each copy.
+			 */
+			u64 cost = md_rdev_read_cost(rdev,
+					atomic_read(&rdev->nr_pending));
+
+			if (conf->mirrors[disk].next_seq_sect ==
+			    r10_bio->devs[slot].addr) {
+				seq_slot = slot;
+				seq_rdev = rdev;
+				seq_cost = cost;
+			}
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_dist = 0;
+				best_slot = slot;
+				best_rdev = rdev;
+			}
+			continue;
+		}
+
 		/* This optimisation is debatable, and completely destroys
 		 * sequential read speed for 'far copies' arrays.  So only
 		 * keep it for 'near' arrays, and review those later.
@@ -882,7 +917,7 @@ retry:
 		else
 			new_distance = abs(r10_bio->devs[slot].addr -
 					   conf->mirrors[disk].head_position);
-		if (new_distance < best_dist) {
+		if (best_cost == ~0ULL && new_distance < best_dist) {
 			best_dist = new_distance;
 			best_slot = slot;
 			best_rdev = rdev;
@@ -891,6 +926,16 @@ retry:
 	if (slot >= conf->copies) {
 		slot = best_slot;
 		rdev = best_rdev;
+		/*
+		 * Keep a sequential stream on the copy it started on, so
+		 * that readahead keeps streaming from one device, unless
+		 * that device has become clearly slower than the best one.
+		 */
+		if (seq_slot >= 0 && slot >= 0 && best_cost != ~0ULL &&
+		    seq_cost / 2 <= best_cost) {
+			slot = seq_slot;
+			rdev = seq_rdev;
+		}
 	}
 
 	if (slot >= 0) {
@@ -903,6 +948,9 @@ retry:
 			goto retry;
 		}
 		r10_bio->read_slot = slot;
+		conf->mirrors[r10_bio->devs[slot].devnum].next_seq_sect =
+			r10_bio->devs[slot].addr + best_good_sectors;
+		r10_bio->start_time = ktime_get();
 	} else
 		rdev = NULL;
 	rcu_read_unlock();
@@ -4761,3 +4809,5 @@ MODULE_ALIAS("md-raid10");
 MODULE_ALIAS("md-level-10");
 
 module_param(max_queued_requests, int, S_IRUGO|S_IWUSR);
+module_param(read_balance_mode, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(read_balance_mode, "0: latency on non-rotational devices (default), 1: head distance only, 2: latency on all devices");
@@ -4,6 +4,9 @@
 struct raid10_info {
 	struct md_rdev	*rdev, *replacement;
 	sector_t	head_position;
+	sector_t	next_seq_sect;	/* where a sequential read would
+					 * continue, for read_balance()
+					 */
 	int		recovery_disabled;	/* matches
 						 * mddev->recovery_disabled
 						 * when we shouldn't try
@@ -105,6 +108,7 @@ struct r10bio {
 	 * if the IO is in READ direction, then this is where we read
 	 */
 	int			read_slot;
+	ktime_t			start_time;	/* of the read, for read_balance */
 
 	struct list_head	retry_list;
 	/*
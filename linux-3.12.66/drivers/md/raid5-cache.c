@@ -0,0 +1,1236 @@
+/*
+ * raid5-cache.c : write-back journal for RAID-4/5/6
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * You should have received a copy of the GNU General Public License
+ * (for example /usr/src/linux/COPYING); if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * THE JOURNAL:
+ *
+ * A small write to a parity array costs a read-modify-write of the
+ * stripe before it can be acknowledged.  When a journal device (a fast
+ * SSD or persistent-memory block device) is attached, every write is
+ * instead copied and appended to the journal, and the caller is told it
+ * is done as soon as that single append has completed.  The copy is then
+ * fed through the stripe cache as an ordinary, non-sync write, so that it
+ * can sit on the delayed list and be merged with its neighbours into full
+ * stripe writes.
+ *
+ * The journal is a ring of page sized blocks.  Block 0 holds a superblock
+ * recording the array uuid and the oldest record that may still be needed
+ * (the tail).  Each record is a header block followed by the data, and
+ * carries a sequence number and checksums so that replay can tell where
+ * the valid part of the ring ends.  A record that won't fit before the end
+ * of the ring is preceded by a 'wrap' header and placed at block 1.
+ *
+ * Completions are acknowledged in sequence order, so that everything that
+ * has been acknowledged is always a prefix of what replay will find.
+ * REQ_FUA requests are only acknowledged once the journal device itself
+ * has been flushed.  A REQ_FLUSH flushes the journal device and then goes
+ * through md_flush_request() like any other, as writes that bypassed the
+ * journal may still be sitting in the members' caches.
+ *
+ * Once the array writes for the oldest records have completed, the member
+ * devices are flushed and the superblock tail is moved past them.
+ *
+ * The array's own superblock records that it has a journal, and the
+ * array won't start without it unless forced.  When it is started with
+ * its journal, everything between the tail and the first invalid record
+ * is written back to the array before any other request is let in.  That
+ * replay goes through raid5's make_request like any write, so it waits
+ * for the first request after the array is fully set up: until then, or
+ * for as long as the array is read-only, reads are let through to what the
+ * members hold.  A journal attached to a running array starts out empty,
+ * as anything it still holds is older than what the array has since been
+ * given.
+ *
+ * Reads of a range that still has a journalled write in flight wait for
+ * that write to reach the array, as the stripe cache would otherwise
+ * happily return the old data from the member devices.
+ *
+ * If the journal device or a journalled array write fails, writes go
+ * straight to the array from then on.  Before the first of them is let
+ * through, the superblock is pointed at a sequence number no record
+ * carries, so that nothing older can be replayed over them.
+ */
+
+#include <linux/blkdev.h>
+#include <linux/crc32c.h>
+#include <linux/hash.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include "md.h"
+#include "raid5.h"
+
+#define R5L_MAGIC_SUPER		0x6a72356c
+#define R5L_MAGIC_RECORD	0x7265356c
+#define R5L_VERSION		1
+
+#define R5L_RECORD_WRAP		1	/* rest of the ring is unused */
+
+/* smallest useful journal, in blocks */
+#define R5L_MIN_BLOCKS		4096
+/* largest write that is journalled; bigger ones wait for the journal to
+ * drain and go straight to the array */
+#define R5L_MAX_DATA_PAGES	(BIO_MAX_PAGES - 1)
+/* data, header and wrap header of the largest record */
+#define R5L_RECORD_PAGES	(R5L_MAX_DATA_PAGES + 2)
+#define R5L_POOL_SIZE		32
+
+/* reads wait on any journalled write to the same stripe hash bucket */
+#define R5L_INFLIGHT_BITS	10
+
+struct r5l_super {
+	__le32	magic;
+	__le32	version;
+	__le32	checksum;
+	__le32	block_size;
+	__u8	uuid[16];
+	__le64	nr_blocks;	/* including the superblock */
+	__le64	tail;		/* first block replay looks at */
+	__le64	tail_seq;	/* sequence number expected there */
+};
+
+struct r5l_record {
+	__le32	magic;
+	__le32	checksum;	/* of this header, with checksum zero */
+	__le64	seq;
+	__le64	sector;		/* array sector the data belongs at */
+	__le32	nr_sectors;
+	__le32	flags;
+	__le32	data_checksum;
+	__le32	pad;
+};
+
+enum r5l_io_flags {
+	R5L_LOGGED,		/* journal writes have completed */
+	R5L_LOG_ERROR,		/* ... but one of them failed */
+	R5L_NEED_FLUSH,		/* REQ_FUA: flush journal before ack */
+	R5L_FLUSHED,
+	R5L_CLONE_DONE,		/* array write has completed */
+	R5L_IDLE,		/* no io or pages left, may be reclaimed */
+};
+
+/*
+ * One journalled request.  It sits on log->pending until the original
+ * bio has been acknowledged, and then on log->acked until reclaim has
+ * moved the tail past it.
+ */
+struct r5l_io_unit {
+	struct r5l_log		*log;
+	struct list_head	sibling;
+
+	struct bio		*orig;
+	struct bio		*clone;	/* owns the data pages */
+	struct page		*rec_page;
+	struct page		*pad_page;
+
+	u64			seq;
+	sector_t		start;		/* first block, including any wrap */
+	sector_t		nr_blocks;
+	sector_t		rec_block;
+
+	sector_t		sector;		/* array range, for readers */
+	unsigned int		nr_sectors;
+
+	atomic_t		log_pending;
+	atomic_t		page_refs;
+	unsigned long		flags;
+	int			error;
+};
+
+struct r5l_log {
+	struct r5conf		*conf;
+	struct block_device	*bdev;
+	sector_t		nr_blocks;
+
+	spinlock_t		lock;
+	sector_t		head;		/* next block to write */
+	sector_t		tail;		/* as recorded in the superblock */
+	sector_t		used;		/* blocks from tail to head */
+	u64			seq;		/* for the next record */
+	u64			tail_seq;
+	struct list_head	pending;
+	struct list_head	acked;
+	int			nr_busy;	/* units not yet R5L_IDLE */
+	bool			flushing;
+	bool			failing;	/* invalidation pending */
+	bool			failed;
+	bool			journal_failed;
+	bool			replaying;	/* not yet replayed */
+	int			replay_error;
+	struct block_device	*replay_bdev;
+
+	wait_queue_head_t	space_wait;
+	wait_queue_head_t	read_wait;
+	wait_queue_head_t	replay_wait;
+	atomic_t		inflight[1 << R5L_INFLIGHT_BITS];
+
+	struct work_struct	flush_work;
+	struct delayed_work	reclaim_work;
+	struct work_struct	replay_work;
+
+	mempool_t		*unit_pool;
+	struct mutex		page_mutex;	/* one record takes pages at once */
+	mempool_t		*page_pool;
+	struct bio_set		*bs;
+	struct page		*sb_page;
+};
+
+static sector_t r5l_block_sector(sector_t block)
+{
+	return block << (PAGE_SHIFT - 9);
+}
+
+static sector_t r5l_ring_add(struct r5l_log *log, sector_t block, sector_t n)
+{
+	block += n;
+	if (block >= log->nr_blocks)
+		block = block - log->nr_blocks + 1;
+	return block;
+}
+
+static u32 r5l_csum(const void *p, size_t len)
+{
+	return crc32c(~0, p, len);
+}
+
+static int r5l_sync_page_io(struct r5l_log *log, sector_t block,
+			    struct page *page, int rw)
+{
+	struct bio *bio = bio_alloc(GFP_NOIO, 1);
+	int ret;
+
+	bio->bi_bdev = log->bdev;
+	bio->bi_sector = r5l_block_sector(block);
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+	ret = submit_bio_wait(rw, bio);
+	bio_put(bio);
+	return ret;
+}
+
+static int r5l_write_super(struct r5l_log *log, sector_t tail, u64 seq)
+{
+	struct r5l_super *sb = page_address(log->sb_page);
+
+	memset(sb, 0, PAGE_SIZE);
+	sb->magic = cpu_to_le32(R5L_MAGIC_SUPER);
+	sb->version = cpu_to_le32(R5L_VERSION);
+	sb->block_size = cpu_to_le32(PAGE_SIZE);
+	memcpy(sb->uuid, log->conf->mddev->uuid, sizeof(sb->uuid));
+	sb->nr_blocks = cpu_to_le64(log->nr_blocks);
+	sb->tail = cpu_to_le64(tail);
+	sb->tail_seq = cpu_to_le64(seq);
+	sb->checksum = cpu_to_le32(r5l_csum(sb, sizeof(*sb)));
+
+	return r5l_sync_page_io(log, 0, log->sb_page, WRITE_FLUSH_FUA);
+}
+
+static void r5l_log_failed(struct r5l_log *log, bool journal)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&log->lock, flags);
+	if (!log->failing && !log->failed) {
+		printk(KERN_ERR "md/raid:%s: journal %s failed, "
+		       "writing through to the array\n",
+		       mdname(log->conf->mddev),
+		       journal ? "device" : "writeback");
+		/* reclaim invalidates the journal and sets ->failed */
+		log->failing = true;
+		mod_delayed_work(system_long_wq, &log->reclaim_work, 0);
+	}
+	if (journal)
+		log->journal_failed = true;
+	spin_unlock_irqrestore(&log->lock, flags);
+}
+
+static void r5l_wake_reclaim(struct r5l_log *log, unsigned long delay)
+{
+	if (delay)
+		queue_delayed_work(system_long_wq, &log->reclaim_work, delay);
+	else
+		mod_delayed_work(system_long_wq, &log->reclaim_work, 0);
+}
+
+/*
+ * Make sure nothing in the journal can be replayed any more, then let
+ * writes go around it.  Records still being written carry the old
+ * sequence numbers and won't match either.
+ */
+static void r5l_invalidate(struct r5l_log *log)
+{
+	u64 seq;
+
+	get_random_bytes(&seq, sizeof(seq));
+	if (r5l_write_super(log, log->tail, seq))
+		printk(KERN_ERR "md/raid:%s: cannot invalidate journal\n",
+		       mdname(log->conf->mddev));
+
+	spin_lock_irq(&log->lock);
+	log->failing = false;
+	log->failed = true;
+	spin_unlock_irq(&log->lock);
+	wake_up(&log->space_wait);
+}
+
+/*
+ * Readers of a range with a journalled write still on its way to the
+ * array have to wait for it.
+ */
+static atomic_t *r5l_inflight(struct r5l_log *log, sector_t sector)
+{
+	return &log->inflight[hash_64(sector >> STRIPE_SHIFT,
+				      R5L_INFLIGHT_BITS)];
+}
+
+static void r5l_inflight_add(struct r5l_log *log, sector_t sector,
+			     unsigned int nr_sectors, int delta)
+{
+	sector_t s = sector & ~((sector_t)STRIPE_SECTORS - 1);
+
+	for (; s < sector + nr_sectors; s += STRIPE_SECTORS)
+		atomic_add(delta, r5l_inflight(log, s));
+}
+
+static bool r5l_read_blocked(struct r5l_log *log, struct bio *bio)
+{
+	sector_t s = bio->bi_sector & ~((sector_t)STRIPE_SECTORS - 1);
+
+	for (; s < bio_end_sector(bio); s += STRIPE_SECTORS)
+		if (atomic_read(r5l_inflight(log, s)))
+			return true;
+	return false;
+}
+
+static void r5l_end_bios(struct bio_list *done)
+{
+	struct bio *bio;
+
+	while ((bio = bio_list_pop(done)) != NULL)
+		bio_endio(bio, test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO);
+}
+
+/*
+ * Acknowledge, in order, every unit at the front of the pending list that
+ * is safely in the journal.  Called with log->lock held.
+ */
+static void r5l_run_acks(struct r5l_log *log, struct bio_list *done)
+{
+	struct r5l_io_unit *u;
+
+	while (!list_empty(&log->pending)) {
+		u = list_first_entry(&log->pending, struct r5l_io_unit, sibling);
+		if (!test_bit(R5L_LOGGED, &u->flags))
+			break;
+		if (test_bit(R5L_LOG_ERROR, &u->flags)) {
+			/* the journal can't vouch for it, the array must */
+			if (!test_bit(R5L_CLONE_DONE, &u->flags))
+				break;
+		} else if (test_bit(R5L_NEED_FLUSH, &u->flags) &&
+			   !test_bit(R5L_FLUSHED, &u->flags)) {
+			if (!log->flushing) {
+				log->flushing = true;
+				schedule_work(&log->flush_work);
+			}
+			break;
+		}
+
+		list_move_tail(&u->sibling, &log->acked);
+		if (u->orig) {
+			if (test_bit(R5L_LOG_ERROR, &u->flags) && u->error)
+				clear_bit(BIO_UPTODATE, &u->orig->bi_flags);
+			bio_list_add(done, u->orig);
+			u->orig = NULL;
+		}
+	}
+	wake_up(&log->space_wait);
+}
+
+static void r5l_flush_work(struct work_struct *work)
+{
+	struct r5l_log *log = container_of(work, struct r5l_log, flush_work);
+	struct bio_list done = BIO_EMPTY_LIST;
+	struct r5l_io_unit *u;
+	int err;
+
+	err = blkdev_issue_flush(log->bdev, GFP_NOIO, NULL);
+	if (err)
+		r5l_log_failed(log, true);
+
+	spin_lock_irq(&log->lock);
+	log->flushing = false;
+	/* the unit that asked for the flush is still at the front */
+	u = list_first_entry(&log->pending, struct r5l_io_unit, sibling);
+	if (err)
+		set_bit(R5L_LOG_ERROR, &u->flags);
+	set_bit(R5L_FLUSHED, &u->flags);
+	r5l_run_acks(log, &done);
+	spin_unlock_irq(&log->lock);
+
+	r5l_end_bios(&done);
+}
+
+static void r5l_put_pages(struct r5l_io_unit *u)
+{
+	struct r5l_log *log = u->log;
+	unsigned long flags;
+	struct bio_vec *bv;
+	int i;
+
+	if (!atomic_dec_and_test(&u->page_refs))
+		return;
+
+	bio_for_each_segment_all(bv, u->clone, i)
+		mempool_free(bv->bv_page, log->page_pool);
+	bio_put(u->clone);
+	u->clone = NULL;
+	mempool_free(u->rec_page, log->page_pool);
+	if (u->pad_page)
+		mempool_free(u->pad_page, log->page_pool);
+
+	spin_lock_irqsave(&log->lock, flags);
+	set_bit(R5L_IDLE, &u->flags);
+	log->nr_busy--;
+	if (waitqueue_active(&log->space_wait) ||
+	    log->used > (log->nr_blocks >> 2))
+		r5l_wake_reclaim(log, 0);
+	else if (!log->nr_busy)
+		/* idle: checkpoint so that replay has little to do */
+		r5l_wake_reclaim(log, HZ);
+	spin_unlock_irqrestore(&log->lock, flags);
+	wake_up(&log->space_wait);
+}
+
+static void r5l_log_put(struct r5l_io_unit *u)
+{
+	struct r5l_log *log = u->log;
+	struct bio_list done = BIO_EMPTY_LIST;
+	unsigned long flags;
+
+	if (!atomic_dec_and_test(&u->log_pending))
+		return;
+
+	if (test_bit(R5L_LOG_ERROR, &u->flags))
+		r5l_log_failed(log, true);
+
+	spin_lock_irqsave(&log->lock, flags);
+	set_bit(R5L_LOGGED, &u->flags);
+	r5l_run_acks(log, &done);
+	spin_unlock_irqrestore(&log->lock, flags);
+
+	r5l_end_bios(&done);
+	r5l_put_pages(u);
+}
+
+static void r5l_log_endio(struct bio *bio, int error)
+{
+	struct r5l_io_unit *u = bio->bi_private;
+
+	if (error || !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		set_bit(R5L_LOG_ERROR, &u->flags);
+	bio_put(bio);
+	r5l_log_put(u);
+}
+
+static void r5l_clone_endio(struct bio *bio, int error)
+{
+	struct r5l_io_unit *u = bio->bi_private;
+	struct r5l_log *log = u->log;
+	struct bio_list done = BIO_EMPTY_LIST;
+	unsigned long flags;
+
+	if (error || !test_bit(BIO_UPTODATE, &bio->bi_flags)) {
+		u->error = -EIO;
+		r5l_log_failed(log, false);
+	}
+
+	r5l_inflight_add(log, u->sector, u->nr_sectors, -1);
+	wake_up(&log->read_wait);
+
+	spin_lock_irqsave(&log->lock, flags);
+	set_bit(R5L_CLONE_DONE, &u->flags);
+	r5l_run_acks(log, &done);
+	spin_unlock_irqrestore(&log->lock, flags);
+
+	r5l_end_bios(&done);
+	r5l_put_pages(u);
+}
+
+/*
+ * Copy the data out of the caller's bio into pages of our own, which are
+ * both written to the journal and handed to the stripe cache.  The clone
+ * goes straight to raid5's make_request, so it doesn't need to respect
+ * queue limits and the vectors can be filled in directly.
+ *
+ * The largest record needs the whole page pool, so the pages for the
+ * header and a possible wrap header are taken along with the data pages,
+ * and only by one writer at a time: writers each holding part of the
+ * pool would otherwise wait for the rest of it forever.
+ */
+static struct bio *r5l_alloc_clone(struct r5l_log *log, struct r5l_io_unit *u,
+				   struct bio *bio, unsigned int nr_pages)
+{
+	struct bio *clone = bio_alloc_bioset(GFP_NOIO, nr_pages, log->bs);
+	unsigned int off = 0, i;
+	struct bio_vec *bv;
+
+	mutex_lock(&log->page_mutex);
+	for (i = 0; i < nr_pages; i++) {
+		clone->bi_io_vec[i].bv_page = mempool_alloc(log->page_pool,
+							     GFP_NOIO);
+		clone->bi_io_vec[i].bv_len = PAGE_SIZE;
+		clone->bi_io_vec[i].bv_offset = 0;
+	}
+	u->rec_page = mempool_alloc(log->page_pool, GFP_NOIO);
+	u->pad_page = mempool_alloc(log->page_pool, GFP_NOIO);
+	mutex_unlock(&log->page_mutex);
+	clone->bi_vcnt = nr_pages;
+
+	bio_for_each_segment(bv, bio, i) {
+		char *src = kmap_atomic(bv->bv_page);
+		unsigned int done = 0;
+
+		while (done < bv->bv_len) {
+			struct page *page = clone->bi_io_vec[off >> PAGE_SHIFT].bv_page;
+			unsigned int n = min_t(unsigned int, bv->bv_len - done,
+					       PAGE_SIZE - offset_in_page(off));
+
+			memcpy(page_address(page) + offset_in_page(off),
+			       src + bv->bv_offset + done, n);
+			done += n;
+			off += n;
+		}
+		kunmap_atomic(src);
+	}
+
+	/* don't leak stale memory into the journal */
+	if (offset_in_page(off))
+		memset(page_address(clone->bi_io_vec[nr_pages - 1].bv_page) +
+		       offset_in_page(off), 0, PAGE_SIZE - offset_in_page(off));
+
+	clone->bi_rw = WRITE;
+	clone->bi_bdev = bio->bi_bdev;
+	clone->bi_sector = bio->bi_sector;
+	clone->bi_size = bio->bi_size;
+	clone->bi_end_io = r5l_clone_endio;
+	return clone;
+}
+
+static u32 r5l_data_csum(struct bio *clone)
+{
+	unsigned int left = clone->bi_size;
+	u32 crc = ~0;
+	int i;
+
+	for (i = 0; left; i++) {
+		unsigned int n = min_t(unsigned int, left, PAGE_SIZE);
+
+		crc = crc32c(crc, page_address(clone->bi_io_vec[i].bv_page), n);
+		left -= n;
+	}
+	return crc;
+}
+
+/*
+ * Find room in the ring for 'nr' blocks, waiting for reclaim if needed,
+ * and queue the unit at the back of the pending list.  Returns false if
+ * the journal failed meanwhile, as reclaim will never make room then.
+ */
+static bool r5l_reserve(struct r5l_log *log, struct r5l_io_unit *u,
+			sector_t nr)
+{
+	sector_t pad;
+
+	spin_lock_irq(&log->lock);
+	for (;;) {
+		DEFINE_WAIT(w);
+
+		pad = 0;
+		if (log->head + nr > log->nr_blocks)
+			pad = log->nr_blocks - log->head;
+		if (log->used + pad + nr <= log->nr_blocks - 1)
+			break;
+		if (log->failed) {
+			spin_unlock_irq(&log->lock);
+			return false;
+		}
+
+		prepare_to_wait(&log->space_wait, &w, TASK_UNINTERRUPTIBLE);
+		r5l_wake_reclaim(log, 0);
+		spin_unlock_irq(&log->lock);
+		schedule();
+		finish_wait(&log->space_wait, &w);
+		spin_lock_irq(&log->lock);
+	}
+
+	u->start = log->head;
+	u->nr_blocks = pad + nr;
+	u->rec_block = pad ? 1 : log->head;
+	u->seq = log->seq++;
+	log->nr_busy++;
+	log->head = r5l_ring_add(log, log->head, pad + nr);
+	log->used += pad + nr;
+	list_add_tail(&u->sibling, &log->pending);
+	spin_unlock_irq(&log->lock);
+	return true;
+}
+
+static struct bio *r5l_log_bio(struct r5l_io_unit *u, sector_t block)
+{
+	struct bio *bio = bio_alloc_bioset(GFP_NOIO, BIO_MAX_PAGES,
+					   u->log->bs);
+
+	bio->bi_bdev = u->log->bdev;
+	bio->bi_sector = r5l_block_sector(block);
+	bio->bi_end_io = r5l_log_endio;
+	bio->bi_private = u;
+	atomic_inc(&u->log_pending);
+	return bio;
+}
+
+static void r5l_submit_record(struct r5l_io_unit *u)
+{
+	struct bio *clone = u->clone;
+	sector_t block = u->rec_block;
+	struct bio *bio;
+	int i;
+
+	if (u->pad_page) {
+		bio = r5l_log_bio(u, u->start);
+		bio_add_page(bio, u->pad_page, PAGE_SIZE, 0);
+		submit_bio(WRITE_SYNC, bio);
+	}
+
+	bio = r5l_log_bio(u, block);
+	bio_add_page(bio, u->rec_page, PAGE_SIZE, 0);
+	block++;
+	for (i = 0; i < clone->bi_vcnt; i++) {
+		struct page *page = clone->bi_io_vec[i].bv_page;
+
+		if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+			submit_bio(WRITE_SYNC, bio);
+			bio = r5l_log_bio(u, block);
+			bio_add_page(bio, page, PAGE_SIZE, 0);
+		}
+		block++;
+	}
+	submit_bio(WRITE_SYNC, bio);
+}
+
+static void r5l_fill_header(struct page *page, u64 seq, sector_t sector,
+			    unsigned int nr_sectors, u32 flags, u32 data_csum)
+{
+	struct r5l_record *rec = page_address(page);
+
+	memset(rec, 0, PAGE_SIZE);
+	rec->magic = cpu_to_le32(R5L_MAGIC_RECORD);
+	rec->seq = cpu_to_le64(seq);
+	rec->sector = cpu_to_le64(sector);
+	rec->nr_sectors = cpu_to_le32(nr_sectors);
+	rec->flags = cpu_to_le32(flags);
+	rec->data_checksum = cpu_to_le32(data_csum);
+	rec->checksum = cpu_to_le32(r5l_csum(rec, sizeof(*rec)));
+}
+
+/*
+ * Journal @bio and hand its copy to the array.  Returns false, with @bio
+ * untouched, if the journal failed before the record could be placed.
+ */
+static bool r5l_write(struct r5l_log *log, struct bio *bio)
+{
+	struct mddev *mddev = log->conf->mddev;
+	struct r5l_io_unit *u;
+	struct bio_vec *bv;
+	unsigned int nr_pages;
+	u32 data_csum;
+	int i;
+
+	u = mempool_alloc(log->unit_pool, GFP_NOIO);
+	memset(u, 0, sizeof(*u));
+	u->log = log;
+	u->orig = bio;
+	if (bio->bi_rw & REQ_FUA)
+		set_bit(R5L_NEED_FLUSH, &u->flags);
+
+	nr_pages = DIV_ROUND_UP(bio->bi_size, PAGE_SIZE);
+	u->clone = r5l_alloc_clone(log, u, bio, nr_pages);
+	u->clone->bi_private = u;
+	u->sector = bio->bi_sector;
+	u->nr_sectors = bio_sectors(bio);
+	data_csum = r5l_data_csum(u->clone);
+
+	if (!r5l_reserve(log, u, 1 + nr_pages)) {
+		bio_for_each_segment_all(bv, u->clone, i)
+			mempool_free(bv->bv_page, log->page_pool);
+		bio_put(u->clone);
+		mempool_free(u->rec_page, log->page_pool);
+		mempool_free(u->pad_page, log->page_pool);
+		mempool_free(u, log->unit_pool);
+		return false;
+	}
+	if (u->rec_block != u->start) {
+		r5l_fill_header(u->pad_page, u->seq, 0, 0,
+				R5L_RECORD_WRAP, 0);
+	} else {
+		mempool_free(u->pad_page, log->page_pool);
+		u->pad_page = NULL;
+	}
+	r5l_fill_header(u->rec_page, u->seq, u->sector, u->nr_sectors,
+			0, data_csum);
+
+	/* dropped by the journal and the array write completing */
+	atomic_set(&u->page_refs, 2);
+	atomic_set(&u->log_pending, 1);
+	r5l_submit_record(u);
+
+	r5l_inflight_add(log, u->sector, u->nr_sectors, 1);
+	mddev->pers->make_request(mddev, u->clone);
+
+	r5l_log_put(u);
+	return true;
+}
+
+/*
+ * Wait until everything in the journal has reached the array.  Used
+ * before a request that can't be journalled is let through, so that
+ * replay can never write older data over it.
+ */
+static bool r5l_empty(struct r5l_log *log)
+{
+	bool empty;
+
+	spin_lock_irq(&log->lock);
+	empty = log->failed ||
+		(list_empty(&log->pending) && list_empty(&log->acked));
+	spin_unlock_irq(&log->lock);
+	return empty;
+}
+
+static void r5l_drain(struct r5l_log *log)
+{
+	r5l_wake_reclaim(log, 0);
+	wait_event(log->space_wait, r5l_empty(log));
+}
+
+static void r5l_replay_endio(struct bio *bio, int error);
+
+/*
+ * Nothing may reach the array before the journal has been replayed into
+ * it.  The replay runs from r5l_replay_work(), on behalf of the first
+ * request to need it, and its bios borrow that request's bdev.  Reads of
+ * a read-only array are let through, as the replay would have to write.
+ */
+static int r5l_wait_replay(struct r5l_log *log, struct bio *bio)
+{
+	if (bio_data_dir(bio) == READ && log->conf->mddev->ro)
+		return 0;
+
+	spin_lock_irq(&log->lock);
+	if (log->replaying && !log->replay_bdev) {
+		log->replay_bdev = bio->bi_bdev;
+		queue_work(system_long_wq, &log->replay_work);
+	}
+	spin_unlock_irq(&log->lock);
+
+	wait_event(log->replay_wait, !log->replaying);
+	return log->replay_error;
+}
+
+/*
+ * Called at the top of raid5's make_request.  Returns true if the journal
+ * has taken over the bio.
+ */
+bool r5l_handle_bio(struct r5l_log *log, struct bio *bio)
+{
+	if (bio->bi_end_io == r5l_clone_endio ||
+	    bio->bi_end_io == r5l_replay_endio)
+		return false;
+
+	if (unlikely(log->replaying || log->replay_error) &&
+	    r5l_wait_replay(log, bio)) {
+		bio_endio(bio, -EIO);
+		return true;
+	}
+
+	if (bio_data_dir(bio) == READ) {
+		if (r5l_read_blocked(log, bio)) {
+			md_wakeup_thread(log->conf->mddev->thread);
+			wait_event(log->read_wait, !r5l_read_blocked(log, bio));
+		}
+		return false;
+	}
+
+	if (bio->bi_rw & REQ_FLUSH) {
+		/*
+		 * Acknowledged records may only be in the journal's volatile
+		 * cache.  Flush it here, and let raid5 pass the request on to
+		 * md_flush_request(), which flushes the members for writes
+		 * that bypassed the journal and brings any data back to us
+		 * without REQ_FLUSH.
+		 */
+		if (!log->journal_failed &&
+		    blkdev_issue_flush(log->bdev, GFP_NOIO, NULL)) {
+			r5l_log_failed(log, true);
+			bio_endio(bio, -EIO);
+			return true;
+		}
+		return false;
+	}
+
+	if (log->failed)
+		return false;
+
+	if ((bio->bi_rw & REQ_DISCARD) ||
+	    DIV_ROUND_UP(bio->bi_size, PAGE_SIZE) > R5L_MAX_DATA_PAGES) {
+		r5l_drain(log);
+		return false;
+	}
+
+	return r5l_write(log, bio);
+}
+
+/*
+ * Flush every working member so that completed array writes are stable
+ * before the journal forgets about them.
+ */
+static int r5l_flush_array(struct r5l_log *log)
+{
+	struct mddev *mddev = log->conf->mddev;
+	struct md_rdev *rdev;
+	int err = 0;
+
+	rcu_read_lock();
+	rdev_for_each_rcu(rdev, mddev)
+		if (rdev->raid_disk >= 0 &&
+		    !test_bit(Faulty, &rdev->flags)) {
+			atomic_inc(&rdev->nr_pending);
+			rcu_read_unlock();
+			if (blkdev_issue_flush(rdev->bdev, GFP_NOIO, NULL))
+				err = -EIO;
+			rdev_dec_pending(rdev, mddev);
+			rcu_read_lock();
+		}
+	rcu_read_unlock();
+	return err;
+}
+
+/*
+ * Move the superblock tail past every acknowledged unit whose array write
+ * has finished, and give their blocks back to the ring.
+ */
+static void r5l_do_reclaim(struct r5l_log *log)
+{
+	struct r5l_io_unit *u, *last = NULL, *tmp;
+	sector_t new_tail, freed = 0;
+	LIST_HEAD(reclaimed);
+	u64 new_seq;
+
+	spin_lock_irq(&log->lock);
+	if (log->failed) {
+		spin_unlock_irq(&log->lock);
+		return;
+	}
+	if (log->failing) {
+		spin_unlock_irq(&log->lock);
+		r5l_invalidate(log);
+		return;
+	}
+	list_for_each_entry(u, &log->acked, sibling) {
+		if (!test_bit(R5L_IDLE, &u->flags) || u->error)
+			break;
+		last = u;
+	}
+	if (!last) {
+		spin_unlock_irq(&log->lock);
+		return;
+	}
+	new_tail = r5l_ring_add(log, last->start, last->nr_blocks);
+	new_seq = last->seq + 1;
+	spin_unlock_irq(&log->lock);
+
+	if (new_tail != log->tail || new_seq != log->tail_seq) {
+		if (r5l_flush_array(log))
+			return;
+		if (r5l_write_super(log, new_tail, new_seq)) {
+			r5l_log_failed(log, true);
+			return;
+		}
+	}
+
+	spin_lock_irq(&log->lock);
+	list_for_each_entry_safe(u, tmp, &log->acked, sibling) {
+		list_move_tail(&u->sibling, &reclaimed);
+		freed += u->nr_blocks;
+		if (u == last)
+			break;
+	}
+	log->tail = new_tail;
+	log->tail_seq = new_seq;
+	log->used -= freed;
+	spin_unlock_irq(&log->lock);
+
+	list_for_each_entry_safe(u, tmp, &reclaimed, sibling)
+		mempool_free(u, log->unit_pool);
+	wake_up(&log->space_wait);
+}
+
+static void r5l_reclaim_work(struct work_struct *work)
+{
+	struct r5l_log *log = container_of(to_delayed_work(work),
+					   struct r5l_log, reclaim_work);
+
+	r5l_do_reclaim(log);
+}
+
+static bool r5l_check_record(struct r5l_record *rec, u64 seq)
+{
+	u32 csum = le32_to_cpu(rec->checksum);
+
+	if (le32_to_cpu(rec->magic) != R5L_MAGIC_RECORD ||
+	    le64_to_cpu(rec->seq) != seq)
+		return false;
+	rec->checksum = 0;
+	return r5l_csum(rec, sizeof(*rec)) == csum;
+}
+
+static void r5l_replay_endio(struct bio *bio, int error)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Replay a single record into the array.  Sets *nr_blocks to the number
+ * of blocks it used, or to 0 at the end of the valid part of the journal.
+ */
+static int r5l_replay_one(struct r5l_log *log, struct block_device *mdbdev,
+			  sector_t block, u64 seq, struct page *hdr,
+			  sector_t *nr_blocks, bool *wrap)
+{
+	struct mddev *mddev = log->conf->mddev;
+	struct r5l_record *rec = page_address(hdr);
+	DECLARE_COMPLETION_ONSTACK(done);
+	unsigned int nr_pages, i;
+	struct bio *bio;
+	int err = 0;
+
+	*nr_blocks = 0;
+	if (r5l_sync_page_io(log, block, hdr, READ) ||
+	    !r5l_check_record(rec, seq))
+		return 0;
+
+	*wrap = le32_to_cpu(rec->flags) & R5L_RECORD_WRAP;
+	if (*wrap) {
+		*nr_blocks = log->nr_blocks - block;
+		return 0;
+	}
+
+	nr_pages = DIV_ROUND_UP(le32_to_cpu(rec->nr_sectors) << 9, PAGE_SIZE);
+	if (!nr_pages || nr_pages > R5L_MAX_DATA_PAGES ||
+	    block + 1 + nr_pages > log->nr_blocks)
+		return 0;
+
+	bio = bio_alloc(GFP_KERNEL, nr_pages);
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page = alloc_page(GFP_KERNEL);
+
+		if (!page) {
+			err = -ENOMEM;
+			goto out;
+		}
+		if (r5l_sync_page_io(log, block + 1 + i, page, READ)) {
+			__free_page(page);
+			goto out;
+		}
+		bio->bi_io_vec[i].bv_page = page;
+		bio->bi_io_vec[i].bv_len = PAGE_SIZE;
+		bio->bi_io_vec[i].bv_offset = 0;
+		bio->bi_vcnt++;
+	}
+	bio->bi_size = le32_to_cpu(rec->nr_sectors) << 9;
+	if (r5l_data_csum(bio) != le32_to_cpu(rec->data_checksum))
+		goto out;
+
+	bio->bi_rw = WRITE;
+	bio->bi_bdev = mdbdev;
+	bio->bi_sector = le64_to_cpu(rec->sector);
+	bio->bi_end_io = r5l_replay_endio;
+	bio->bi_private = &done;
+	mddev->pers->make_request(mddev, bio);
+	wait_for_completion(&done);
+	if (test_bit(BIO_UPTODATE, &bio->bi_flags))
+		*nr_blocks = 1 + nr_pages;
+	else
+		err = -EIO;
+out:
+	for (i = 0; i < bio->bi_vcnt; i++)
+		__free_page(bio->bi_io_vec[i].bv_page);
+	bio_put(bio);
+	return err;
+}
+
+/*
+ * Write everything from the superblock tail up to the first invalid
+ * record back to the array, then start an empty ring after it.  The
+ * replayed bios go to @mdbdev, which a waiting request keeps alive.
+ */
+static int r5l_replay(struct r5l_log *log, struct block_device *mdbdev)
+{
+	struct mddev *mddev = log->conf->mddev;
+	sector_t block = log->tail, scanned = 0, n;
+	u64 seq = log->tail_seq;
+	unsigned int count = 0;
+	struct page *hdr;
+	int err = 0;
+
+	hdr = alloc_page(GFP_KERNEL);
+	if (!hdr)
+		return -ENOMEM;
+
+	while (scanned < log->nr_blocks - 1) {
+		bool wrap = false;
+
+		err = r5l_replay_one(log, mdbdev, block, seq, hdr, &n, &wrap);
+		if (err || !n)
+			break;
+		if (!wrap) {
+			seq++;
+			count++;
+		}
+		block = r5l_ring_add(log, block, n);
+		scanned += n;
+	}
+	__free_page(hdr);
+
+	if (count)
+		printk(KERN_INFO "md/raid:%s: replayed %u journal records\n",
+		       mdname(mddev), count);
+	if (!err && count)
+		err = r5l_flush_array(log);
+	if (!err && (block != log->tail || seq != log->tail_seq))
+		err = r5l_write_super(log, block, seq);
+	if (err) {
+		log->failed = true;
+		return err;
+	}
+
+	log->head = log->tail = block;
+	log->seq = log->tail_seq = seq;
+	log->used = 0;
+	return 0;
+}
+
+static void r5l_replay_work(struct work_struct *work)
+{
+	struct r5l_log *log = container_of(work, struct r5l_log, replay_work);
+	int err;
+
+	err = r5l_replay(log, log->replay_bdev);
+	if (err)
+		printk(KERN_ERR "md/raid:%s: journal replay failed (%d), "
+		       "failing requests while the journal is attached\n",
+		       mdname(log->conf->mddev), err);
+
+	spin_lock_irq(&log->lock);
+	log->replay_error = err;
+	log->replay_bdev = NULL;
+	log->replaying = false;
+	spin_unlock_irq(&log->lock);
+	wake_up_all(&log->replay_wait);
+}
+
+/*
+ * A journal that has not been replayed yet holds writes that the array
+ * was told are done, so it must not be detached.
+ */
+bool r5l_replay_pending(struct r5l_log *log)
+{
+	return log->replaying;
+}
+
+/*
+ * Start an empty ring, from a random sequence so that anything left on
+ * the device can never look valid.
+ */
+static int r5l_format(struct r5l_log *log)
+{
+	log->head = log->tail = 1;
+	get_random_bytes(&log->tail_seq, sizeof(log->tail_seq));
+	log->seq = log->tail_seq;
+	log->used = 0;
+	return r5l_write_super(log, log->tail, log->tail_seq);
+}
+
+/*
+ * Read and check the journal superblock.  Unless @fresh, the journal is
+ * later replayed from the tail it records; otherwise it is reset.
+ */
+static int r5l_load_super(struct r5l_log *log, bool fresh)
+{
+	struct r5l_super *sb = page_address(log->sb_page);
+	struct mddev *mddev = log->conf->mddev;
+	u32 csum;
+	int err;
+
+	err = r5l_sync_page_io(log, 0, log->sb_page, READ);
+	if (err)
+		return err;
+
+	if (le32_to_cpu(sb->magic) != R5L_MAGIC_SUPER)
+		return r5l_format(log);
+
+	csum = le32_to_cpu(sb->checksum);
+	sb->checksum = 0;
+	if (r5l_csum(sb, sizeof(*sb)) != csum ||
+	    le32_to_cpu(sb->version) != R5L_VERSION ||
+	    le32_to_cpu(sb->block_size) != PAGE_SIZE) {
+		printk(KERN_ERR "md/raid:%s: journal superblock is invalid\n",
+		       mdname(mddev));
+		return -EINVAL;
+	}
+	if (memcmp(sb->uuid, mddev->uuid, sizeof(sb->uuid))) {
+		printk(KERN_ERR "md/raid:%s: journal belongs to another array\n",
+		       mdname(mddev));
+		return -EBUSY;
+	}
+	if (fresh)
+		return r5l_format(log);
+	if (le64_to_cpu(sb->nr_blocks) > log->nr_blocks ||
+	    le64_to_cpu(sb->tail) < 1 ||
+	    le64_to_cpu(sb->tail) >= le64_to_cpu(sb->nr_blocks))
+		return -EINVAL;
+
+	log->nr_blocks = le64_to_cpu(sb->nr_blocks);
+	log->tail = le64_to_cpu(sb->tail);
+	log->tail_seq = le64_to_cpu(sb->tail_seq);
+	return 0;
+}
+
+/*
+ * Open @dev as the journal of @conf.  A journal the array already relies
+ * on is replayed before the first request gets through; a @fresh one is
+ * reset instead.
+ */
+struct r5l_log *r5l_init(struct r5conf *conf, dev_t dev, bool fresh)
+{
+	char b[BDEVNAME_SIZE];
+	struct r5l_log *log;
+	int i, err = -ENOMEM;
+
+	log = kzalloc(sizeof(*log), GFP_KERNEL);
+	if (!log)
+		return ERR_PTR(-ENOMEM);
+	log->conf = conf;
+	spin_lock_init(&log->lock);
+	INIT_LIST_HEAD(&log->pending);
+	INIT_LIST_HEAD(&log->acked);
+	init_waitqueue_head(&log->space_wait);
+	init_waitqueue_head(&log->read_wait);
+	init_waitqueue_head(&log->replay_wait);
+	for (i = 0; i < (1 << R5L_INFLIGHT_BITS); i++)
+		atomic_set(&log->inflight[i], 0);
+	INIT_WORK(&log->flush_work, r5l_flush_work);
+	INIT_DELAYED_WORK(&log->reclaim_work, r5l_reclaim_work);
+	INIT_WORK(&log->replay_work, r5l_replay_work);
+	log->replaying = !fresh;
+
+	log->unit_pool = mempool_create_kmalloc_pool(R5L_POOL_SIZE,
+						     sizeof(struct r5l_io_unit));
+	mutex_init(&log->page_mutex);
+	log->page_pool = mempool_create_page_pool(R5L_RECORD_PAGES, 0);
+	log->bs = bioset_create(R5L_POOL_SIZE, 0);
+	log->sb_page = alloc_page(GFP_KERNEL);
+	if (!log->unit_pool || !log->page_pool || !log->bs || !log->sb_page)
+		goto out_free;
+
+	log->bdev = blkdev_get_by_dev(dev, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				      log);
+	if (IS_ERR(log->bdev)) {
+		err = PTR_ERR(log->bdev);
+		log->bdev = NULL;
+		goto out_free;
+	}
+
+	err = -EINVAL;
+	if (bdev_logical_block_size(log->bdev) > PAGE_SIZE)
+		goto out_put;
+	log->nr_blocks = i_size_read(log->bdev->bd_inode) >> PAGE_SHIFT;
+	if (log->nr_blocks < R5L_MIN_BLOCKS)
+		goto out_put;
+
+	err = r5l_load_super(log, fresh);
+	if (err)
+		goto out_put;
+
+	printk(KERN_INFO "md/raid:%s: journal on %s, %llu blocks\n",
+	       mdname(conf->mddev), bdevname(log->bdev, b),
+	       (unsigned long long)log->nr_blocks);
+	return log;
+
+out_put:
+	blkdev_put(log->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_free:
+	if (log->sb_page)
+		__free_page(log->sb_page);
+	if (log->bs)
+		bioset_free(log->bs);
+	if (log->page_pool)
+		mempool_destroy(log->page_pool);
+	if (log->unit_pool)
+		mempool_destroy(log->unit_pool);
+	kfree(log);
+	return ERR_PTR(err);
+}
+
+static bool r5l_quiet(struct r5l_log *log)
+{
+	bool quiet;
+
+	spin_lock_irq(&log->lock);
+	quiet = !log->nr_busy && list_empty(&log->pending);
+	spin_unlock_irq(&log->lock);
+	return quiet;
+}
+
+/*
+ * Wait for every journalled write to complete, and leave the journal
+ * empty so that the next attach has nothing to replay.  The array must
+ * already be quiesced.
+ */
+void r5l_exit(struct r5l_log *log)
+{
+	struct r5l_io_unit *u, *tmp;
+
+	flush_work(&log->replay_work);
+	wait_event(log->space_wait, r5l_quiet(log));
+	cancel_delayed_work_sync(&log->reclaim_work);
+	flush_work(&log->flush_work);
+
+	/* also finishes invalidating a journal that has just failed */
+	r5l_do_reclaim(log);
+
+	list_for_each_entry_safe(u, tmp, &log->acked, sibling)
+		mempool_free(u, log->unit_pool);
+
+	blkdev_put(log->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	__free_page(log->sb_page);
+	bioset_free(log->bs);
+	mempool_destroy(log->page_pool);
+	mempool_destroy(log->unit_pool);
+	kfree(log);
+}
+
+ssize_t r5l_show_journal(struct r5l_log *log, char *page)
+{
+	return sprintf(page, "%d:%d\n", MAJOR(log->bdev->bd_dev),
+		       MINOR(log->bdev->bd_dev));
+}
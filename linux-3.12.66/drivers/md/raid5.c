@@ -4442,6 +4442,9 @@ static void make_request(struct mddev *mddev, struct bio * bi)
 	const int rw = bio_data_dir(bi);
 	int remaining;
 
+	if (conf->log && r5l_handle_bio(conf->log, bi))
+		return;
+
 	if (unlikely(bi->bi_rw & REQ_FLUSH)) {
 		md_flush_request(mddev, bi);
 		return;
@@ -5281,11 +5284,94 @@ raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
 				raid5_show_group_thread_cnt,
 				raid5_store_group_thread_cnt);
 
+static ssize_t
+raid5_show_journal(struct mddev *mddev, char *page)
+{
+	struct r5conf *conf = mddev->private;
+	if (conf && conf->log)
+		return r5l_show_journal(conf->log, page);
+	else if (conf)
+		return sprintf(page, "none\n");
+	else
+		return 0;
+}
+
+/*
+ * "major:minor" attaches an empty journal device to the running array,
+ * and "none" drains and detaches it.  The superblock records the change
+ * before the journal takes any writes, or after it has let go of all of
+ * them.  md/journal_dev names the journal to use when the array is next
+ * started.
+ */
+static ssize_t
+raid5_store_journal(struct mddev *mddev, const char *page, size_t len)
+{
+	struct r5conf *conf = mddev->private;
+	struct r5l_log *log;
+	unsigned int major, minor;
+	char c;
+	dev_t dev;
+	int n;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (sysfs_streq(page, "none")) {
+		if (!conf->log)
+			return len;
+		if (r5l_replay_pending(conf->log))
+			return -EBUSY;
+		mddev_suspend(mddev);
+		r5l_exit(conf->log);
+		conf->log = NULL;
+		mddev_resume(mddev);
+		mddev->journal = 0;
+		mddev->journal_dev = 0;
+		md_update_sb(mddev, 1);
+		return len;
+	}
+
+	n = sscanf(page, "%u:%u%c", &major, &minor, &c);
+	if (n < 2 || (n == 3 && c != '\n'))
+		return -EINVAL;
+	dev = MKDEV(major, minor);
+	if (major != MAJOR(dev) || minor != MINOR(dev))
+		return -EOVERFLOW;
+	if (conf->log)
+		return -EBUSY;
+	if (mddev->ro == 1)
+		return -EROFS;
+	/* somewhere to record that the array now depends on a journal */
+	if (!mddev->persistent || mddev->major_version != 1)
+		return -EINVAL;
+
+	log = r5l_init(conf, dev, true);
+	if (IS_ERR(log))
+		return PTR_ERR(log);
+
+	mddev->journal = 1;
+	mddev->journal_dev = dev;
+	md_update_sb(mddev, 1);
+
+	mddev_suspend(mddev);
+	conf->log = log;
+	mddev_resume(mddev);
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_journal = __ATTR(journal, S_IRUGO | S_IWUSR,
+		       raid5_show_journal,
+		       raid5_store_journal);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
 	&raid5_group_thread_cnt.attr,
+	&raid5_journal.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -5874,6 +5960,46 @@ static int run(struct mddev *mddev)
 		}
 	}
 
+	if (mddev->journal_dev) {
+		struct r5l_log *log = ERR_PTR(-EINVAL);
+
+		/* the superblock must be able to record the journal.  One
+		 * the array already relies on is replayed once the array is
+		 * live and writable, before anything else reaches it */
+		if (mddev->persistent && mddev->major_version == 1 &&
+		    (mddev->journal || !mddev->ro))
+			log = r5l_init(conf, mddev->journal_dev,
+				       !mddev->journal);
+		if (IS_ERR(log))
+			printk(KERN_ERR "md/raid:%s: cannot use journal %d:%d\n",
+			       mdname(mddev), MAJOR(mddev->journal_dev),
+			       MINOR(mddev->journal_dev));
+		else {
+			/* a new journal must be on record before it acks
+			 * any write */
+			if (!mddev->journal) {
+				mddev->journal = 1;
+				md_update_sb(mddev, 1);
+			}
+			conf->log = log;
+		}
+	}
+	if (mddev->journal && !conf->log) {
+		if (mddev->ok_start_degraded) {
+			printk(KERN_WARNING
+			       "md/raid:%s: starting without journal"
+			       " - data corruption possible.\n",
+			       mdname(mddev));
+			mddev->journal = 0;
+			set_bit(MD_CHANGE_DEVS, &mddev->flags);
+		} else {
+			printk(KERN_ERR
+			       "md/raid:%s: cannot start array without its journal.\n",
+			       mdname(mddev));
+			goto abort;
+		}
+	}
+
 	if (mddev->degraded == 0)
 		printk(KERN_INFO "md/raid:%s: raid level %d active with %d out of %d"
 		       " devices, algorithm %d\n", mdname(mddev), conf->level,
@@ -6008,6 +6134,10 @@ static int stop(struct mddev *mddev)
 {
 	struct r5conf *conf = mddev->private;
 
+	if (conf->log) {
+		r5l_exit(conf->log);
+		conf->log = NULL;
+	}
 	md_unregister_thread(&mddev->thread);
 	if (mddev->queue)
 		mddev->queue->backing_dev_info.congested_fn = NULL;
@@ -480,6 +480,8 @@ struct r5conf {
 	struct r5worker_group	*worker_groups;
 	int			group_cnt;
 	int			worker_cnt_per_group;
+
+	struct r5l_log		*log;	/* write-back journal, if attached */
 };
 
 /*
@@ -547,4 +549,11 @@ static inline int algorithm_is_DDF(int layout)
 extern int md_raid5_congested(struct mddev *mddev, int bits);
 extern void md_raid5_kick_device(struct r5conf *conf);
 extern int raid5_set_cache_size(struct mddev *mddev, int size);
+
+struct r5l_log;
+extern struct r5l_log *r5l_init(struct r5conf *conf, dev_t dev, bool fresh);
+extern void r5l_exit(struct r5l_log *log);
+extern bool r5l_handle_bio(struct r5l_log *log, struct bio *bio);
+extern ssize_t r5l_show_journal(struct r5l_log *log, char *page);
+extern bool r5l_replay_pending(struct r5l_log *log);
 #endif
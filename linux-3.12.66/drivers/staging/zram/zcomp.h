@@ -0,0 +1,52 @@
+/*
+ * Compression backends for zram
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+/* static compression backend */
+struct zcomp_backend {
+	/*
+	 * Compress one page from @src into @dst. @dst must be able to
+	 * hold 2 * PAGE_SIZE bytes; the compressed length is returned
+	 * in @dst_len.
+	 */
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private);
+
+	/* Decompress @src_len bytes from @src into a PAGE_SIZE @dst */
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+
+	/* allocate and free the backend private (working) memory */
+	void *(*create)(void);
+	void (*destroy)(void *private);
+
+	const char *name;
+};
+
+/* dynamic per-device compression frontend */
+struct zcomp {
+	void *private;		/* backend working memory */
+	void *buffer;		/* compression output buffer */
+	struct zcomp_backend *backend;
+};
+
+ssize_t zcomp_available_show(const char *comp, char *buf);
+bool zcomp_available_algorithm(const char *comp);
+
+struct zcomp *zcomp_create(const char *comp);
+void zcomp_destroy(struct zcomp *comp);
+
+int zcomp_compress(struct zcomp *comp, const unsigned char *src,
+		size_t *dst_len);
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst);
+
+#endif /* _ZCOMP_H_ */
@@ -18,7 +18,8 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "../zsmalloc/zsmalloc.h"
+#include <linux/zsmalloc.h>
+#include "zcomp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -40,6 +41,9 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
  * always return failure.
  */
 
+/* Compression algorithm used by newly initialized devices */
+static const char *default_compressor = "lzo";
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -88,8 +92,6 @@ struct zram_stats {
 };
 
 struct zram_meta {
-	void *compress_workmem;
-	void *compress_buffer;
 	struct table *table;
 	struct zs_pool *mem_pool;
 };
@@ -101,6 +103,7 @@ struct zram_slot_free {
 
 struct zram {
 	struct zram_meta *meta;
+	struct zcomp *comp;
 	struct rw_semaphore lock; /* protect compression buffers, table,
 				   * 32bit stat counters against concurrent
 				   * notifications, reads and writes */
@@ -121,5 +124,6 @@ struct zram {
 	spinlock_t slot_free_lock;
 
 	struct zram_stats stats;
+	char compressor[10];
 };
 #endif
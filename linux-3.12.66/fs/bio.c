@@ -28,6 +28,7 @@
 #include <linux/mempool.h>
 #include <linux/workqueue.h>
 #include <linux/cgroup.h>
+#include <linux/cpu.h>
 #include <scsi/sg.h>		/* for struct sg_iovec */
 
 #include <trace/events/block.h>
@@ -237,6 +238,126 @@ fallback:
 	return bvl;
 }
 
+/*
+ * Each bio_set keeps a small per cpu stack of free bios in front of its
+ * mempool. It is refilled and drained with the slab bulk API, so the
+ * allocator is entered once per BIO_CACHE_BATCH bios. The mempool reserve
+ * is always topped up before bios are kept here, and callers that cannot
+ * use the cache simply fall through to the mempool.
+ */
+#define BIO_CACHE_SIZE		32
+#define BIO_CACHE_BATCH		8
+
+struct bio_alloc_cache {
+	unsigned int	nr;
+	void		*objs[BIO_CACHE_SIZE];
+};
+
+/* every bio_set with a cache, so that a dead cpu's bios can be freed */
+static LIST_HEAD(bio_cache_sets);
+static DEFINE_MUTEX(bio_cache_lock);
+
+static void *bio_cache_get(struct bio_set *bs, gfp_t gfp_mask)
+{
+	struct bio_alloc_cache *cache;
+	void *batch[BIO_CACHE_BATCH];
+	unsigned long flags;
+	void *p = NULL;
+	int nr, room;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bs->cache);
+	if (cache->nr)
+		p = cache->objs[--cache->nr];
+	local_irq_restore(flags);
+
+	/* bulk allocation wants interrupts enabled */
+	if (p || irqs_disabled())
+		return p;
+
+	nr = kmem_cache_alloc_bulk(bs->bio_slab,
+				   (gfp_mask & ~__GFP_WAIT) | __GFP_NOWARN,
+				   BIO_CACHE_BATCH, batch);
+	if (!nr)
+		return NULL;
+	p = batch[--nr];
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bs->cache);
+	room = min_t(int, nr, BIO_CACHE_SIZE - cache->nr);
+	memcpy(cache->objs + cache->nr, batch, room * sizeof(void *));
+	cache->nr += room;
+	local_irq_restore(flags);
+
+	if (room < nr)
+		kmem_cache_free_bulk(bs->bio_slab, nr - room, batch + room);
+	return p;
+}
+
+static void bio_cache_put(struct bio_set *bs, void *p)
+{
+	struct bio_alloc_cache *cache;
+	void *batch[BIO_CACHE_BATCH];
+	unsigned long flags;
+	int nr = 0;
+
+	/* somebody may be waiting on an empty reserve */
+	if (bs->bio_pool->curr_nr < bs->bio_pool->min_nr) {
+		mempool_free(p, bs->bio_pool);
+		return;
+	}
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(bs->cache);
+	if (cache->nr == BIO_CACHE_SIZE && !irqs_disabled_flags(flags)) {
+		cache->nr -= BIO_CACHE_BATCH;
+		memcpy(batch, cache->objs + cache->nr, sizeof(batch));
+		nr = BIO_CACHE_BATCH;
+	}
+	if (cache->nr < BIO_CACHE_SIZE) {
+		cache->objs[cache->nr++] = p;
+		p = NULL;
+	}
+	local_irq_restore(flags);
+
+	if (nr)
+		kmem_cache_free_bulk(bs->bio_slab, nr, batch);
+	if (p)
+		mempool_free(p, bs->bio_pool);
+}
+
+static void bio_cache_drain_cpu(struct bio_set *bs, int cpu)
+{
+	struct bio_alloc_cache *cache = per_cpu_ptr(bs->cache, cpu);
+
+	if (cache->nr)
+		kmem_cache_free_bulk(bs->bio_slab, cache->nr, cache->objs);
+	cache->nr = 0;
+}
+
+static void bio_cache_drain(struct bio_set *bs)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		bio_cache_drain_cpu(bs, cpu);
+}
+
+static int bio_cache_cpu_notify(struct notifier_block *self,
+				unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long)hcpu;
+	struct bio_set *bs;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN) {
+		mutex_lock(&bio_cache_lock);
+		list_for_each_entry(bs, &bio_cache_sets, cache_list)
+			bio_cache_drain_cpu(bs, cpu);
+		mutex_unlock(&bio_cache_lock);
+	}
+	return NOTIFY_OK;
+}
+
 static void __bio_free(struct bio *bio)
 {
 	bio_disassociate_task(bio);
@@ -262,7 +383,7 @@ static void bio_free(struct bio *bio)
 		p = bio;
 		p -= bs->front_pad;
 
-		mempool_free(p, bs->bio_pool);
+		bio_cache_put(bs, p);
 	} else {
 		/* Bio was allocated by bio_kmalloc() */
 		kfree(bio);
@@ -425,7 +546,9 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, int nr_iovecs, struct bio_set *bs)
 		if (current->bio_list && !bio_list_empty(current->bio_list))
 			gfp_mask &= ~__GFP_WAIT;
 
-		p = mempool_alloc(bs->bio_pool, gfp_mask);
+		p = bio_cache_get(bs, gfp_mask);
+		if (!p)
+			p = mempool_alloc(bs->bio_pool, gfp_mask);
 		if (!p && gfp_mask != saved_gfp) {
 			punt_bios_to_rescuer(bs);
 			gfp_mask = saved_gfp;
@@ -1862,6 +1985,14 @@ void bioset_free(struct bio_set *bs)
 	if (bs->rescue_workqueue)
 		destroy_workqueue(bs->rescue_workqueue);
 
+	if (bs->cache) {
+		mutex_lock(&bio_cache_lock);
+		list_del(&bs->cache_list);
+		mutex_unlock(&bio_cache_lock);
+		bio_cache_drain(bs);
+		free_percpu(bs->cache);
+	}
+
 	if (bs->bio_pool)
 		mempool_destroy(bs->bio_pool);
 
@@ -1913,6 +2044,13 @@ struct bio_set *bioset_create(unsigned int pool_size, unsigned int front_pad)
 	if (!bs->bio_pool)
 		goto bad;
 
+	bs->cache = alloc_percpu(struct bio_alloc_cache);
+	if (!bs->cache)
+		goto bad;
+	mutex_lock(&bio_cache_lock);
+	list_add(&bs->cache_list, &bio_cache_sets);
+	mutex_unlock(&bio_cache_lock);
+
 	bs->bvec_pool = biovec_create_pool(bs, pool_size);
 	if (!bs->bvec_pool)
 		goto bad;
@@ -2015,6 +2153,7 @@ static int __init init_bio(void)
 
 	bio_integrity_init();
 	biovec_init_slabs();
+	hotcpu_notifier(bio_cache_cpu_notify, 0);
 
 	fs_bio_set = bioset_create(BIO_POOL_SIZE, 0);
 	if (!fs_bio_set)
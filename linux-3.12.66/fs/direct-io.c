@@ -26,6 +26,7 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/highmem.h>
+#include <linux/vmalloc.h>
 #include <linux/pagemap.h>
 #include <linux/task_io_accounting_ops.h>
 #include <linux/bio.h>
@@ -38,6 +39,7 @@
 #include <linux/atomic.h>
 #include <linux/prefetch.h>
 #include <linux/aio.h>
+#include <linux/uaccess.h>
 
 /*
  * How many user pages to map in one call to get_user_pages().  This determines
@@ -128,10 +130,12 @@ struct dio {
 	int page_errors;		/* errno from get_user_pages() */
 	int is_async;			/* is IO async ? */
 	bool defer_completion;		/* defer AIO completion to workqueue? */
+	bool kernel_pages;		/* iovecs address kernel memory */
 	int io_error;			/* IO error in completion path */
 	unsigned long refcount;		/* direct_io_worker() and bios */
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
+	struct block_device *bio_bdev;	/* where the last bio was sent */
 
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
@@ -158,6 +162,31 @@ static inline unsigned dio_pages_present(struct dio_submit *sdio)
 	return sdio->tail - sdio->head;
 }
 
+/*
+ * Take references on the pages backing a kernel buffer.  The caller
+ * keeps the buffer (and any kmap of it) alive until submission is done.
+ */
+static int dio_get_kernel_pages(unsigned long addr, int nr_pages,
+				struct page **pages)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++, addr += PAGE_SIZE) {
+		const void *kaddr = (const void *)addr;
+		struct page *page;
+
+		if (is_vmalloc_addr(kaddr))
+			page = vmalloc_to_page(kaddr);
+		else
+			page = kmap_to_page((void *)kaddr);
+		if (!page)
+			return i ? i : -EFAULT;
+		page_cache_get(page);
+		pages[i] = page;
+	}
+	return nr_pages;
+}
+
 /*
  * Go grab and pin some userspace pages.   Typically we'll get 64 at a time.
  */
@@ -167,11 +196,15 @@ static inline int dio_refill_pages(struct dio *dio, struct dio_submit *sdio)
 	int nr_pages;
 
 	nr_pages = min(sdio->total_pages - sdio->curr_page, DIO_PAGES);
-	ret = get_user_pages_fast(
-		sdio->curr_user_address,		/* Where from? */
-		nr_pages,			/* How many pages? */
-		dio->rw == READ,		/* Write to memory? */
-		&dio->pages[0]);		/* Put results here */
+	if (dio->kernel_pages)
+		ret = dio_get_kernel_pages(sdio->curr_user_address,
+					   nr_pages, &dio->pages[0]);
+	else
+		ret = get_user_pages_fast(
+			sdio->curr_user_address,	/* Where from? */
+			nr_pages,		/* How many pages? */
+			dio->rw == READ,	/* Write to memory? */
+			&dio->pages[0]);	/* Put results here */
 
 	if (ret < 0 && sdio->blocks_available && (dio->rw & WRITE)) {
 		struct page *page = ZERO_PAGE(0);
@@ -403,9 +436,11 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 	dio->refcount++;
 	spin_unlock_irqrestore(&dio->bio_lock, flags);
 
-	if (dio->is_async && dio->rw == READ)
+	if (dio->is_async && dio->rw == READ && !dio->kernel_pages)
 		bio_set_pages_dirty(bio);
 
+	dio->bio_bdev = bio->bi_bdev;
+
 	if (sdio->submit_io)
 		sdio->submit_io(dio->rw, bio, dio->inode,
 			       sdio->logical_offset_in_bio);
@@ -436,6 +471,7 @@ static struct bio *dio_await_one(struct dio *dio)
 {
 	unsigned long flags;
 	struct bio *bio = NULL;
+	bool may_sleep = true;
 
 	spin_lock_irqsave(&dio->bio_lock, flags);
 
@@ -443,13 +479,16 @@ static struct bio *dio_await_one(struct dio *dio)
 	 * Wait as long as the list is empty and there are bios in flight.  bio
 	 * completion drops the count, maybe adds to the list, and wakes while
 	 * holding the bio_lock so we don't need set_current_state()'s barrier
-	 * and can call it after testing our condition.
+	 * and can call it after testing our condition.  A device that supports
+	 * polling may reap the completion itself before we go to sleep.
 	 */
 	while (dio->refcount > 1 && dio->bio_list == NULL) {
 		__set_current_state(TASK_UNINTERRUPTIBLE);
 		dio->waiter = current;
 		spin_unlock_irqrestore(&dio->bio_lock, flags);
-		io_schedule();
+		if (!blk_poll(bdev_get_queue(dio->bio_bdev), may_sleep))
+			io_schedule();
+		may_sleep = false;
 		/* wake up sets us TASK_RUNNING */
 		spin_lock_irqsave(&dio->bio_lock, flags);
 		dio->waiter = NULL;
@@ -474,13 +513,14 @@ static int dio_bio_complete(struct dio *dio, struct bio *bio)
 	if (!uptodate)
 		dio->io_error = -EIO;
 
-	if (dio->is_async && dio->rw == READ) {
+	if (dio->is_async && dio->rw == READ && !dio->kernel_pages) {
 		bio_check_pages_dirty(bio);	/* transfers ownership */
 	} else {
 		bio_for_each_segment_all(bvec, bio, i) {
 			struct page *page = bvec->bv_page;
 
-			if (dio->rw == READ && !PageCompound(page))
+			if (dio->rw == READ && !PageCompound(page) &&
+			    !dio->kernel_pages)
 				set_page_dirty_lock(page);
 			page_cache_release(page);
 		}
@@ -1204,6 +1244,14 @@ do_blockdev_direct_IO(int rw, struct kiocb *iocb, struct inode *inode,
 	dio->inode = inode;
 	dio->rw = rw;
 
+	/*
+	 * Kernel threads without a user mm (e.g. the loop driver) can only
+	 * hand us kernel buffers.  Those pages are owned by the caller and
+	 * must not be looked up with get_user_pages() or redirtied.
+	 */
+	dio->kernel_pages = (rw & REQ_KERNEL) ||
+		(!current->mm && segment_eq(get_fs(), KERNEL_DS));
+
 	/*
 	 * For AIO O_(D)SYNC writes we need to defer completions to a workqueue
 	 * so that we can call ->fsync.
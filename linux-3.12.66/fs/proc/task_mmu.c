@@ -509,7 +509,9 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 	if (pmd_trans_huge_lock(pmd, vma) == 1) {
 		smaps_pte_entry(*(pte_t *)pmd, addr, HPAGE_PMD_SIZE, walk);
 		spin_unlock(&walk->mm->page_table_lock);
-		mss->anonymous_thp += HPAGE_PMD_SIZE;
+		/* huge pages of shmem are not anonymous */
+		if (!vma->vm_file)
+			mss->anonymous_thp += HPAGE_PMD_SIZE;
 		return 0;
 	}
 
@@ -528,6 +528,10 @@ struct bio_set {
 
 	mempool_t *bio_pool;
 	mempool_t *bvec_pool;
+
+	/* per cpu bios refilled and drained in batches, see bio_cache_get() */
+	struct bio_alloc_cache __percpu *cache;
+	struct list_head cache_list;	/* for draining dead cpus */
 #if defined(CONFIG_BLK_DEV_INTEGRITY)
 	mempool_t *bio_integrity_pool;
 	mempool_t *bvec_integrity_pool;
@@ -235,6 +235,38 @@ static inline void copy_user_highpage(struct page *to, struct page *from,
 
 #endif
 
+/*
+ * Clear or copy a user page without pulling it into the cache, where the
+ * architecture provides clear_user_page_nocache() and copy_user_page_nocache():
+ * for the bulk of a huge page, most of which will not be touched soon.
+ */
+#ifdef __HAVE_ARCH_USER_PAGE_NOCACHE
+static inline void clear_user_highpage_nocache(struct page *page,
+					       unsigned long vaddr)
+{
+	void *addr = kmap_atomic(page);
+	clear_user_page_nocache(addr, vaddr, page);
+	kunmap_atomic(addr);
+}
+
+static inline void copy_user_highpage_nocache(struct page *to,
+	struct page *from, unsigned long vaddr, struct vm_area_struct *vma)
+{
+	char *vfrom, *vto;
+
+	vfrom = kmap_atomic(from);
+	vto = kmap_atomic(to);
+	copy_user_page_nocache(vto, vfrom, vaddr, to);
+	kunmap_atomic(vto);
+	kunmap_atomic(vfrom);
+}
+#else
+#define clear_user_highpage_nocache(page, vaddr) \
+	clear_user_highpage(page, vaddr)
+#define copy_user_highpage_nocache(to, from, vaddr, vma) \
+	copy_user_highpage(to, from, vaddr, vma)
+#endif
+
 static inline void copy_highpage(struct page *to, struct page *from)
 {
 	char *vfrom, *vto;
@@ -357,6 +357,11 @@ static inline void ClearPageCompound(struct page *page)
 	BUG_ON(!PageHead(page));
 	ClearPageHead(page);
 }
+
+static inline void ClearPageTail(struct page *page)
+{
+	clear_bit(PG_tail, &page->flags);
+}
 #endif
 #else
 /*
@@ -407,6 +412,13 @@ static inline void ClearPageCompound(struct page *page)
 	BUG_ON((page->flags & PG_head_tail_mask) != (1 << PG_compound));
 	clear_bit(PG_compound, &page->flags);
 }
+
+static inline void ClearPageTail(struct page *page)
+{
+	BUG_ON(!PageTail(page));
+	clear_bit(PG_compound, &page->flags);
+	clear_bit(PG_reclaim, &page->flags);
+}
 #endif
 
 #endif /* !PAGEFLAGS_EXTENDED */
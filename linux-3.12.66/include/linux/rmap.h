@@ -90,6 +90,11 @@ enum ttu_flags {
 	TTU_IGNORE_MLOCK = (1 << 8),	/* ignore mlock */
 	TTU_IGNORE_ACCESS = (1 << 9),	/* don't age */
 	TTU_IGNORE_HWPOISON = (1 << 10),/* corrupted page is recoverable */
+	TTU_BATCH_FLUSH = (1 << 11),	/* Batch TLB flushes where possible
+					 * and caller guarantees they will
+					 * do a final flush if necessary */
+	TTU_LZFREE = (1 << 12),		/* drop clean anon pages freed by
+					 * MADV_FREE instead of swapping */
 };
 
 #ifdef CONFIG_MMU
@@ -175,6 +180,8 @@ void page_add_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
 void do_page_add_anon_rmap(struct page *, struct vm_area_struct *,
 			   unsigned long, int);
 void page_add_new_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
+void __page_add_new_anon_rmap(struct page *, struct vm_area_struct *,
+			      pgoff_t, vm_flags_t);
 void page_add_file_rmap(struct page *);
 void page_remove_rmap(struct page *);
 
@@ -115,6 +115,17 @@ void kmem_cache_destroy(struct kmem_cache *);
 int kmem_cache_shrink(struct kmem_cache *);
 void kmem_cache_free(struct kmem_cache *, void *);
 
+/*
+ * Bulk allocation and freeing. SLUB takes objects off and puts them back
+ * on the per cpu freelists in one pass; the other allocators fall back to
+ * a loop of single operations. kmem_cache_alloc_bulk() allocates all
+ * objects or none and returns the number allocated.
+ *
+ * Interrupts must be enabled when calling these functions.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *, size_t, void **);
+int kmem_cache_alloc_bulk(struct kmem_cache *, gfp_t, size_t, void **);
+
 /*
  * Please use this macro to create slab caches. Simply specify the
  * name of the structure and maybe some flags that are listed above.
@@ -0,0 +1,37 @@
+#ifndef _LINUX_SWAP_SLOTS_H
+#define _LINUX_SWAP_SLOTS_H
+
+#include <linux/swap.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+
+#define SWAP_SLOTS_CACHE_SIZE			64
+#define THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE	(5*SWAP_SLOTS_CACHE_SIZE)
+#define THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE	(2*SWAP_SLOTS_CACHE_SIZE)
+
+/*
+ * Per cpu cache of swap slots. Allocation takes slots from @slots,
+ * refilled SWAP_SLOTS_CACHE_SIZE at a time from one swap device. Freed
+ * slots are gathered in @slots_ret and released to their swap devices
+ * in one batch.
+ */
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr, cur */
+	swp_entry_t	*slots;
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	swp_entry_t	*slots_ret;
+	int		n_ret;
+};
+
+#ifdef CONFIG_SWAP
+extern bool swap_slot_cache_enabled;
+
+void disable_swap_slots_cache_lock(void);
+void reenable_swap_slots_cache_unlock(void);
+void enable_swap_slots_cache(void);
+void free_swap_slot(swp_entry_t entry);
+#endif
+
+#endif /* _LINUX_SWAP_SLOTS_H */
@@ -145,6 +145,11 @@ static int __replace_page(struct vm_area_struct *vma, unsigned long addr,
 
 	get_page(kpage);
 	page_add_new_anon_rmap(kpage, vma, addr);
+	/*
+	 * kpage is mapped by a clean pte: reclaim would drop it unwritten
+	 * as if freed by MADV_FREE unless it is marked dirty.
+	 */
+	SetPageDirty(kpage);
 
 	if (!PageAnon(page)) {
 		dec_mm_counter(mm, MM_FILEPAGES);
@@ -18,6 +18,7 @@
 #include <linux/seqlock.h>
 #include <linux/mutex.h>
 #include <linux/gfp.h>
+#include <linux/hash.h>
 #include <asm/tlbflush.h>
 #include <asm/io.h>
 
@@ -27,22 +28,86 @@
  * We do use our own empty page to avoid interference with other users
  * of ZERO_PAGE(), such as /dev/zero
  */
-static DEFINE_MUTEX(xip_sparse_mutex);
-static seqcount_t xip_sparse_seq = SEQCNT_ZERO;
 static struct page *__xip_sparse_page;
 
-/* called under xip_sparse_mutex */
+/*
+ * Mapping the sparse page into a hole and unmapping it again once the hole
+ * gets a block must not race with each other.  Both sides hash the
+ * (mapping, pgoff) pair to one of these, so faults on different files or on
+ * different ranges of one file do not contend.  Ranges are a few pages wide
+ * to keep neighbouring faults on separate cachelines from bouncing the same
+ * lock.
+ */
+#define XIP_SPARSE_HASH_BITS	8
+#define XIP_SPARSE_RANGE_SHIFT	4
+
+struct xip_sparse_lock {
+	struct mutex mutex;
+	seqcount_t seq;
+} ____cacheline_aligned_in_smp;
+
+static struct xip_sparse_lock xip_sparse_locks[1 << XIP_SPARSE_HASH_BITS];
+
+/*
+ * Block allocation through get_xip_mem(create=1) is serialized per mapping:
+ * not every XIP filesystem can allocate blocks concurrently within one file.
+ */
+static struct mutex xip_alloc_mutexes[1 << XIP_SPARSE_HASH_BITS];
+
+static struct xip_sparse_lock *
+xip_sparse_lock(struct address_space *mapping, pgoff_t pgoff)
+{
+	unsigned long key = (unsigned long)mapping +
+				(pgoff >> XIP_SPARSE_RANGE_SHIFT);
+
+	return &xip_sparse_locks[hash_long(key, XIP_SPARSE_HASH_BITS)];
+}
+
+static struct mutex *xip_alloc_mutex(struct address_space *mapping)
+{
+	return &xip_alloc_mutexes[hash_ptr(mapping, XIP_SPARSE_HASH_BITS)];
+}
+
+static int __init xip_sparse_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(xip_sparse_locks); i++) {
+		mutex_init(&xip_sparse_locks[i].mutex);
+		seqcount_init(&xip_sparse_locks[i].seq);
+		mutex_init(&xip_alloc_mutexes[i]);
+	}
+	return 0;
+}
+core_initcall(xip_sparse_init);
+
 static struct page *xip_sparse_page(void)
 {
 	if (!__xip_sparse_page) {
 		struct page *page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
 
-		if (page)
-			__xip_sparse_page = page;
+		if (page && cmpxchg(&__xip_sparse_page, NULL, page))
+			__free_page(page);
 	}
 	return __xip_sparse_page;
 }
 
+/*
+ * Allocate a block for the hole at pgoff.
+ */
+static int xip_alloc_mem(struct address_space *mapping, pgoff_t pgoff,
+			 void **xip_mem, unsigned long *xip_pfn)
+{
+	struct mutex *lock = xip_alloc_mutex(mapping);
+	int error;
+
+	mutex_lock(lock);
+	error = mapping->a_ops->get_xip_mem(mapping, pgoff, 1,
+						xip_mem, xip_pfn);
+	mutex_unlock(lock);
+	return error;
+}
+
 /*
  * This is a file read routine for execute in place files, and uses
  * the mapping->a_ops->get_xip_mem() function for the actual low-level
@@ -174,12 +239,13 @@ __xip_unmap (struct address_space * mapping,
 	pte_t pteval;
 	spinlock_t *ptl;
 	struct page *page;
+	struct xip_sparse_lock *sl = xip_sparse_lock(mapping, pgoff);
 	unsigned count;
 	int locked = 0;
 
-	count = read_seqcount_begin(&xip_sparse_seq);
+	count = read_seqcount_begin(&sl->seq);
 
-	page = __xip_sparse_page;
+	page = ACCESS_ONCE(__xip_sparse_page);
 	if (!page)
 		return;
 
@@ -207,9 +273,9 @@ retry:
 	mutex_unlock(&mapping->i_mmap_mutex);
 
 	if (locked) {
-		mutex_unlock(&xip_sparse_mutex);
-	} else if (read_seqcount_retry(&xip_sparse_seq, count)) {
-		mutex_lock(&xip_sparse_mutex);
+		mutex_unlock(&sl->mutex);
+	} else if (read_seqcount_retry(&sl->seq, count)) {
+		mutex_lock(&sl->mutex);
 		locked = 1;
 		goto retry;
 	}
@@ -274,10 +340,7 @@ again:
 		int err;
 
 		/* maybe shared writable, allocate new block */
-		mutex_lock(&xip_sparse_mutex);
-		error = mapping->a_ops->get_xip_mem(mapping, vmf->pgoff, 1,
-							&xip_mem, &xip_pfn);
-		mutex_unlock(&xip_sparse_mutex);
+		error = xip_alloc_mem(mapping, vmf->pgoff, &xip_mem, &xip_pfn);
 		if (error)
 			return VM_FAULT_SIGBUS;
 		/* unmap sparse mappings at pgoff from all other vmas */
@@ -424,14 +487,16 @@ found:
 		return VM_FAULT_NOPAGE;
 	} else {
 		int err, ret = VM_FAULT_OOM;
+		struct xip_sparse_lock *sl = xip_sparse_lock(mapping,
+							     vmf->pgoff);
 
-		mutex_lock(&xip_sparse_mutex);
-		write_seqcount_begin(&xip_sparse_seq);
+		mutex_lock(&sl->mutex);
+		write_seqcount_begin(&sl->seq);
 		error = mapping->a_ops->get_xip_mem(mapping, vmf->pgoff, 0,
 							&xip_mem, &xip_pfn);
 		if (unlikely(!error)) {
-			write_seqcount_end(&xip_sparse_seq);
-			mutex_unlock(&xip_sparse_mutex);
+			write_seqcount_end(&sl->seq);
+			mutex_unlock(&sl->mutex);
 			goto again;
 		}
 		if (error != -ENODATA)
@@ -455,8 +520,8 @@ found:
 		//	printk(KERN_DEBUG "filemap_xip_fault;07\n");
 		//}
 out:
-		write_seqcount_end(&xip_sparse_seq);
-		mutex_unlock(&xip_sparse_mutex);
+		write_seqcount_end(&sl->seq);
+		mutex_unlock(&sl->mutex);
 		//if (vma->vm_ops->page_mkwrite == pram_xip_mkwrite){
 		//	printk(KERN_DEBUG "filemap_xip_fault;08\n");
 		//}
@@ -513,10 +578,8 @@ __xip_file_write(struct file *filp, const char __user *buf,
 						&xip_mem, &xip_pfn);
 		if (status == -ENODATA) {
 			/* we allocate a new page unmap it */
-			mutex_lock(&xip_sparse_mutex);
-			status = a_ops->get_xip_mem(mapping, index, 1,
-							&xip_mem, &xip_pfn);
-			mutex_unlock(&xip_sparse_mutex);
+			status = xip_alloc_mem(mapping, index,
+						&xip_mem, &xip_pfn);
 			if (!status)
 				/* unmap page at pgoff from all other vmas */
 				__xip_unmap(mapping, index);
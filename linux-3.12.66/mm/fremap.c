@@ -237,6 +237,10 @@ get_write_lock:
 			}
 			goto out_freed;
 		}
+		/* rmap cannot find huge pmds through i_mmap_nonlinear */
+		if (vma->vm_ops->pmd_fault)
+			zap_page_range(vma, vma->vm_start,
+				       vma->vm_end - vma->vm_start, NULL);
 		mutex_lock(&mapping->i_mmap_mutex);
 		flush_dcache_mmap_lock(mapping);
 		vma->vm_flags |= VM_NONLINEAR;
@@ -21,6 +21,7 @@
 #include <linux/pagemap.h>
 #include <linux/migrate.h>
 #include <linux/hashtable.h>
+#include <linux/shmem_fs.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -398,6 +399,9 @@ static struct attribute *hugepage_attr[] = {
 	&enabled_attr.attr,
 	&defrag_attr.attr,
 	&use_zero_page_attr.attr,
+#ifdef CONFIG_SHMEM
+	&shmem_enabled_attr.attr,
+#endif
 #ifdef CONFIG_DEBUG_VM
 	&debug_cow_attr.attr,
 #endif
@@ -705,9 +709,10 @@ static inline pmd_t mk_huge_pmd(struct page *page, pgprot_t prot)
 
 static int __do_huge_pmd_anonymous_page(struct mm_struct *mm,
 					struct vm_area_struct *vma,
-					unsigned long haddr, pmd_t *pmd,
+					unsigned long address, pmd_t *pmd,
 					struct page *page)
 {
+	unsigned long haddr = address & HPAGE_PMD_MASK;
 	pgtable_t pgtable;
 
 	VM_BUG_ON(!PageCompound(page));
@@ -715,7 +720,7 @@ static int __do_huge_pmd_anonymous_page(struct mm_struct *mm,
 	if (unlikely(!pgtable))
 		return VM_FAULT_OOM;
 
-	clear_huge_page(page, haddr, HPAGE_PMD_NR);
+	clear_huge_page(page, address, HPAGE_PMD_NR);
 	/*
 	 * The memory barrier inside __SetPageUptodate makes sure that
 	 * clear_huge_page writes become visible before the set_pmd_at()
@@ -822,7 +827,7 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		count_vm_event(THP_FAULT_FALLBACK);
 		return VM_FAULT_FALLBACK;
 	}
-	if (unlikely(__do_huge_pmd_anonymous_page(mm, vma, haddr, pmd, page))) {
+	if (unlikely(__do_huge_pmd_anonymous_page(mm, vma, address, pmd, page))) {
 		mem_cgroup_uncharge_page(page);
 		put_page(page);
 		count_vm_event(THP_FAULT_FALLBACK);
@@ -833,6 +838,46 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	return 0;
 }
 
+/*
+ * Map a huge page of the page cache, locked by the caller, at an empty
+ * pmd.  The caller's reference on the page goes to the mapping, or is
+ * dropped if somebody else populated the pmd first.
+ */
+int do_huge_pmd_file_page(struct vm_area_struct *vma, unsigned long address,
+			  pmd_t *pmd, struct page *page)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+
+	VM_BUG_ON(!PageLocked(page) || !PageTransHuge(page));
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable)) {
+		put_page(page);
+		return VM_FAULT_OOM;
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		put_page(page);
+		pte_free(mm, pgtable);
+	} else {
+		pmd_t entry;
+		entry = mk_huge_pmd(page, vma->vm_page_prot);
+		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+		page_add_file_rmap(page);
+		pgtable_trans_huge_deposit(mm, pmd, pgtable);
+		set_pmd_at(mm, haddr, pmd, entry);
+		add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+		mm->nr_ptes++;
+		spin_unlock(&mm->page_table_lock);
+		count_vm_event(THP_FILE_MAPPED);
+	}
+
+	return 0;
+}
+
 int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
 		  struct vm_area_struct *vma)
@@ -891,6 +936,12 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	}
 	src_page = pmd_page(pmd);
 	VM_BUG_ON(!PageHead(src_page));
+	if (!PageAnon(src_page)) {
+		/* the child faults the huge page of the file in again */
+		pte_free(dst_mm, pgtable);
+		ret = 0;
+		goto out_unlock;
+	}
 	get_page(src_page);
 	page_dup_rmap(src_page);
 	add_mm_counter(dst_mm, MM_ANONPAGES, HPAGE_PMD_NR);
@@ -1116,6 +1167,15 @@ int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	unsigned long mmun_start;	/* For mmu_notifiers */
 	unsigned long mmun_end;		/* For mmu_notifiers */
 
+	/*
+	 * A huge page of a shared file mapping is never copied on write:
+	 * drop the pmd and let the ptes sort out the write protection.
+	 */
+	if (vma->vm_ops) {
+		__split_huge_page_pmd(vma, address, pmd);
+		return VM_FAULT_FALLBACK;
+	}
+
 	VM_BUG_ON(!vma->anon_vma);
 	haddr = address & HPAGE_PMD_MASK;
 	if (is_huge_zero_pmd(orig_pmd))
@@ -1177,9 +1237,10 @@ alloc:
 	count_vm_event(THP_FAULT_ALLOC);
 
 	if (!page)
-		clear_huge_page(new_page, haddr, HPAGE_PMD_NR);
+		clear_huge_page(new_page, address, HPAGE_PMD_NR);
 	else
-		copy_user_huge_page(new_page, page, haddr, vma, HPAGE_PMD_NR);
+		copy_user_huge_page(new_page, page, address, vma,
+				    HPAGE_PMD_NR);
 	__SetPageUptodate(new_page);
 
 	mmun_start = haddr;
@@ -1411,7 +1472,9 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 			page = pmd_page(orig_pmd);
 			page_remove_rmap(page);
 			VM_BUG_ON(page_mapcount(page) < 0);
-			add_mm_counter(tlb->mm, MM_ANONPAGES, -HPAGE_PMD_NR);
+			add_mm_counter(tlb->mm, PageAnon(page) ?
+				       MM_ANONPAGES : MM_FILEPAGES,
+				       -HPAGE_PMD_NR);
 			VM_BUG_ON(!PageHead(page));
 			tlb->mm->nr_ptes--;
 			spin_unlock(&tlb->mm->page_table_lock);
@@ -1491,14 +1554,14 @@ int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 			if (pmd_numa(entry))
 				entry = pmd_mknonnuma(entry);
 			entry = pmd_modify(entry, newprot);
-			BUG_ON(pmd_write(entry));
+			BUG_ON(pmd_write(entry) && !(vma->vm_flags & VM_SHARED));
 			set_pmd_at(mm, addr, pmd, entry);
 		} else {
 			struct page *page = pmd_page(*pmd);
 			entry = *pmd;
 
-			/* only check non-shared pages */
-			if (page_mapcount(page) == 1 &&
+			/* only check non-shared anonymous pages */
+			if (PageAnon(page) && page_mapcount(page) == 1 &&
 			    !pmd_numa(*pmd)) {
 				entry = pmd_mknuma(entry);
 				set_pmd_at(mm, addr, pmd, entry);
@@ -1856,6 +1919,171 @@ static void __split_huge_page(struct page *page,
 	BUG_ON(mapcount != mapcount2);
 }
 
+/*
+ * Take down a pmd mapping a huge page of a file.  Unlike anonymous
+ * memory, the page cache keeps the page, so the next fault simply maps
+ * it again: with a pmd if the page is still huge, with ptes otherwise.
+ * Called with mm->page_table_lock held.
+ */
+static void __split_huge_file_pmd(struct vm_area_struct *vma,
+				  unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page = pmd_page(*pmd);
+	pgtable_t pgtable;
+
+	pmdp_clear_flush(vma, haddr, pmd);
+	/* the deposited page table is empty */
+	pgtable = pgtable_trans_huge_withdraw(mm, pmd);
+	pmd_populate(mm, pmd, pgtable);
+
+	page_remove_rmap(page);
+	VM_BUG_ON(page_mapcount(page) < 0);
+	add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	put_page(page);
+}
+
+static void __split_huge_file_page_refcount(struct page *page,
+					    struct list_head *list)
+{
+	int i, bit;
+	unsigned long head_flags;
+	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
+	int tail_count = 0;
+
+	/* prevent PageLRU to go away from under us, and freeze lru stats */
+	spin_lock_irq(&zone->lru_lock);
+	lruvec = mem_cgroup_page_lruvec(page, zone);
+
+	compound_lock(page);
+	/* complete memcg works before add pages to LRU */
+	mem_cgroup_split_huge_fixup(page);
+
+	for (i = HPAGE_PMD_NR - 1; i >= 1; i--) {
+		struct page *page_tail = page + i;
+
+		/*
+		 * Nothing maps the page anymore, so the tail mapcount
+		 * only counts the gup pins taken on this subpage.
+		 */
+		BUG_ON(page_mapcount(page_tail) < 0);
+		tail_count += page_mapcount(page_tail);
+		BUG_ON(tail_count < 0);
+		BUG_ON(atomic_read(&page_tail->_count) != 0);
+		/*
+		 * One reference for the page cache slot of the subpage,
+		 * one dropped below once the split is complete.  See
+		 * __split_huge_page_refcount() about atomic_add().
+		 */
+		atomic_add(page_mapcount(page_tail) + 2, &page_tail->_count);
+
+		/* after clearing PageTail the gup refcount can be released */
+		smp_mb();
+
+		/*
+		 * Subpages can be locked, dirtied and marked referenced
+		 * through the page cache while still part of the huge page,
+		 * and only the head is locked against that: so the tail's
+		 * flags must be changed with atomic bitops, a plain
+		 * read-modify-write could undo a racing lock_page() or
+		 * set_page_dirty() on the subpage.
+		 */
+		ClearPageTail(page_tail);
+		head_flags = page->flags & ((1L << PG_referenced) |
+					    (1L << PG_swapbacked) |
+					    (1L << PG_mlocked) |
+					    (1L << PG_uptodate) |
+					    (1L << PG_active) |
+					    (1L << PG_unevictable));
+		for_each_set_bit(bit, &head_flags, NR_PAGEFLAGS)
+			set_bit(bit, &page_tail->flags);
+		SetPageDirty(page_tail);
+
+		/* clear PageTail before overwriting first_page */
+		smp_wmb();
+
+		atomic_set(&page_tail->_mapcount, -1);
+
+		/* set up when the page was added to the page cache */
+		BUG_ON(page_tail->mapping != page->mapping);
+		BUG_ON(page_tail->index != page->index + i);
+		page_nid_xchg_last(page_tail, page_nid_last(page));
+
+		lru_add_page_tail(page, page_tail, lruvec, list);
+	}
+	/* the tail pins and the page cache slots of the tails move over */
+	atomic_sub(tail_count + HPAGE_PMD_NR - 1, &page->_count);
+	BUG_ON(atomic_read(&page->_count) <= 0);
+
+	__mod_zone_page_state(zone, NR_SHMEM_THPS, -1);
+
+	ClearPageCompound(page);
+	compound_unlock(page);
+	spin_unlock_irq(&zone->lru_lock);
+
+	for (i = 1; i < HPAGE_PMD_NR; i++) {
+		struct page *page_tail = page + i;
+		BUG_ON(page_count(page_tail) <= 0);
+		put_page(page_tail);
+	}
+}
+
+/*
+ * Split a huge page of the page cache.  The subpages are already in the
+ * page cache at their own index, so all that is left is to take down
+ * the pmds mapping the page and to hand each subpage its own reference
+ * count.  The caller holds the page lock, which keeps the page from
+ * being mapped again by ->pmd_fault() while we are at it.
+ */
+static int split_huge_file_page(struct page *page, struct list_head *list)
+{
+	struct address_space *mapping = page->mapping;
+	pgoff_t pgoff = page->index;
+	struct vm_area_struct *vma;
+
+	VM_BUG_ON(!PageLocked(page));
+	if (!PageCompound(page))
+		return 0;
+	if (!mapping)
+		return 1;
+
+	mutex_lock(&mapping->i_mmap_mutex);
+	vma_interval_tree_foreach(vma, &mapping->i_mmap, pgoff, pgoff) {
+		struct mm_struct *mm = vma->vm_mm;
+		unsigned long address;
+		pmd_t *pmd;
+
+		/* only vmas mapping the whole huge page can map it huge */
+		if (pgoff < vma->vm_pgoff)
+			continue;
+		address = vma->vm_start +
+			((pgoff - vma->vm_pgoff) << PAGE_SHIFT);
+		if (address & ~HPAGE_PMD_MASK ||
+		    address + HPAGE_PMD_SIZE > vma->vm_end)
+			continue;
+
+		mmu_notifier_invalidate_range_start(mm, address,
+						    address + HPAGE_PMD_SIZE);
+		spin_lock(&mm->page_table_lock);
+		pmd = page_check_address_pmd(page, mm, address,
+					PAGE_CHECK_ADDRESS_PMD_FLAG);
+		if (pmd)
+			__split_huge_file_pmd(vma, address, pmd);
+		spin_unlock(&mm->page_table_lock);
+		mmu_notifier_invalidate_range_end(mm, address,
+						  address + HPAGE_PMD_SIZE);
+	}
+	mutex_unlock(&mapping->i_mmap_mutex);
+
+	if (WARN_ON_ONCE(page_mapped(page)))
+		return 1;
+
+	__split_huge_file_page_refcount(page, list);
+	count_vm_event(THP_SPLIT);
+	return 0;
+}
+
 /*
  * Split a hugepage into normal pages. This doesn't change the position of head
  * page. If @list is null, tail pages will be added to LRU list, otherwise, to
@@ -1869,7 +2097,8 @@ int split_huge_page_to_list(struct page *page, struct list_head *list)
 	int ret = 1;
 
 	BUG_ON(is_huge_zero_page(page));
-	BUG_ON(!PageAnon(page));
+	if (!PageAnon(page))
+		return split_huge_file_page(page, list);
 
 	/*
 	 * The caller does not necessarily hold an mmap_sem that would prevent
@@ -1911,7 +2140,10 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_HUGEPAGE | VM_NO_THP))
+		if (*vm_flags & VM_HUGEPAGE)
+			return -EINVAL;
+		/* shared shmem mappings can use huge pages too */
+		if (*vm_flags & VM_NO_THP && !vma_is_shmem(vma))
 			return -EINVAL;
 		if (mm->def_flags & VM_NOHUGEPAGE)
 			return -EINVAL;
@@ -1929,7 +2161,9 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_NOHUGEPAGE | VM_NO_THP))
+		if (*vm_flags & VM_NOHUGEPAGE)
+			return -EINVAL;
+		if (*vm_flags & VM_NO_THP && !vma_is_shmem(vma))
 			return -EINVAL;
 		*vm_flags &= ~VM_HUGEPAGE;
 		*vm_flags |= VM_NOHUGEPAGE;
@@ -2416,6 +2650,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 	if (!pmd)
 		goto out;
 
+	/* Speculative faults must not populate the ptes being collapsed */
+	vm_write_begin(vma);
 	anon_vma_lock_write(vma->anon_vma);
 
 	pte = pte_offset_map(pmd, address);
@@ -2451,6 +2687,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
 		spin_unlock(&mm->page_table_lock);
 		anon_vma_unlock_write(vma->anon_vma);
+		vm_write_end(vma);
 		goto out;
 	}
 
@@ -2482,6 +2719,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	set_pmd_at(mm, address, pmd, _pmd);
 	update_mmu_cache_pmd(vma, address, pmd);
 	spin_unlock(&mm->page_table_lock);
+	vm_write_end(vma);
 
 	*hpage = NULL;
 
@@ -2836,6 +3074,12 @@ again:
 	}
 	page = pmd_page(*pmd);
 	VM_BUG_ON(!page_count(page));
+	if (!PageAnon(page)) {
+		__split_huge_file_pmd(vma, haddr, pmd);
+		spin_unlock(&mm->page_table_lock);
+		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
+		return;
+	}
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
 	mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
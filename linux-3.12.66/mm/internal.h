@@ -110,7 +110,9 @@ extern pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address);
 /*
  * in mm/page_alloc.c
  */
-extern void __free_pages_bootmem(struct page *page, unsigned int order);
+extern void __free_pages_bootmem(struct page *page, unsigned long pfn,
+					unsigned int order);
+extern void reserve_bootmem_region(phys_addr_t start, phys_addr_t end);
 extern void prep_compound_page(struct page *page, unsigned long order);
 #ifdef CONFIG_MEMORY_FAILURE
 extern bool is_free_buddy_page(struct page *page);
@@ -189,12 +191,11 @@ static inline void munlock_vma_pages_all(struct vm_area_struct *vma)
  * Called only in fault path, to determine if a new page is being
  * mapped into a LOCKED vma.  If it is, mark page as mlocked.
  */
-static inline int mlocked_vma_newpage(struct vm_area_struct *vma,
-				    struct page *page)
+static inline int mlocked_vma_newpage(vm_flags_t vm_flags, struct page *page)
 {
 	VM_BUG_ON(PageLRU(page));
 
-	if (likely((vma->vm_flags & (VM_LOCKED | VM_SPECIAL)) != VM_LOCKED))
+	if (likely((vm_flags & (VM_LOCKED | VM_SPECIAL)) != VM_LOCKED))
 		return 0;
 
 	if (!TestSetPageMlocked(page)) {
@@ -247,7 +248,7 @@ extern unsigned long vma_address(struct page *page,
 				 struct vm_area_struct *vma);
 #endif
 #else /* !CONFIG_MMU */
-static inline int mlocked_vma_newpage(struct vm_area_struct *v, struct page *p)
+static inline int mlocked_vma_newpage(vm_flags_t f, struct page *p)
 {
 	return 0;
 }
@@ -389,4 +390,20 @@ unsigned long reclaim_clean_pages_from_list(struct zone *zone,
 #define ALLOC_CMA		0x80 /* allow allocations from CMA areas */
 #define ALLOC_FAIR		0x100 /* fair zone allocation */
 
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+void try_to_unmap_flush(void);
+void try_to_unmap_flush_dirty(void);
+void flush_tlb_batched_pending(struct mm_struct *mm);
+#else
+static inline void try_to_unmap_flush(void)
+{
+}
+static inline void try_to_unmap_flush_dirty(void)
+{
+}
+static inline void flush_tlb_batched_pending(struct mm_struct *mm)
+{
+}
+#endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
+
 #endif	/* __MM_INTERNAL_H */
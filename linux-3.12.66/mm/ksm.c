@@ -107,19 +107,38 @@ struct mm_slot {
 };
 
 /**
- * struct ksm_scan - cursor for scanning
- * @mm_slot: the current mm_slot we are scanning
- * @address: the next address inside that to be scanned
- * @rmap_list: link to the next rmap to be scanned in the rmap_list
+ * struct ksm_scan - state of the current full scan
+ * @mm_slot: the next mm_slot to be handed to a ksmd worker
+ * @nr_scanning: number of workers holding an mm_slot of this scan
  * @seqnr: count of completed full scans (needed when removing unstable node)
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * There is only the one ksm_scan instance of this structure, shared by
+ * the ksmd workers under ksm_mmlist_lock.  A full scan is complete when
+ * every mm_slot has been handed out and no worker holds one any more.
  */
 struct ksm_scan {
+	struct mm_slot *mm_slot;
+	int nr_scanning;
+	unsigned long seqnr;
+};
+
+/**
+ * struct ksm_worker - a ksmd thread and its cursor for scanning
+ * @thread: the ksmd thread, NULL if not running
+ * @mm_slot: the mm_slot this worker is scanning, NULL if none
+ * @address: the next address inside that to be scanned
+ * @rmap_list: link to the next rmap to be scanned in the rmap_list
+ * @stale_rmap_items: rmap_items unlinked from @mm_slot, still to be removed
+ *	from the trees once mmap_sem has been dropped
+ *
+ * An mm_slot and its rmap_list belong to the worker scanning it.
+ */
+struct ksm_worker {
+	struct task_struct *thread;
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
-	unsigned long seqnr;
+	struct rmap_item *stale_rmap_items;
 };
 
 /**
@@ -215,7 +234,7 @@ static unsigned long ksm_pages_sharing;
 static unsigned long ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items = ATOMIC_LONG_INIT(0);
 
 /* Number of pages ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
@@ -223,6 +242,12 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* The ksmd workers, each scanning pages_to_scan pages per batch */
+#define KSM_MAX_WORKERS	64
+static struct ksm_worker ksm_workers[KSM_MAX_WORKERS];
+static unsigned int ksm_nr_workers;
+static DEFINE_MUTEX(ksm_workers_mutex);
+
 #ifdef CONFIG_NUMA
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
@@ -240,9 +265,24 @@ static unsigned long ksm_run = KSM_RUN_STOP;
 static void wait_while_offlining(void);
 
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
+/*
+ * ksm_thread_sem is held for read by the ksmd workers while they scan, and
+ * for write by those who must keep them out: the run and merge_across_nodes
+ * controls, and memory offlining.
+ */
+static DECLARE_RWSEM(ksm_thread_sem);
+
+/*
+ * ksm_tree_mutex serializes the ksmd workers' use of the stable and
+ * unstable trees, of migrate_nodes, of the tree linkage of rmap_items and
+ * of the pages_shared, pages_sharing and pages_unshared counts.  It must
+ * not be taken while holding an mmap_sem: cmp_and_merge_page() takes other
+ * mms' mmap_sems under it.
+ */
+static DEFINE_MUTEX(ksm_tree_mutex);
+
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
 		sizeof(struct __struct), __alignof__(struct __struct),\
 		(__flags), NULL)
@@ -286,13 +326,13 @@ static inline struct rmap_item *alloc_rmap_item(void)
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL |
 						__GFP_NORETRY | __GFP_NOWARN);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -770,9 +810,16 @@ static int unmerge_and_remove_all_rmap_items(void)
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
-	int err = 0;
+	int i, err = 0;
 
+	/*
+	 * The workers are kept out by ksm_thread_sem, and start afresh
+	 * after this: forget any mm_slots they were part way through.
+	 */
 	spin_lock(&ksm_mmlist_lock);
+	for (i = 0; i < KSM_MAX_WORKERS; i++)
+		ksm_workers[i].mm_slot = NULL;
+	ksm_scan.nr_scanning = 0;
 	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
@@ -1054,9 +1101,21 @@ static int try_to_merge_one_page(struct vm_area_struct *vma,
 			 */
 			set_page_stable_node(page, NULL);
 			mark_page_accessed(page);
+			/*
+			 * Reclaim frees a clean anonymous page with clean
+			 * ptes without writing it to swap (see MADV_FREE):
+			 * make sure that the ksm page will be swapped, since
+			 * others who want its contents are about to map it.
+			 */
+			if (!PageDirty(page))
+				SetPageDirty(page);
 			err = 0;
-		} else if (pages_identical(page, kpage))
+		} else if (pages_identical(page, kpage)) {
+			/* As above, in case kpage was cleaned since */
+			if (!PageDirty(kpage))
+				SetPageDirty(kpage);
 			err = replace_page(vma, page, kpage, orig_pte);
+		}
 	}
 
 	if ((vma->vm_flags & VM_LOCKED) && kpage && !err) {
@@ -1405,21 +1464,17 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 }
 
 /*
- * cmp_and_merge_page - first see if page can be merged into the stable tree;
- * if not, compare checksum to previous and if it's the same, see if page can
- * be inserted into the unstable tree, or merged with a page already there and
- * both transferred to the stable tree.
+ * stable_tree_merge_page - see if page can be merged into the stable tree,
+ * first removing rmap_item from whichever tree it was in before.
  *
- * @page: the page that we are searching identical page to.
- * @rmap_item: the reverse mapping into the virtual address of this page
+ * Returns true if that has dealt with the page, false if it is still to be
+ * tried against the unstable tree.  Called with ksm_tree_mutex held.
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static bool stable_tree_merge_page(struct page *page,
+				   struct rmap_item *rmap_item)
 {
-	struct rmap_item *tree_rmap_item;
-	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
 	int err;
 
 	stable_node = page_stable_node(page);
@@ -1433,14 +1488,14 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		}
 		if (stable_node->head != &migrate_nodes &&
 		    rmap_item->head == stable_node)
-			return;
+			return true;
 	}
 
 	/* We first start with searching the page inside the stable tree */
 	kpage = stable_tree_search(page);
 	if (kpage == page && rmap_item->head == stable_node) {
 		put_page(kpage);
-		return;
+		return true;
 	}
 
 	remove_rmap_item_from_tree(rmap_item);
@@ -1457,20 +1512,30 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			unlock_page(kpage);
 		}
 		put_page(kpage);
-		return;
+		return true;
 	}
+	return false;
+}
+
+/*
+ * unstable_tree_merge_page - see if page can be inserted into the unstable
+ * tree, or merged with a page already there and both transferred to the
+ * stable tree.  Called with ksm_tree_mutex held.
+ */
+static void unstable_tree_merge_page(struct page *page,
+				     struct rmap_item *rmap_item)
+{
+	struct rmap_item *tree_rmap_item;
+	struct page *tree_page = NULL;
+	struct stable_node *stable_node;
+	struct page *kpage;
 
 	/*
-	 * If the hash value of the page has changed from the last time
-	 * we calculated it, this page is changing frequently: therefore we
-	 * don't want to insert it in the unstable tree, and we don't want
-	 * to waste our time searching for something identical to it there.
+	 * Another worker may have merged the page through a forked mm while
+	 * we did not hold the lock: leave it to be found in the stable tree.
 	 */
-	checksum = calc_checksum(page);
-	if (rmap_item->oldchecksum != checksum) {
-		rmap_item->oldchecksum = checksum;
+	if (PageKsm(page))
 		return;
-	}
 
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
@@ -1505,7 +1570,48 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	}
 }
 
-static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
+/*
+ * cmp_and_merge_page - first see if page can be merged into the stable tree;
+ * if not, compare checksum to previous and if it's the same, see if page can
+ * be inserted into the unstable tree, or merged with a page already there and
+ * both transferred to the stable tree.
+ *
+ * ksm_tree_mutex is held only while the trees are searched and changed:
+ * the rmap_item belongs to this worker, so checksumming the page between
+ * those can be left to run alongside the other workers.
+ *
+ * @page: the page that we are searching identical page to.
+ * @rmap_item: the reverse mapping into the virtual address of this page
+ */
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+{
+	unsigned int checksum;
+	bool done;
+
+	mutex_lock(&ksm_tree_mutex);
+	done = stable_tree_merge_page(page, rmap_item);
+	mutex_unlock(&ksm_tree_mutex);
+	if (done)
+		return;
+
+	/*
+	 * If the hash value of the page has changed from the last time
+	 * we calculated it, this page is changing frequently: therefore we
+	 * don't want to insert it in the unstable tree, and we don't want
+	 * to waste our time searching for something identical to it there.
+	 */
+	checksum = calc_checksum(page);
+	if (rmap_item->oldchecksum != checksum) {
+		rmap_item->oldchecksum = checksum;
+		return;
+	}
+
+	mutex_lock(&ksm_tree_mutex);
+	unstable_tree_merge_page(page, rmap_item);
+	mutex_unlock(&ksm_tree_mutex);
+}
+
+static struct rmap_item *get_next_rmap_item(struct ksm_worker *worker,
 					    struct rmap_item **rmap_list,
 					    unsigned long addr)
 {
@@ -1518,14 +1624,14 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 		if (rmap_item->address > addr)
 			break;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		rmap_item->rmap_list = worker->stale_rmap_items;
+		worker->stale_rmap_items = rmap_item;
 	}
 
 	rmap_item = alloc_rmap_item();
 	if (rmap_item) {
 		/* It has already been zeroed */
-		rmap_item->mm = mm_slot->mm;
+		rmap_item->mm = worker->mm_slot->mm;
 		rmap_item->address = addr;
 		rmap_item->rmap_list = *rmap_list;
 		*rmap_list = rmap_item;
@@ -1533,19 +1639,72 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Unlink all the rmap_items from rmap_list onwards: they are removed from
+ * the trees by free_stale_rmap_items(), once mmap_sem has been dropped.
+ */
+static void unlink_trailing_rmap_items(struct ksm_worker *worker,
+				       struct rmap_item **rmap_list)
+{
+	while (*rmap_list) {
+		struct rmap_item *rmap_item = *rmap_list;
+		*rmap_list = rmap_item->rmap_list;
+		rmap_item->rmap_list = worker->stale_rmap_items;
+		worker->stale_rmap_items = rmap_item;
+	}
+}
+
+static void free_stale_rmap_items(struct ksm_worker *worker)
 {
-	struct mm_struct *mm;
-	struct mm_slot *slot;
-	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
+
+	if (!worker->stale_rmap_items)
+		return;
+
+	mutex_lock(&ksm_tree_mutex);
+	while (worker->stale_rmap_items) {
+		rmap_item = worker->stale_rmap_items;
+		worker->stale_rmap_items = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+	mutex_unlock(&ksm_tree_mutex);
+}
+
+/*
+ * Is a ksmd worker part way through this mm_slot?
+ * Called with ksm_mmlist_lock held.
+ */
+static bool ksm_mm_slot_busy(struct mm_slot *mm_slot)
+{
+	int i;
+
+	for (i = 0; i < KSM_MAX_WORKERS; i++)
+		if (ksm_workers[i].mm_slot == mm_slot)
+			return true;
+	return false;
+}
+
+/*
+ * Hand the worker the next mm_slot of the full scan, first starting a new
+ * full scan if the last one is complete.  Returns NULL if there is none:
+ * perhaps the other workers are still finishing the mm_slots they hold.
+ */
+static struct mm_slot *ksm_get_mm_slot(struct ksm_worker *worker)
+{
+	struct mm_slot *slot;
 	int nid;
 
-	if (list_empty(&ksm_mm_head.mm_list))
-		return NULL;
+	spin_lock(&ksm_mmlist_lock);
+	if (ksm_scan.mm_slot == &ksm_mm_head) {
+		if (ksm_scan.nr_scanning) {
+			spin_unlock(&ksm_mmlist_lock);
+			return NULL;
+		}
+		/* Keep the other workers waiting until the scan is set up */
+		ksm_scan.nr_scanning++;
+		spin_unlock(&ksm_mmlist_lock);
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
 		/*
 		 * A number of pages can hang around indefinitely on per-cpu
 		 * pagevecs, raised page count preventing write_protect_page
@@ -1558,6 +1717,7 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 */
 		lru_add_drain_all();
 
+		mutex_lock(&ksm_tree_mutex);
 		/*
 		 * Whereas stale stable_nodes on the stable_tree itself
 		 * get pruned in the regular course of stable_tree_search(),
@@ -1581,20 +1741,69 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 
 		for (nid = 0; nid < ksm_nr_node_ids; nid++)
 			root_unstable_tree[nid] = RB_ROOT;
+		mutex_unlock(&ksm_tree_mutex);
 
 		spin_lock(&ksm_mmlist_lock);
-		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
-		spin_unlock(&ksm_mmlist_lock);
-		/*
-		 * Although we tested list_empty() above, a racing __ksm_exit
-		 * of the last mm on the list may have removed it since then.
-		 */
-		if (slot == &ksm_mm_head)
-			return NULL;
+		ksm_scan.nr_scanning--;
+		ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+						struct mm_slot, mm_list);
+	}
+
+	/*
+	 * Although the caller tested list_empty(), a racing __ksm_exit
+	 * of the last mm on the list may have removed it since then.
+	 */
+	slot = ksm_scan.mm_slot;
+	if (slot != &ksm_mm_head) {
+		ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+						struct mm_slot, mm_list);
+		ksm_scan.nr_scanning++;
+		worker->mm_slot = slot;
+		worker->address = 0;
+		worker->rmap_list = &slot->rmap_list;
+	} else
+		slot = NULL;
+	spin_unlock(&ksm_mmlist_lock);
+
+	return slot;
+}
+
+/*
+ * The worker has finished with its mm_slot: the full scan is complete
+ * if that was the last one outstanding, and then we return true.
+ */
+static bool ksm_put_mm_slot(struct ksm_worker *worker)
+{
+	bool scan_done = false;
+
+	spin_lock(&ksm_mmlist_lock);
+	worker->mm_slot = NULL;
+	if (!--ksm_scan.nr_scanning && ksm_scan.mm_slot == &ksm_mm_head) {
+		ksm_scan.seqnr++;
+		scan_done = true;
+	}
+	spin_unlock(&ksm_mmlist_lock);
+	return scan_done;
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_worker *worker,
+						 struct page **page)
+{
+	struct mm_struct *mm;
+	struct mm_slot *slot;
+	struct vm_area_struct *vma;
+	struct rmap_item *rmap_item;
+	bool remove_slot;
+
+	if (list_empty(&ksm_mm_head.mm_list))
+		return NULL;
+
+	slot = worker->mm_slot;
+	if (!slot) {
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		slot = ksm_get_mm_slot(worker);
+		if (!slot)
+			return NULL;
 	}
 
 	mm = slot->mm;
@@ -1602,60 +1811,59 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, worker->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (worker->address < vma->vm_start)
+			worker->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			worker->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (worker->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, worker->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				worker->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
 			if (PageAnon(*page) ||
 			    page_trans_compound_anon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, worker->address);
 				flush_dcache_page(*page);
-				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+				rmap_item = get_next_rmap_item(worker,
+					worker->rmap_list, worker->address);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					worker->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					worker->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
+				free_stale_rmap_items(worker);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			worker->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		worker->address = 0;
+		worker->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	unlink_trailing_rmap_items(worker, worker->rmap_list);
 
-	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
-						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	remove_slot = (worker->address == 0);
+	if (remove_slot) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -1665,40 +1873,47 @@ next_mm:
 		 * or when all VM_MERGEABLE areas have been unmapped (and
 		 * mmap_sem then protects against race with MADV_MERGEABLE).
 		 */
+		spin_lock(&ksm_mmlist_lock);
 		hash_del(&slot->link);
 		list_del(&slot->mm_list);
 		spin_unlock(&ksm_mmlist_lock);
 
 		free_mm_slot(slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
-		up_read(&mm->mmap_sem);
-		mmdrop(mm);
-	} else {
-		spin_unlock(&ksm_mmlist_lock);
-		up_read(&mm->mmap_sem);
 	}
+	up_read(&mm->mmap_sem);
 
-	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
-		goto next_mm;
-
-	ksm_scan.seqnr++;
-	return NULL;
+	/*
+	 * The unstable tree may still point to the stale rmap_items, and
+	 * through them to this mm: remove them before it can be freed, and
+	 * before the full scan can complete.
+	 */
+	free_stale_rmap_items(worker);
+	if (remove_slot)
+		mmdrop(mm);
+	/*
+	 * Move on to the next mm_slot, unless that completed the full scan:
+	 * then let the worker sleep before starting another, rather than
+	 * spinning round an address space with nothing left to merge.
+	 */
+	if (ksm_put_mm_slot(worker))
+		return NULL;
+	goto next_mm;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @worker - the ksmd worker doing the scan
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_worker *worker, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
 
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(worker, &page);
 		if (!rmap_item)
 			return;
 		cmp_and_merge_page(page, rmap_item);
@@ -1711,17 +1926,22 @@ static int ksmd_should_run(void)
 	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_worker *worker = data;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		wait_while_offlining();
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		/*
+		 * While memory is going offline, just sleep and try again
+		 * later: the tree must not be touched meanwhile.
+		 */
+		down_read(&ksm_thread_sem);
+		if (ksmd_should_run() && !(ksm_run & KSM_RUN_OFFLINE))
+			ksm_do_scan(worker, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
@@ -1736,6 +1956,47 @@ static int ksm_scan_thread(void *nothing)
 	return 0;
 }
 
+/*
+ * Start or stop ksmd workers until nr are running.  A stopped worker's
+ * mm_slot is handed back to be the next one scanned, from its start.
+ * Called with ksm_workers_mutex held.
+ */
+static int ksm_set_nr_workers(unsigned int nr)
+{
+	struct ksm_worker *worker;
+	struct task_struct *thread;
+
+	while (ksm_nr_workers < nr) {
+		worker = &ksm_workers[ksm_nr_workers];
+		if (ksm_nr_workers)
+			thread = kthread_run(ksm_scan_thread, worker,
+					     "ksmd/%u", ksm_nr_workers);
+		else
+			thread = kthread_run(ksm_scan_thread, worker, "ksmd");
+		if (IS_ERR(thread))
+			return PTR_ERR(thread);
+		worker->thread = thread;
+		ksm_nr_workers++;
+	}
+
+	while (ksm_nr_workers > nr) {
+		worker = &ksm_workers[--ksm_nr_workers];
+		kthread_stop(worker->thread);
+		worker->thread = NULL;
+
+		spin_lock(&ksm_mmlist_lock);
+		if (worker->mm_slot) {
+			list_move_tail(&worker->mm_slot->mm_list,
+				       &ksm_scan.mm_slot->mm_list);
+			ksm_scan.mm_slot = worker->mm_slot;
+			ksm_scan.nr_scanning--;
+			worker->mm_slot = NULL;
+		}
+		spin_unlock(&ksm_mmlist_lock);
+	}
+	return 0;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1830,15 +2091,17 @@ void __ksm_exit(struct mm_struct *mm)
 	/*
 	 * This process is exiting: if it's straightforward (as is the
 	 * case when ksmd was never running), free mm_slot immediately.
-	 * But if it's at the cursor or has rmap_items linked to it, use
-	 * mmap_sem to synchronize with any break_cows before pagetables
-	 * are freed, and leave the mm_slot on the list for ksmd to free.
+	 * But if it's at the cursor, held by a ksmd worker, or has
+	 * rmap_items linked to it, use mmap_sem to synchronize with any
+	 * break_cows before pagetables are freed, and leave the mm_slot
+	 * on the list for ksmd to free.
 	 * Beware: ksm may already have noticed it exiting and freed the slot.
 	 */
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && ksm_scan.mm_slot != mm_slot &&
+	    !ksm_mm_slot_busy(mm_slot)) {
 		if (!mm_slot->rmap_list) {
 			hash_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
@@ -2081,10 +2344,10 @@ static int just_wait(void *word)
 static void wait_while_offlining(void)
 {
 	while (ksm_run & KSM_RUN_OFFLINE) {
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
 				just_wait, TASK_UNINTERRUPTIBLE);
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 	}
 }
 
@@ -2134,11 +2397,11 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 * and remove_all_stable_nodes() while memory is going offline:
 		 * it is unsafe for them to touch the stable tree at this time.
 		 * But unmerge_ksm_pages(), rmap lookups and other entry points
-		 * which do not need the ksm_thread_mutex are all safe.
+		 * which do not need the ksm_thread_sem are all safe.
 		 */
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run |= KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 
 	case MEM_OFFLINE:
@@ -2154,9 +2417,9 @@ static int ksm_memory_callback(struct notifier_block *self,
 		/* fallthrough */
 
 	case MEM_CANCEL_OFFLINE:
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run &= ~KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 
 		smp_mb();	/* wake_up_bit advises this */
 		wake_up_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE));
@@ -2227,6 +2490,31 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t workers_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_workers);
+}
+
+static ssize_t workers_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	int err;
+	unsigned long nr_workers;
+
+	err = kstrtoul(buf, 10, &nr_workers);
+	if (err || nr_workers < 1 || nr_workers > KSM_MAX_WORKERS)
+		return -EINVAL;
+
+	mutex_lock(&ksm_workers_mutex);
+	err = ksm_set_nr_workers(nr_workers);
+	mutex_unlock(&ksm_workers_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(workers);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -2252,7 +2540,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_run != flags) {
 		ksm_run = flags;
@@ -2266,7 +2554,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -2295,7 +2583,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 	if (knob > 1)
 		return -EINVAL;
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_merge_across_nodes != knob) {
 		if (ksm_pages_shared || remove_all_stable_nodes())
@@ -2326,7 +2614,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 			ksm_nr_node_ids = knob ? 1 : nr_node_ids;
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	return err ? err : count;
 }
@@ -2359,7 +2647,7 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items) - ksm_pages_shared
 				- ksm_pages_sharing - ksm_pages_unshared;
 	/*
 	 * It was not worth any locking to calculate that statistic,
@@ -2381,6 +2669,7 @@ KSM_ATTR_RO(full_scans);
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&workers_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
@@ -2401,25 +2690,31 @@ static struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
 	int err;
 
 	err = ksm_slab_init();
 	if (err)
 		goto out;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
+	/* One worker per online node by default: tunable through sysfs */
+	mutex_lock(&ksm_workers_mutex);
+	err = ksm_set_nr_workers(clamp_t(unsigned int, num_online_nodes(),
+					 1, KSM_MAX_WORKERS));
+	if (err) {
 		printk(KERN_ERR "ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
+		ksm_set_nr_workers(0);
+		mutex_unlock(&ksm_workers_mutex);
 		goto out_free;
 	}
+	mutex_unlock(&ksm_workers_mutex);
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		printk(KERN_ERR "ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
+		mutex_lock(&ksm_workers_mutex);
+		ksm_set_nr_workers(0);
+		mutex_unlock(&ksm_workers_mutex);
 		goto out_free;
 	}
 #else
@@ -899,7 +899,7 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 		__this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_CACHE],
 				nr_pages);
 
-	if (PageTransHuge(page))
+	if (anon && PageTransHuge(page))
 		__this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_RSS_HUGE],
 				nr_pages);
 
@@ -3812,8 +3812,9 @@ void mem_cgroup_split_huge_fixup(struct page *head)
 		smp_wmb();/* see __commit_charge() */
 		pc->flags = head_pc->flags & ~PCGF_NOCOPY_AT_SPLIT;
 	}
-	__this_cpu_sub(memcg->stat->count[MEM_CGROUP_STAT_RSS_HUGE],
-		       HPAGE_PMD_NR);
+	if (PageAnon(head))
+		__this_cpu_sub(memcg->stat->count[MEM_CGROUP_STAT_RSS_HUGE],
+			       HPAGE_PMD_NR);
 }
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
@@ -4124,7 +4125,8 @@ int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
 
 	if (mem_cgroup_disabled())
 		return 0;
-	if (PageCompound(page))
+	/* huge pages of shmem are charged, hugetlbfs pages are not */
+	if (PageHuge(page))
 		return 0;
 
 	if (!PageSwapCache(page))
@@ -6670,7 +6672,8 @@ static enum mc_target_type get_mctgt_type_thp(struct vm_area_struct *vma,
 
 	page = pmd_page(pmd);
 	VM_BUG_ON(!page || !PageHead(page));
-	if (!move_anon())
+	/* huge pages of shmem stay with the cgroup that charged them */
+	if (!PageAnon(page) || !move_anon())
 		return ret;
 	pc = lookup_page_cgroup(page);
 	if (PageCgroupUsed(pc) && pc->mem_cgroup == mc.from) {
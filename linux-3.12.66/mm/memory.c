@@ -1083,6 +1083,7 @@ again:
 	init_rss_vec(rss);
 	start_pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
 	pte = start_pte;
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 	do {
 		pte_t ptent = *pte;
@@ -3375,20 +3376,111 @@ static inline int check_stack_guard_page(struct vm_area_struct *vma, unsigned lo
 	return 0;
 }
 
+/*
+ * The vma by whose mempolicy a fault allocates a new page.  A speculative
+ * fault only starts on a vma without a mempolicy, but mbind() may install
+ * one, and free it again, under alloc_page_vma(): so it allocates by the
+ * task's policy alone, without looking at the vma.  If the vma did change,
+ * pte_map_lock() finds that out and the page is freed again.
+ */
+static inline struct vm_area_struct *
+fault_alloc_vma(struct vm_area_struct *vma, unsigned int flags)
+{
+	return (flags & FAULT_FLAG_SPECULATIVE) ? NULL : vma;
+}
+
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static inline bool vma_has_changed(struct vm_area_struct *vma,
+				   unsigned int seq)
+{
+	return read_seqcount_retry(&vma->vm_sequence, seq);
+}
+
+/*
+ * Map and lock the pte for a fault.  A speculative fault holds no
+ * mmap_sem, so the page tables may be freed under it: they are walked
+ * with interrupts disabled, which holds off the TLB shootdown that comes
+ * before freeing them, and the vma must not have changed once the pte
+ * lock is held.  Returns false if the fault has to be retried the usual
+ * way.
+ */
+static bool pte_map_lock(struct mm_struct *mm, struct vm_area_struct *vma,
+			 unsigned long address, pmd_t *pmd, unsigned int flags,
+			 unsigned int seq, pte_t **ptep, spinlock_t **ptlp)
+{
+	bool ret = false;
+	spinlock_t *ptl;
+	pmd_t pmdval;
+	pte_t *pte;
+
+	if (!(flags & FAULT_FLAG_SPECULATIVE)) {
+		*ptep = pte_offset_map_lock(mm, pmd, address, ptlp);
+		return true;
+	}
+
+	local_irq_disable();
+	if (vma_has_changed(vma, seq) || atomic_read(&mm->mm_moving))
+		goto out;
+
+	pmdval = ACCESS_ONCE(*pmd);
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) || pmd_bad(pmdval))
+		goto out;
+
+	/*
+	 * The pte lock holder may be waiting for us to take a TLB flush
+	 * IPI, so we must not spin here with interrupts disabled.
+	 */
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto out;
+	}
+
+	if (vma_has_changed(vma, seq) || atomic_read(&mm->mm_moving) ||
+	    !pmd_same(pmdval, *pmd)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out;
+	}
+
+	*ptep = pte;
+	*ptlp = ptl;
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+#else
+static inline bool pte_map_lock(struct mm_struct *mm,
+			struct vm_area_struct *vma, unsigned long address,
+			pmd_t *pmd, unsigned int flags, unsigned int seq,
+			pte_t **ptep, spinlock_t **ptlp)
+{
+	*ptep = pte_offset_map_lock(mm, pmd, address, ptlp);
+	return true;
+}
+#endif
+
 /*
  * We enter with non-exclusive mmap_sem (to exclude vma changes,
  * but allow concurrent faults), and pte mapped but not yet locked.
  * We return with mmap_sem still held, but pte unmapped and unlocked.
+ *
+ * A speculative fault enters with neither mmap_sem nor page_table, and
+ * gets VM_FAULT_RETRY back if the vma changed under it.
  */
 static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		unsigned long address, pte_t *page_table, pmd_t *pmd,
-		unsigned int flags)
+		unsigned int flags, unsigned int seq)
 {
 	struct page *page;
 	spinlock_t *ptl;
 	pte_t entry;
+	pgoff_t index;
+	vm_flags_t vm_flags;
 
-	pte_unmap(page_table);
+	if (!(flags & FAULT_FLAG_SPECULATIVE))
+		pte_unmap(page_table);
 
 	/* File mapping without ->vm_ops ? */
 	if (vma->vm_flags & VM_SHARED)
@@ -3402,7 +3494,9 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (!(flags & FAULT_FLAG_WRITE)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
 						vma->vm_page_prot));
-		page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+		if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+				  &page_table, &ptl))
+			return VM_FAULT_RETRY;
 		if (!pte_none(*page_table))
 			goto unlock;
 		goto setpte;
@@ -3411,7 +3505,8 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* Allocate our own private page. */
 	if (unlikely(anon_vma_prepare(vma)))
 		goto oom;
-	page = alloc_zeroed_user_highpage_movable(vma, address);
+	page = alloc_zeroed_user_highpage_movable(fault_alloc_vma(vma, flags),
+						  address);
 	if (!page)
 		goto oom;
 	/*
@@ -3424,16 +3519,27 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL))
 		goto oom_free_page;
 
+	/*
+	 * vma_adjust() does not take the pte lock: a speculative fault must
+	 * read what it needs of the vma before pte_map_lock() checks it.
+	 */
+	vm_flags = vma->vm_flags;
+	index = linear_page_index(vma, address);
 	entry = mk_pte(page, vma->vm_page_prot);
-	if (vma->vm_flags & VM_WRITE)
+	if (vm_flags & VM_WRITE)
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
-	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+	if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+			  &page_table, &ptl)) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+		return VM_FAULT_RETRY;
+	}
 	if (!pte_none(*page_table))
 		goto release;
 
 	inc_mm_counter_fast(mm, MM_ANONPAGES);
-	page_add_new_anon_rmap(page, vma, address);
+	__page_add_new_anon_rmap(page, vma, index, vm_flags);
 setpte:
 	set_pte_at(mm, address, page_table, entry);
 
@@ -3468,14 +3574,16 @@ oom:
 int pram_flags = PRAM_INIT;
 unsigned long pram_address = 0;
 static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
-		unsigned long address, pmd_t *pmd,
-		pgoff_t pgoff, unsigned int flags, pte_t orig_pte)
+		unsigned long address, pmd_t *pmd, pgoff_t pgoff,
+		unsigned int flags, pte_t orig_pte, unsigned int seq)
 {
 	pte_t *page_table;
 	spinlock_t *ptl;
 	struct page *page;
 	struct page *cow_page;
 	pte_t entry;
+	pgoff_t index;
+	vm_flags_t vm_flags;
 	int anon = 0;
 	struct page *dirty_page = NULL;
 	struct vm_fault vmf;
@@ -3516,7 +3624,8 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		if (unlikely(anon_vma_prepare(vma)))
 			return VM_FAULT_OOM;
 
-		cow_page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma, address);
+		cow_page = alloc_page_vma(GFP_HIGHUSER_MOVABLE,
+					  fault_alloc_vma(vma, flags), address);
 		if (!cow_page)
 			return VM_FAULT_OOM;
 
@@ -3611,8 +3720,6 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	}
 
-	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
-
 	/*
 	 * This silly early PAGE_DIRTY setting removes a race
 	 * due to the bad i386 page protection. But it's valid
@@ -3622,18 +3729,36 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	 * an exclusive copy of the page, or this is a shared mapping,
 	 * so we can make it writable and dirty to avoid having to
 	 * handle that later.
+	 *
+	 * As in do_anonymous_page(), the vma is only read before
+	 * pte_map_lock(), which checks that it has not changed.
 	 */
+	vm_flags = vma->vm_flags;
+	index = linear_page_index(vma, address);
+	entry = mk_pte(page, vma->vm_page_prot);
+	if (flags & FAULT_FLAG_WRITE)
+		entry = maybe_mkwrite(pte_mkdirty(entry), vma);
+	else if (pte_file(orig_pte) && pte_file_soft_dirty(orig_pte))
+		pte_mksoft_dirty(entry);
+
+	if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+			  &page_table, &ptl)) {
+		/* Only speculative faults, which never reach page_mkwrite */
+		if (cow_page) {
+			mem_cgroup_uncharge_page(cow_page);
+			page_cache_release(cow_page);
+		}
+		unlock_page(vmf.page);
+		page_cache_release(vmf.page);
+		return VM_FAULT_RETRY;
+	}
+
 	/* Only go through if we didn't race with anybody else... */
 	if (likely(pte_same(*page_table, orig_pte))) {
 		flush_icache_page(vma, page);
-		entry = mk_pte(page, vma->vm_page_prot);
-		if (flags & FAULT_FLAG_WRITE)
-			entry = maybe_mkwrite(pte_mkdirty(entry), vma);
-		else if (pte_file(orig_pte) && pte_file_soft_dirty(orig_pte))
-			pte_mksoft_dirty(entry);
 		if (anon) {
 			inc_mm_counter_fast(mm, MM_ANONPAGES);
-			page_add_new_anon_rmap(page, vma, address);
+			__page_add_new_anon_rmap(page, vma, index, vm_flags);
 		} else {
 			inc_mm_counter_fast(mm, MM_FILEPAGES);
 			page_add_file_rmap(page);
@@ -3707,16 +3832,17 @@ uncharge_out:
 
 static int do_linear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		unsigned long address, pte_t *page_table, pmd_t *pmd,
-		unsigned int flags, pte_t orig_pte)
+		unsigned int flags, pte_t orig_pte, unsigned int seq)
 {
 	pgoff_t pgoff = (((address & PAGE_MASK)
 			- vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
 
-	pte_unmap(page_table);
+	if (!(flags & FAULT_FLAG_SPECULATIVE))
+		pte_unmap(page_table);
 	/* The VMA was not fully populated on mmap() or missing VM_DONTEXPAND */
 	if (!vma->vm_ops->fault)
 		return VM_FAULT_SIGBUS;
-	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
+	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte, seq);
 }
 
 /*
@@ -3748,7 +3874,7 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	}
 
 	pgoff = pte_to_pgoff(orig_pte);
-	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
+	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte, 0);
 }
 
 int numa_migrate_prep(struct page *page, struct vm_area_struct *vma,
@@ -3929,9 +4055,9 @@ static int handle_pte_fault(struct mm_struct *mm,
 		if (pte_none(entry)) {
 			if (vma->vm_ops)
 				return do_linear_fault(mm, vma, address,
-						pte, pmd, flags, entry);
+						pte, pmd, flags, entry, 0);
 			return do_anonymous_page(mm, vma, address,
-						 pte, pmd, flags);
+						 pte, pmd, flags, 0);
 		}
 		if (pte_file(entry))
 			return do_nonlinear_fault(mm, vma, address,
@@ -3992,7 +4118,12 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+	if (pmd_none(*pmd) && vma->vm_ops && vma->vm_ops->pmd_fault &&
+	    !(vma->vm_flags & VM_NOHUGEPAGE)) {
+		int ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
 		int ret = VM_FAULT_FALLBACK;
 		if (!vma->vm_ops)
 			ret = do_huge_pmd_anonymous_page(mm, vma, address,
@@ -4094,6 +4225,179 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return ret;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Handle the common cases of a user fault without mmap_sem: a missing pte
+ * in an anonymous or page cache backed vma, or a pte that only needs its
+ * young or dirty bit set.  Everything else, COW and swap-in included, and
+ * any race with a change to the vma, returns VM_FAULT_RETRY and has to be
+ * handled by handle_mm_fault() under mmap_sem.
+ */
+static int __handle_speculative_fault(struct mm_struct *mm,
+				      unsigned long address,
+				      unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	unsigned int seq;
+	pgd_t *pgd, pgdval;
+	pud_t *pud, pudval;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+	spinlock_t *ptl;
+	int ret = VM_FAULT_RETRY;
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		return ret;
+
+	seq = raw_seqcount_begin(&vma->vm_sequence);
+
+	if (address < vma->vm_start || vma->vm_end <= address)
+		goto out_put;
+
+	if (vma->vm_flags & (VM_HUGETLB | VM_NONLINEAR | VM_PFNMAP |
+			     VM_MIXEDMAP | VM_GROWSDOWN | VM_GROWSUP))
+		goto out_put;
+
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma->vm_flags & VM_WRITE))
+			goto out_put;
+	} else {
+		if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+			goto out_put;
+	}
+
+	/* Only page cache backed files, and no shared writes to them */
+	if (vma->vm_ops) {
+		if (vma->vm_ops->fault != filemap_fault)
+			goto out_put;
+		if ((flags & FAULT_FLAG_WRITE) && (vma->vm_flags & VM_SHARED))
+			goto out_put;
+	}
+
+	/* See fault_alloc_vma(): the vma's own mempolicy needs mmap_sem */
+	if (vma_policy(vma))
+		goto out_put;
+
+	/* Private writes need an anon_vma, and anon_vma_prepare() mmap_sem */
+	if ((flags & FAULT_FLAG_WRITE) && !vma->anon_vma)
+		goto out_put;
+
+	if (vma_has_changed(vma, seq))
+		goto out_put;
+
+	/*
+	 * Walk the page tables with interrupts disabled, as fast gup does,
+	 * so that they cannot be freed under us.  Missing page tables and
+	 * huge pmds are left to the usual path.
+	 */
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	pgdval = ACCESS_ONCE(*pgd);
+	if (pgd_none(pgdval) || unlikely(pgd_bad(pgdval)))
+		goto out_walk;
+
+	pud = pud_offset(pgd, address);
+	pudval = ACCESS_ONCE(*pud);
+	if (pud_none(pudval) || unlikely(pud_bad(pudval)))
+		goto out_walk;
+
+	pmd = pmd_offset(pud, address);
+	pmdval = ACCESS_ONCE(*pmd);
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    pmd_numa(pmdval) || unlikely(pmd_bad(pmdval)))
+		goto out_walk;
+
+	pte = pte_offset_map(pmd, address);
+	entry = ACCESS_ONCE(*pte);
+	pte_unmap(pte);
+	local_irq_enable();
+
+	if (pte_none(entry)) {
+		if (vma->vm_ops)
+			ret = do_linear_fault(mm, vma, address, NULL, pmd,
+					      flags, entry, seq);
+		else
+			ret = do_anonymous_page(mm, vma, address, NULL, pmd,
+						flags, seq);
+		/* An error may just mean we raced with truncate or munmap */
+		if ((ret & VM_FAULT_ERROR) && vma_has_changed(vma, seq))
+			ret = VM_FAULT_RETRY;
+		goto out_put;
+	}
+
+	if (!pte_present(entry) || pte_numa(entry))
+		goto out_put;
+
+	/* Write protected: do_wp_page() needs mmap_sem */
+	if ((flags & FAULT_FLAG_WRITE) && !pte_write(entry))
+		goto out_put;
+
+	if (!pte_map_lock(mm, vma, address, pmd, flags, seq, &pte, &ptl))
+		goto out_put;
+	if (unlikely(!pte_same(*pte, entry)))
+		goto unlock;
+	if (flags & FAULT_FLAG_WRITE)
+		entry = pte_mkdirty(entry);
+	entry = pte_mkyoung(entry);
+	if (ptep_set_access_flags(vma, address, pte, entry, flags & FAULT_FLAG_WRITE)) {
+		update_mmu_cache(vma, address, pte);
+	} else {
+		if (flags & FAULT_FLAG_WRITE)
+			flush_tlb_fix_spurious_fault(vma, address);
+	}
+unlock:
+	pte_unmap_unlock(pte, ptl);
+	ret = 0;
+	goto out_put;
+
+out_walk:
+	local_irq_enable();
+out_put:
+	put_vma(vma);
+	return ret;
+}
+
+/*
+ * Called by the architecture fault handler before it takes mmap_sem.
+ * Anything but VM_FAULT_RETRY means the fault has been handled; flags
+ * must not ask for the fault to be retried, as there is no mmap_sem to
+ * drop.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	int ret;
+
+	flags &= ~(FAULT_FLAG_ALLOW_RETRY | FAULT_FLAG_KILLABLE);
+	flags |= FAULT_FLAG_SPECULATIVE;
+
+	__set_current_state(TASK_RUNNING);
+
+	/* do counter updates before entering really critical section. */
+	check_sync_rss_stat(current);
+
+	if (flags & FAULT_FLAG_USER)
+		mem_cgroup_oom_enable();
+
+	ret = __handle_speculative_fault(mm, address, flags);
+
+	if (flags & FAULT_FLAG_USER) {
+		mem_cgroup_oom_disable();
+		if (task_in_memcg_oom(current) && !(ret & VM_FAULT_OOM))
+			mem_cgroup_oom_synchronize(false);
+	}
+
+	if (ret != VM_FAULT_RETRY) {
+		count_vm_event(PGFAULT);
+		count_vm_event(SPECULATIVE_PGFAULT);
+		mem_cgroup_count_vm_event(mm, PGFAULT);
+	}
+
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -4478,72 +4782,67 @@ EXPORT_SYMBOL(might_fault);
 #endif
 
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) || defined(CONFIG_HUGETLBFS)
-static void clear_gigantic_page(struct page *page,
-				unsigned long addr,
-				unsigned int pages_per_huge_page)
+/*
+ * Clearing or copying a whole huge page through the cache would evict the
+ * faulting task's working set (and its neighbours') for the sake of data
+ * which will mostly not be touched for a while.  So all the subpages but
+ * the one faulted on are written with cache-bypassing stores, where the
+ * architecture supports them; and the subpage containing addr_hint is
+ * done last, with ordinary stores, so that it is still hot on return.
+ *
+ * addr_hint is the faulting address, or any address within the huge page
+ * when there is none better.
+ */
+void clear_huge_page(struct page *page,
+		     unsigned long addr_hint, unsigned int pages_per_huge_page)
 {
-	int i;
+	unsigned long addr = addr_hint &
+		~(((unsigned long)pages_per_huge_page << PAGE_SHIFT) - 1);
+	unsigned int target = (addr_hint - addr) >> PAGE_SHIFT;
+	struct page *target_page = page;
 	struct page *p = page;
+	unsigned int i;
 
 	might_sleep();
 	for (i = 0; i < pages_per_huge_page;
 	     i++, p = mem_map_next(p, page, i)) {
 		cond_resched();
-		clear_user_highpage(p, addr + i * PAGE_SIZE);
-	}
-}
-void clear_huge_page(struct page *page,
-		     unsigned long addr, unsigned int pages_per_huge_page)
-{
-	int i;
-
-	if (unlikely(pages_per_huge_page > MAX_ORDER_NR_PAGES)) {
-		clear_gigantic_page(page, addr, pages_per_huge_page);
-		return;
-	}
-
-	might_sleep();
-	for (i = 0; i < pages_per_huge_page; i++) {
-		cond_resched();
-		clear_user_highpage(page + i, addr + i * PAGE_SIZE);
+		if (i == target) {
+			target_page = p;
+			continue;
+		}
+		clear_user_highpage_nocache(p, addr + i * PAGE_SIZE);
 	}
+	clear_user_highpage(target_page, addr + target * PAGE_SIZE);
 }
 
-static void copy_user_gigantic_page(struct page *dst, struct page *src,
-				    unsigned long addr,
-				    struct vm_area_struct *vma,
-				    unsigned int pages_per_huge_page)
+void copy_user_huge_page(struct page *dst, struct page *src,
+			 unsigned long addr_hint, struct vm_area_struct *vma,
+			 unsigned int pages_per_huge_page)
 {
-	int i;
+	unsigned long addr = addr_hint &
+		~(((unsigned long)pages_per_huge_page << PAGE_SHIFT) - 1);
+	unsigned int target = (addr_hint - addr) >> PAGE_SHIFT;
+	struct page *dst_target = dst, *src_target = src;
 	struct page *dst_base = dst;
 	struct page *src_base = src;
+	unsigned int i;
 
+	might_sleep();
 	for (i = 0; i < pages_per_huge_page; ) {
 		cond_resched();
-		copy_user_highpage(dst, src, addr + i*PAGE_SIZE, vma);
+		if (i == target) {
+			dst_target = dst;
+			src_target = src;
+		} else
+			copy_user_highpage_nocache(dst, src,
+						   addr + i * PAGE_SIZE, vma);
 
 		i++;
 		dst = mem_map_next(dst, dst_base, i);
 		src = mem_map_next(src, src_base, i);
 	}
-}
-
-void copy_user_huge_page(struct page *dst, struct page *src,
-			 unsigned long addr, struct vm_area_struct *vma,
-			 unsigned int pages_per_huge_page)
-{
-	int i;
-
-	if (unlikely(pages_per_huge_page > MAX_ORDER_NR_PAGES)) {
-		copy_user_gigantic_page(dst, src, addr, vma,
-					pages_per_huge_page);
-		return;
-	}
-
-	might_sleep();
-	for (i = 0; i < pages_per_huge_page; i++) {
-		cond_resched();
-		copy_user_highpage(dst + i, src + i, addr + i*PAGE_SIZE, vma);
-	}
+	copy_user_highpage(dst_target, src_target,
+			   addr + target * PAGE_SIZE, vma);
 }
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE || CONFIG_HUGETLBFS */
@@ -725,8 +725,10 @@ static int vma_replace_policy(struct vm_area_struct *vma,
 			goto err_out;
 	}
 
+	vm_write_begin(vma);
 	old = vma->vm_policy;
 	vma->vm_policy = new; /* protected by mmap_sem */
+	vm_write_end(vma);
 	mpol_put(old);
 
 	return 0;
@@ -2368,9 +2370,14 @@ int mpol_misplaced(struct page *page, struct vm_area_struct *vma, unsigned long
 		 * This quadric squishes small probabilities, making
 		 * it less likely we act on an unlikely task<->page
 		 * relation.
+		 *
+		 * Pages that reclaim demoted to a CPU-less node skip the
+		 * filter: being referenced at all makes them worth
+		 * promoting back.
 		 */
 		last_nid = page_nid_xchg_last(page, polnid);
-		if (last_nid != polnid)
+		if (last_nid != polnid &&
+		    !(numa_demotion_enabled && !node_is_toptier(curnid)))
 			goto out;
 	}
 
@@ -38,6 +38,7 @@
 #include <linux/gfp.h>
 #include <linux/balloon_compaction.h>
 #include <linux/mmu_notifier.h>
+#include <linux/memory.h>
 
 #include <asm/tlbflush.h>
 
@@ -943,9 +944,22 @@ static int unmap_and_move(new_page_t get_new_page, free_page_t put_new_page,
 		goto out;
 	}
 
-	if (unlikely(PageTransHuge(page)))
-		if (unlikely(split_huge_page(page)))
+	if (unlikely(PageTransHuge(page))) {
+		/* huge pages of shmem are split under the page lock */
+		bool file = !PageAnon(page);
+
+		if (file && !trylock_page(page)) {
+			rc = -EAGAIN;
+			goto out;
+		}
+		rc = split_huge_page(page);
+		if (file)
+			unlock_page(page);
+		if (unlikely(rc)) {
+			rc = 0;
 			goto out;
+		}
+	}
 
 	rc = __unmap_and_move(page, newpage, force, mode);
 
@@ -1901,4 +1915,124 @@ out_unlock:
 }
 #endif /* CONFIG_NUMA_BALANCING */
 
+/*
+ * Page demotion.
+ *
+ * Nodes that have memory but no CPUs (for instance NVM brought up as
+ * its own node) form a slower tier.  When demotion is enabled, reclaim
+ * on a node with CPUs migrates cold pages to its nearest memory-only
+ * node instead of swapping them out or dropping them, and NUMA hinting
+ * faults bring them back once they are referenced again.
+ */
+bool numa_demotion_enabled __read_mostly;
+
+static int node_demotion[MAX_NUMNODES] __read_mostly = {
+	[0 ... MAX_NUMNODES - 1] = NUMA_NO_NODE,
+};
+static DEFINE_MUTEX(demotion_mutex);
+
+/*
+ * Return the node that reclaim on @node should demote pages to, or
+ * NUMA_NO_NODE if pages there are to be reclaimed as usual.
+ */
+int next_demotion_node(int node)
+{
+	return ACCESS_ONCE(node_demotion[node]);
+}
+
+/*
+ * A node is part of the top tier if it has CPUs: pages found on any
+ * other node are promoted back as soon as a CPU touches them.
+ */
+bool node_is_toptier(int node)
+{
+	return node_state(node, N_CPU);
+}
+
+static void set_demotion_targets(void)
+{
+	int node, target;
+
+	mutex_lock(&demotion_mutex);
+	for_each_node(node) {
+		int best = NUMA_NO_NODE;
+		int best_distance = INT_MAX;
+
+		if (node_state(node, N_MEMORY) && node_is_toptier(node)) {
+			for_each_node_state(target, N_MEMORY) {
+				if (node_is_toptier(target))
+					continue;
+				if (node_distance(node, target) < best_distance) {
+					best = target;
+					best_distance = node_distance(node, target);
+				}
+			}
+		}
+		ACCESS_ONCE(node_demotion[node]) = best;
+	}
+	mutex_unlock(&demotion_mutex);
+}
+
+#ifdef CONFIG_MEMORY_HOTPLUG
+static int demotion_memory_callback(struct notifier_block *self,
+				    unsigned long action, void *arg)
+{
+	switch (action) {
+	case MEM_ONLINE:
+	case MEM_OFFLINE:
+		set_demotion_targets();
+		break;
+	}
+	return NOTIFY_OK;
+}
+#endif /* CONFIG_MEMORY_HOTPLUG */
+
+#ifdef CONFIG_SYSFS
+static ssize_t demotion_enabled_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", numa_demotion_enabled ? "true" : "false");
+}
+
+static ssize_t demotion_enabled_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	bool enable;
+
+	if (strtobool(buf, &enable))
+		return -EINVAL;
+
+	numa_demotion_enabled = enable;
+
+	return count;
+}
+
+static struct kobj_attribute numa_demotion_enabled_attr =
+	__ATTR(demotion_enabled, 0644, demotion_enabled_show,
+	       demotion_enabled_store);
+
+static struct attribute *numa_attrs[] = {
+	&numa_demotion_enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group numa_attr_group = {
+	.attrs = numa_attrs,
+	.name = "numa",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init numa_demotion_init(void)
+{
+	set_demotion_targets();
+	hotplug_memory_notifier(demotion_memory_callback, 100);
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &numa_attr_group))
+		pr_err("numa: failed to register demotion sysfs group\n");
+#endif
+	return 0;
+}
+late_initcall(numa_demotion_init);
+
 #endif /* CONFIG_NUMA */
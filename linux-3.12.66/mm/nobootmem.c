@@ -75,7 +75,7 @@ void __init free_bootmem_late(unsigned long addr, unsigned long size)
 	end = PFN_DOWN(addr + size);
 
 	for (; cursor < end; cursor++) {
-		__free_pages_bootmem(pfn_to_page(cursor), 0);
+		__free_pages_bootmem(pfn_to_page(cursor), cursor, 0);
 		totalram_pages++;
 	}
 }
@@ -90,19 +90,19 @@ static void __init __free_pages_memory(unsigned long start, unsigned long end)
 
 	if (end_aligned <= start_aligned) {
 		for (i = start; i < end; i++)
-			__free_pages_bootmem(pfn_to_page(i), 0);
+			__free_pages_bootmem(pfn_to_page(i), i, 0);
 
 		return;
 	}
 
 	for (i = start; i < start_aligned; i++)
-		__free_pages_bootmem(pfn_to_page(i), 0);
+		__free_pages_bootmem(pfn_to_page(i), i, 0);
 
 	for (i = start_aligned; i < end_aligned; i += BITS_PER_LONG)
-		__free_pages_bootmem(pfn_to_page(i), order);
+		__free_pages_bootmem(pfn_to_page(i), i, order);
 
 	for (i = end_aligned; i < end; i++)
-		__free_pages_bootmem(pfn_to_page(i), 0);
+		__free_pages_bootmem(pfn_to_page(i), i, 0);
 }
 
 static unsigned long __init __free_memory_core(phys_addr_t start,
@@ -124,8 +124,12 @@ static unsigned long __init free_low_memory_core_early(void)
 {
 	unsigned long count = 0;
 	phys_addr_t start, end, size;
+	struct memblock_region *r;
 	u64 i;
 
+	for_each_memblock(reserved, r)
+		reserve_bootmem_region(r->base, r->base + r->size);
+
 	for_each_free_mem_range(i, MAX_NUMNODES, &start, &end, NULL)
 		count += __free_memory_core(start, end);
 
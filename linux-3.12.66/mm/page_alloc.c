@@ -61,6 +61,7 @@
 #include <linux/page-debug-flags.h>
 #include <linux/hugetlb.h>
 #include <linux/sched/rt.h>
+#include <linux/kthread.h>
 
 #include <asm/sections.h>
 #include <asm/tlbflush.h>
@@ -774,7 +775,139 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 	local_irq_restore(flags);
 }
 
-void __init __free_pages_bootmem(struct page *page, unsigned int order)
+static void __meminit __init_single_page(struct page *page, unsigned long pfn,
+				unsigned long zone, int nid)
+{
+	struct zone *z = &NODE_DATA(nid)->node_zones[zone];
+
+	set_page_links(page, zone, nid, pfn);
+	mminit_verify_page_links(page, zone, nid, pfn);
+	init_page_count(page);
+	page_mapcount_reset(page);
+	page_nid_reset_last(page);
+	SetPageReserved(page);
+	/*
+	 * Mark the block movable so that blocks are reserved for
+	 * movable at startup. This will force kernel allocations
+	 * to reserve their blocks rather than leaking throughout
+	 * the address space during boot when many long-lived
+	 * kernel allocations are made. Later some blocks near
+	 * the start are marked MIGRATE_RESERVE by
+	 * setup_zone_migrate_reserve()
+	 *
+	 * bitmap is created for zone's valid pfn range. but memmap
+	 * can be created for invalid pages (for alignment)
+	 * check here not to call set_pageblock_migratetype() against
+	 * pfn out of zone.
+	 */
+	if ((z->zone_start_pfn <= pfn)
+	    && (pfn < zone_end_pfn(z))
+	    && !(pfn & (pageblock_nr_pages - 1)))
+		set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+
+	INIT_LIST_HEAD(&page->lru);
+#ifdef WANT_PAGE_VIRTUAL
+	/* The shift won't overflow because ZONE_NORMAL is below 4G. */
+	if (!is_highmem_idx(zone))
+		set_page_address(page, __va(pfn << PAGE_SHIFT));
+#endif
+}
+
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+static inline void pgdat_set_deferred_range(pg_data_t *pgdat)
+{
+	pgdat->first_deferred_pfn = ULONG_MAX;
+}
+
+/*
+ * Returns true if the struct page for @pfn lies in the deferred range of
+ * its node and has not been initialised yet. The memmap is allocated
+ * zeroed, so an uninitialised struct page has no flags set, while an
+ * initialised one at least has PG_reserved set until it is freed.
+ */
+static inline bool __meminit early_page_uninitialised(unsigned long pfn)
+{
+	pg_data_t *pgdat = NODE_DATA(early_pfn_to_nid(pfn));
+
+	return pfn >= pgdat->first_deferred_pfn && !pfn_to_page(pfn)->flags;
+}
+
+/*
+ * Returns false once enough of the node has been initialised during early
+ * boot; the remainder is initialised by deferred_init_memmap() after SMP
+ * is up.
+ */
+static inline bool __meminit update_defer_init(pg_data_t *pgdat,
+				unsigned long pfn, unsigned long zone_end,
+				unsigned long *nr_initialised)
+{
+	/* Always populate low zones for address-constrained allocations */
+	if (zone_end < pgdat_end_pfn(pgdat))
+		return true;
+
+	/* Initialise at least 2G of the highest zone */
+	(*nr_initialised)++;
+	if (*nr_initialised > (2UL << (30 - PAGE_SHIFT)) &&
+	    (pfn & (PAGES_PER_SECTION - 1)) == 0) {
+		pgdat->first_deferred_pfn = pfn;
+		return false;
+	}
+
+	return true;
+}
+#else
+static inline void pgdat_set_deferred_range(pg_data_t *pgdat)
+{
+}
+
+static inline bool early_page_uninitialised(unsigned long pfn)
+{
+	return false;
+}
+
+static inline bool update_defer_init(pg_data_t *pgdat,
+				unsigned long pfn, unsigned long zone_end,
+				unsigned long *nr_initialised)
+{
+	return true;
+}
+#endif /* CONFIG_DEFERRED_STRUCT_PAGE_INIT */
+
+/*
+ * Initialise the struct pages of a memblock reserved range that falls into
+ * a node's deferred range. They are never handed to the page allocator by
+ * free_all_bootmem() but may be freed individually later on, and pfn
+ * walkers must see them with a valid zone and node.
+ */
+void __meminit reserve_bootmem_region(phys_addr_t start, phys_addr_t end)
+{
+	unsigned long start_pfn = PFN_DOWN(start);
+	unsigned long end_pfn = PFN_UP(end);
+
+	for (; start_pfn < end_pfn; start_pfn++) {
+		pg_data_t *pgdat;
+		int nid, zid;
+
+		if (!early_pfn_valid(start_pfn))
+			continue;
+		if (!early_page_uninitialised(start_pfn))
+			continue;
+
+		nid = early_pfn_to_nid(start_pfn);
+		pgdat = NODE_DATA(nid);
+		for (zid = 0; zid < MAX_NR_ZONES - 1; zid++) {
+			struct zone *zone = &pgdat->node_zones[zid];
+
+			if (start_pfn >= zone->zone_start_pfn &&
+			    start_pfn < zone_end_pfn(zone))
+				break;
+		}
+		__init_single_page(pfn_to_page(start_pfn), start_pfn, zid, nid);
+	}
+}
+
+static void __init __free_pages_boot_core(struct page *page,
+					unsigned int order)
 {
 	unsigned int nr_pages = 1 << order;
 	struct page *p = page;
@@ -794,6 +927,139 @@ void __init __free_pages_bootmem(struct page *page, unsigned int order)
 	__free_pages(page, order);
 }
 
+void __init __free_pages_bootmem(struct page *page, unsigned long pfn,
+				 unsigned int order)
+{
+	/* Left for deferred_init_memmap() to initialise and free */
+	if (early_page_uninitialised(pfn))
+		return;
+
+	__free_pages_boot_core(page, order);
+}
+
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+/* Free a run of freshly initialised pages in the largest aligned blocks */
+static void __init deferred_free_range(unsigned long pfn,
+				       unsigned long nr_pages)
+{
+	unsigned long end_pfn = pfn + nr_pages;
+
+	while (pfn < end_pfn) {
+		unsigned int order = MAX_ORDER - 1;
+
+		while (order && ((pfn & ((1UL << order) - 1)) ||
+				 pfn + (1UL << order) > end_pfn))
+			order--;
+
+		__free_pages_boot_core(pfn_to_page(pfn), order);
+		pfn += 1UL << order;
+	}
+}
+
+static atomic_t pgdat_init_n_undone __initdata;
+static __initdata DECLARE_COMPLETION(pgdat_init_all_done_comp);
+
+static inline void __init pgdat_init_report_one_done(void)
+{
+	if (atomic_dec_and_test(&pgdat_init_n_undone))
+		complete(&pgdat_init_all_done_comp);
+}
+
+/* Initialise remaining memory on a node */
+static int __init deferred_init_memmap(void *data)
+{
+	pg_data_t *pgdat = data;
+	int nid = pgdat->node_id;
+	unsigned long start = jiffies;
+	unsigned long nr_pages = 0;
+	unsigned long first_init_pfn = pgdat->first_deferred_pfn;
+	unsigned long walk_start, walk_end;
+	const struct cpumask *cpumask = cpumask_of_node(nid);
+	struct zone *zone;
+	int i, zid;
+
+	if (first_init_pfn == ULONG_MAX) {
+		pgdat_init_report_one_done();
+		return 0;
+	}
+
+	/* Bind memory initialisation thread to a local node if possible */
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+
+	BUG_ON(first_init_pfn < pgdat->node_start_pfn);
+	BUG_ON(first_init_pfn > pgdat_end_pfn(pgdat));
+
+	/* Only the highest zone is deferred so find it */
+	for (zid = 0; zid < MAX_NR_ZONES - 1; zid++) {
+		zone = pgdat->node_zones + zid;
+		if (first_init_pfn < zone_end_pfn(zone))
+			break;
+	}
+	zone = pgdat->node_zones + zid;
+
+	for_each_mem_pfn_range(i, nid, &walk_start, &walk_end, NULL) {
+		unsigned long pfn, end_pfn;
+		unsigned long free_base_pfn = 0;
+		unsigned long nr_to_free = 0;
+
+		pfn = max3(walk_start, first_init_pfn, zone->zone_start_pfn);
+		end_pfn = min(walk_end, zone_end_pfn(zone));
+
+		for (; pfn < end_pfn; pfn++) {
+			struct page *page;
+
+			if ((pfn & (MAX_ORDER_NR_PAGES - 1)) == 0)
+				cond_resched();
+
+			if (!early_pfn_valid(pfn))
+				goto free_range;
+
+			/*
+			 * Pages of reserved ranges were initialised by
+			 * reserve_bootmem_region() and stay allocated, so
+			 * they end the current run of pages to free.
+			 */
+			page = pfn_to_page(pfn);
+			if (page->flags)
+				goto free_range;
+
+			__init_single_page(page, pfn, zid, nid);
+			if (!nr_to_free)
+				free_base_pfn = pfn;
+			nr_to_free++;
+			continue;
+free_range:
+			deferred_free_range(free_base_pfn, nr_to_free);
+			nr_pages += nr_to_free;
+			nr_to_free = 0;
+		}
+		deferred_free_range(free_base_pfn, nr_to_free);
+		nr_pages += nr_to_free;
+	}
+
+	pr_info("node %d initialised, %lu pages in %ums\n", nid, nr_pages,
+		jiffies_to_msecs(jiffies - start));
+
+	pgdat_init_report_one_done();
+	return 0;
+}
+
+void __init page_alloc_init_late(void)
+{
+	int nid;
+
+	/* There will be num_node_state(N_MEMORY) threads */
+	atomic_set(&pgdat_init_n_undone, num_node_state(N_MEMORY));
+	for_each_node_state(nid, N_MEMORY)
+		kthread_run(deferred_init_memmap, NODE_DATA(nid),
+			    "pgdatinit%d", nid);
+
+	/* Block until all are initialised */
+	wait_for_completion(&pgdat_init_all_done_comp);
+}
+#endif /* CONFIG_DEFERRED_STRUCT_PAGE_INIT */
+
 #ifdef CONFIG_CMA
 /* Free whole pageblock and set its migration type to MIGRATE_CMA. */
 void __init init_cma_reserved_pageblock(struct page *page)
@@ -4074,15 +4340,14 @@ static void setup_zone_migrate_reserve(struct zone *zone)
 void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 		unsigned long start_pfn, enum memmap_context context)
 {
-	struct page *page;
+	pg_data_t *pgdat = NODE_DATA(nid);
 	unsigned long end_pfn = start_pfn + size;
 	unsigned long pfn;
-	struct zone *z;
+	unsigned long nr_initialised = 0;
 
 	if (highest_memmap_pfn < end_pfn - 1)
 		highest_memmap_pfn = end_pfn - 1;
 
-	z = &NODE_DATA(nid)->node_zones[zone];
 	for (pfn = start_pfn; pfn < end_pfn; pfn++) {
 		/*
 		 * There can be holes in boot-time mem_map[]s
@@ -4094,39 +4359,11 @@ void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 				continue;
 			if (!early_pfn_in_nid(pfn, nid))
 				continue;
+			if (!update_defer_init(pgdat, pfn, end_pfn,
+					       &nr_initialised))
+				break;
 		}
-		page = pfn_to_page(pfn);
-		set_page_links(page, zone, nid, pfn);
-		mminit_verify_page_links(page, zone, nid, pfn);
-		init_page_count(page);
-		page_mapcount_reset(page);
-		page_nid_reset_last(page);
-		SetPageReserved(page);
-		/*
-		 * Mark the block movable so that blocks are reserved for
-		 * movable at startup. This will force kernel allocations
-		 * to reserve their blocks rather than leaking throughout
-		 * the address space during boot when many long-lived
-		 * kernel allocations are made. Later some blocks near
-		 * the start are marked MIGRATE_RESERVE by
-		 * setup_zone_migrate_reserve()
-		 *
-		 * bitmap is created for zone's valid pfn range. but memmap
-		 * can be created for invalid pages (for alignment)
-		 * check here not to call set_pageblock_migratetype() against
-		 * pfn out of zone.
-		 */
-		if ((z->zone_start_pfn <= pfn)
-		    && (pfn < zone_end_pfn(z))
-		    && !(pfn & (pageblock_nr_pages - 1)))
-			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-
-		INIT_LIST_HEAD(&page->lru);
-#ifdef WANT_PAGE_VIRTUAL
-		/* The shift won't overflow because ZONE_NORMAL is below 4G. */
-		if (!is_highmem_idx(zone))
-			set_page_address(page, __va(pfn << PAGE_SHIFT));
-#endif
+		__init_single_page(pfn_to_page(pfn), pfn, zone, nid);
 	}
 }
 
@@ -4820,6 +5057,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 #endif
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	init_waitqueue_head(&pgdat->pfmemalloc_wait);
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat_page_cgroup_init(pgdat);
 
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -4970,6 +5210,8 @@ void __paginginit free_area_init_node(int nid, unsigned long *zones_size,
 		(unsigned long)pgdat->node_mem_map);
 #endif
 
+	pgdat_set_deferred_range(pgdat);
+
 	free_area_init_core(pgdat, start_pfn, end_pfn,
 			    zones_size, zholes_size);
 }
@@ -99,6 +99,7 @@ enum sgp_type {
 	SGP_DIRTY,	/* like SGP_CACHE, but set new page dirty */
 	SGP_WRITE,	/* may exceed i_size, may allocate !Uptodate page */
 	SGP_FALLOC,	/* like SGP_WRITE, but make existing page Uptodate */
+	SGP_HUGE,	/* like SGP_CACHE, but may allocate a huge page */
 };
 
 #ifdef CONFIG_TMPFS
@@ -131,6 +132,81 @@ static inline struct shmem_sb_info *SHMEM_SB(struct super_block *sb)
 	return sb->s_fs_info;
 }
 
+/*
+ * Policies for the huge= mount option, and shmem_enabled in sysfs:
+ *
+ * SHMEM_HUGE_NEVER:
+ *	disables huge pages for the mount;
+ * SHMEM_HUGE_ALWAYS:
+ *	enables huge pages for the mount;
+ * SHMEM_HUGE_WITHIN_SIZE:
+ *	only allocate huge pages if the page will be fully within i_size;
+ * SHMEM_HUGE_ADVISE:
+ *	only allocate huge pages for mappings with madvise(MADV_HUGEPAGE).
+ */
+#define SHMEM_HUGE_NEVER	0
+#define SHMEM_HUGE_ALWAYS	1
+#define SHMEM_HUGE_WITHIN_SIZE	2
+#define SHMEM_HUGE_ADVISE	3
+
+/*
+ * Special values, only for shmem_enabled in sysfs:
+ *
+ * SHMEM_HUGE_DENY:
+ *	disables huge pages on all tmpfs mounts, for use in emergencies;
+ * SHMEM_HUGE_FORCE:
+ *	enables huge pages on all tmpfs mounts, for testing.
+ */
+#define SHMEM_HUGE_DENY		(-1)
+#define SHMEM_HUGE_FORCE	(-2)
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* policy for the internal mount used by SysV shm and shared anonymous memory */
+static int shmem_huge __read_mostly;
+
+#if defined(CONFIG_SYSFS) || defined(CONFIG_TMPFS)
+static int shmem_parse_huge(const char *str)
+{
+	if (!strcmp(str, "never"))
+		return SHMEM_HUGE_NEVER;
+	if (!strcmp(str, "always"))
+		return SHMEM_HUGE_ALWAYS;
+	if (!strcmp(str, "within_size"))
+		return SHMEM_HUGE_WITHIN_SIZE;
+	if (!strcmp(str, "advise"))
+		return SHMEM_HUGE_ADVISE;
+	if (!strcmp(str, "deny"))
+		return SHMEM_HUGE_DENY;
+	if (!strcmp(str, "force"))
+		return SHMEM_HUGE_FORCE;
+	return -EINVAL;
+}
+
+static const char *shmem_format_huge(int huge)
+{
+	switch (huge) {
+	case SHMEM_HUGE_NEVER:
+		return "never";
+	case SHMEM_HUGE_ALWAYS:
+		return "always";
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return "within_size";
+	case SHMEM_HUGE_ADVISE:
+		return "advise";
+	case SHMEM_HUGE_DENY:
+		return "deny";
+	case SHMEM_HUGE_FORCE:
+		return "force";
+	default:
+		VM_BUG_ON(1);
+		return "bad_val";
+	}
+}
+#endif
+#else
+#define shmem_huge SHMEM_HUGE_DENY
+#endif
+
 /*
  * shmem_file_setup pre-accounts the whole fixed size of a VM object,
  * for shared memory and for shared anonymous (/dev/zero) mappings
@@ -155,10 +231,11 @@ static inline void shmem_unacct_size(unsigned long flags, loff_t size)
  * shmem_getpage reports shmem_acct_block failure as -ENOSPC not -ENOMEM,
  * so that a failure on a sparse tmpfs mapping will give SIGBUS not OOM.
  */
-static inline int shmem_acct_block(unsigned long flags)
+static inline int shmem_acct_block(unsigned long flags, long pages)
 {
 	return (flags & VM_NORESERVE) ?
-		security_vm_enough_memory_mm(current->mm, VM_ACCT(PAGE_CACHE_SIZE)) : 0;
+		security_vm_enough_memory_mm(current->mm,
+				pages * VM_ACCT(PAGE_CACHE_SIZE)) : 0;
 }
 
 static inline void shmem_unacct_blocks(unsigned long flags, long pages)
@@ -277,35 +354,56 @@ static bool shmem_confirm_swap(struct address_space *mapping,
 
 /*
  * Like add_to_page_cache_locked, but error if expected item has gone.
+ *
+ * A huge page goes in as HPAGE_PMD_NR subpages, each at its own index,
+ * so that lookups and the code working on small pages find what they
+ * expect.  The head page holds the references of all the slots until
+ * the huge page is split.
  */
 static int shmem_add_to_page_cache(struct page *page,
 				   struct address_space *mapping,
 				   pgoff_t index, gfp_t gfp, void *expected)
 {
-	int error;
+	int error = 0;
+	int i, nr = hpage_nr_pages(page);
 
 	VM_BUG_ON(!PageLocked(page));
 	VM_BUG_ON(!PageSwapBacked(page));
+	VM_BUG_ON(expected && nr > 1);
 
-	page_cache_get(page);
-	page->mapping = mapping;
-	page->index = index;
+	atomic_add(nr, &page->_count);
+	for (i = 0; i < nr; i++) {
+		page[i].mapping = mapping;
+		page[i].index = index + i;
+	}
 
 	spin_lock_irq(&mapping->tree_lock);
-	if (!expected)
-		error = radix_tree_insert(&mapping->page_tree, index, page);
-	else
+	if (!expected) {
+		for (i = 0; i < nr; i++) {
+			error = radix_tree_insert(&mapping->page_tree,
+						  index + i, page + i);
+			if (error) {
+				while (i--)
+					radix_tree_delete(&mapping->page_tree,
+							  index + i);
+				break;
+			}
+		}
+	} else
 		error = shmem_radix_tree_replace(mapping, index, expected,
 								 page);
 	if (!error) {
-		mapping->nrpages++;
-		__inc_zone_page_state(page, NR_FILE_PAGES);
-		__inc_zone_page_state(page, NR_SHMEM);
+		mapping->nrpages += nr;
+		if (nr > 1)
+			__inc_zone_page_state(page, NR_SHMEM_THPS);
+		__mod_zone_page_state(page_zone(page), NR_FILE_PAGES, nr);
+		__mod_zone_page_state(page_zone(page), NR_SHMEM, nr);
 		spin_unlock_irq(&mapping->tree_lock);
 	} else {
-		page->mapping = NULL;
+		for (i = 0; i < nr; i++)
+			page[i].mapping = NULL;
 		spin_unlock_irq(&mapping->tree_lock);
-		page_cache_release(page);
+		atomic_sub(nr, &page->_count);
 	}
 	return error;
 }
@@ -329,6 +427,33 @@ static void shmem_delete_from_page_cache(struct page *page, void *radswap)
 	BUG_ON(error);
 }
 
+/*
+ * Like delete_from_page_cache, but for a huge page just added by
+ * shmem_getpage_gfp(): undo shmem_add_to_page_cache() for all subpages.
+ */
+static void shmem_delete_huge_from_page_cache(struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	int i, nr = hpage_nr_pages(page);
+
+	VM_BUG_ON(!PageLocked(page));
+
+	spin_lock_irq(&mapping->tree_lock);
+	for (i = 0; i < nr; i++) {
+		radix_tree_delete_item(&mapping->page_tree,
+				       page->index + i, page + i);
+		ClearPageDirty(page + i);
+		page[i].mapping = NULL;
+	}
+	mapping->nrpages -= nr;
+	__dec_zone_page_state(page, NR_SHMEM_THPS);
+	__mod_zone_page_state(page_zone(page), NR_FILE_PAGES, -nr);
+	__mod_zone_page_state(page_zone(page), NR_SHMEM, -nr);
+	spin_unlock_irq(&mapping->tree_lock);
+	mem_cgroup_uncharge_cache_page(page);
+	atomic_sub(nr, &page->_count);
+}
+
 /*
  * Remove swap entry from radix tree, free the swap and its page cache.
  */
@@ -422,6 +547,9 @@ static void shmem_undo_range(struct inode *inode, loff_t lstart, loff_t lend,
 				continue;
 			}
 
+			/* huge pages are split below */
+			if (PageTransCompound(page))
+				continue;
 			if (!trylock_page(page))
 				continue;
 			if (!unfalloc || !PageUptodate(page)) {
@@ -502,6 +630,18 @@ static void shmem_undo_range(struct inode *inode, loff_t lstart, loff_t lend,
 				continue;
 			}
 
+			/*
+			 * Truncation works on small pages: split a huge page
+			 * partly or wholly in the range.  Its subpages stay
+			 * in the page cache, and this one is now ours alone.
+			 */
+			if (PageTransCompound(page)) {
+				if (unfalloc && PageUptodate(page))
+					continue;
+				if (shmem_split_huge_page(page))
+					continue;
+			}
+
 			lock_page(page);
 			if (!unfalloc || !PageUptodate(page)) {
 				if (page->mapping == mapping) {
@@ -892,6 +1032,31 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 
 	return page;
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t hindex)
+{
+	struct vm_area_struct pvma;
+	struct page *page;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	/* Bias interleave by inode number to distribute better across nodes */
+	pvma.vm_pgoff = hindex + info->vfs_inode.i_ino;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, hindex);
+
+	page = alloc_pages_vma(gfp | __GFP_COMP | __GFP_NOMEMALLOC |
+			       __GFP_NORETRY | __GFP_NOWARN, HPAGE_PMD_ORDER,
+			       &pvma, 0, numa_node_id());
+
+	/* Drop reference taken by mpol_shared_policy_lookup() */
+	mpol_cond_put(pvma.vm_policy);
+
+	return page;
+}
+#endif
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
 static inline void shmem_show_mpol(struct seq_file *seq, struct mempolicy *mpol)
@@ -910,6 +1075,15 @@ static inline struct page *shmem_alloc_page(gfp_t gfp,
 {
 	return alloc_page(gfp);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t hindex)
+{
+	return alloc_pages(gfp | __GFP_COMP | __GFP_NOMEMALLOC |
+			   __GFP_NORETRY | __GFP_NOWARN, HPAGE_PMD_ORDER);
+}
+#endif
 #endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
@@ -919,6 +1093,98 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Should a page allocated at @index for @sgp be huge?  Only writes,
+ * fallocate and pmd faults get huge pages: a pte fault would have to
+ * split the page again at once.  There is no vma at hand for write and
+ * fallocate, so SHMEM_HUGE_ADVISE is left to shmem_pmd_fault().
+ */
+static bool shmem_huge_wanted(struct inode *inode, pgoff_t index,
+			      enum sgp_type sgp)
+{
+	pgoff_t hindex = round_down(index, HPAGE_PMD_NR);
+	loff_t i_size;
+
+	if (sgp != SGP_WRITE && sgp != SGP_FALLOC && sgp != SGP_HUGE)
+		return false;
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return false;
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+		return true;
+	case SHMEM_HUGE_WITHIN_SIZE:
+		i_size = round_up(i_size_read(inode), PAGE_CACHE_SIZE);
+		return hindex + HPAGE_PMD_NR <= (i_size >> PAGE_CACHE_SHIFT);
+	case SHMEM_HUGE_ADVISE:
+		return sgp == SGP_HUGE;
+	default:
+		return false;
+	}
+}
+
+/*
+ * A huge page only goes where there is neither a page nor a swap entry
+ * yet: if we race with somebody filling the hole, adding the huge page
+ * to the page cache fails with -EEXIST.
+ */
+static bool shmem_huge_range_empty(struct address_space *mapping,
+				   pgoff_t hindex)
+{
+	void **slot;
+	unsigned long index;
+	unsigned int found;
+
+	rcu_read_lock();
+	found = radix_tree_gang_lookup_slot(&mapping->page_tree, &slot,
+					    &index, hindex, 1);
+	rcu_read_unlock();
+	return !found || index >= hindex + HPAGE_PMD_NR;
+}
+
+/*
+ * Split the huge page that @page, pinned but not locked by the caller,
+ * belongs to.  Returns non-zero if the page could not be split.
+ */
+static int shmem_split_huge_page(struct page *page)
+{
+	struct page *head = compound_trans_head(page);
+	int ret = 0;
+
+	/* once split, the head may have been freed and reused */
+	if (head != page && !get_page_unless_zero(head))
+		return 0;
+	lock_page(head);
+	if (PageTransCompound(page) && compound_trans_head(page) == head &&
+	    head->mapping)
+		ret = split_huge_page(head);
+	unlock_page(head);
+	if (head != page)
+		page_cache_release(head);
+	return ret;
+}
+#else
+static inline bool shmem_huge_wanted(struct inode *inode, pgoff_t index,
+				     enum sgp_type sgp)
+{
+	return false;
+}
+
+static inline bool shmem_huge_range_empty(struct address_space *mapping,
+					  pgoff_t hindex)
+{
+	return false;
+}
+
+static inline int shmem_split_huge_page(struct page *page)
+{
+	return 0;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /*
  * When a page is moved from swapcache to shmem filecache (either by the
  * usual swapin of shmem_getpage_gfp(), or by the less common swapoff of
@@ -1002,6 +1268,53 @@ static int shmem_replace_page(struct page **pagep, gfp_t gfp,
 	return error;
 }
 
+/*
+ * Charge the new page against the mount and the memory commit, then
+ * allocate it: the page is huge when @huge, and can only be huge with
+ * CONFIG_TRANSPARENT_HUGEPAGE.
+ */
+static struct page *shmem_alloc_and_acct_page(gfp_t gfp, struct inode *inode,
+					      pgoff_t index, bool huge)
+{
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	struct page *page;
+	int nr;
+	int err = -ENOSPC;
+
+	if (!IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE))
+		huge = false;
+	nr = huge ? HPAGE_PMD_NR : 1;
+
+	if (shmem_acct_block(info->flags, nr))
+		goto failed;
+	if (sbinfo->max_blocks) {
+		if (percpu_counter_compare(&sbinfo->used_blocks,
+					sbinfo->max_blocks - nr) > 0)
+			goto unacct;
+		percpu_counter_add(&sbinfo->used_blocks, nr);
+	}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (huge)
+		page = shmem_alloc_hugepage(gfp, info, index);
+	else
+#endif
+		page = shmem_alloc_page(gfp, info, index);
+	if (page) {
+		__SetPageSwapBacked(page);
+		return page;
+	}
+
+	err = -ENOMEM;
+	if (sbinfo->max_blocks)
+		percpu_counter_add(&sbinfo->used_blocks, -nr);
+unacct:
+	shmem_unacct_blocks(info->flags, nr);
+failed:
+	return ERR_PTR(err);
+}
+
 /*
  * shmem_getpage_gfp - find page in cache, or get from swap, or allocate
  *
@@ -1017,9 +1330,11 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 	struct shmem_sb_info *sbinfo;
 	struct page *page;
 	swp_entry_t swap;
+	pgoff_t hindex = index;
 	int error;
 	int once = 0;
 	int alloced = 0;
+	int nr = 1;
 
 	if (index > (MAX_LFS_FILESIZE >> PAGE_CACHE_SHIFT))
 		return -EFBIG;
@@ -1031,6 +1346,21 @@ repeat:
 		page = NULL;
 	}
 
+	/*
+	 * Part of a huge page: fine for read, write and pmd faults, but a
+	 * page to be mapped by a pte or handed out for other uses must be
+	 * split first.
+	 */
+	if (page && PageTransCompound(page) &&
+	    (sgp == SGP_CACHE || sgp == SGP_DIRTY)) {
+		unlock_page(page);
+		error = shmem_split_huge_page(page);
+		page_cache_release(page);
+		if (error)
+			return -EBUSY;
+		goto repeat;
+	}
+
 	if (sgp != SGP_WRITE && sgp != SGP_FALLOC &&
 	    ((loff_t)index << PAGE_CACHE_SHIFT) >= i_size_read(inode)) {
 		error = -EINVAL;
@@ -1060,6 +1390,12 @@ repeat:
 	info = SHMEM_I(inode);
 	sbinfo = SHMEM_SB(inode->i_sb);
 
+	/* shmem_pmd_fault() leaves anything but a huge page to shmem_fault() */
+	if (swap.val && sgp == SGP_HUGE) {
+		error = -EAGAIN;
+		goto failed;
+	}
+
 	if (swap.val) {
 		/* Look it up and read it in.. */
 		page = lookup_swap_cache(swap);
@@ -1129,29 +1465,53 @@ repeat:
 		swap_free(swap);
 
 	} else {
-		if (shmem_acct_block(info->flags)) {
-			error = -ENOSPC;
-			goto failed;
+		bool huge = false;
+
+		if (shmem_huge_wanted(inode, index, sgp)) {
+			hindex = round_down(index, HPAGE_PMD_NR);
+			huge = shmem_huge_range_empty(mapping, hindex);
 		}
-		if (sbinfo->max_blocks) {
-			if (percpu_counter_compare(&sbinfo->used_blocks,
-						sbinfo->max_blocks) >= 0) {
-				error = -ENOSPC;
-				goto unacct;
+		if (huge) {
+			page = shmem_alloc_and_acct_page(gfp, inode, hindex,
+							 true);
+			if (IS_ERR(page)) {
+				page = NULL;
+				huge = false;
 			}
-			percpu_counter_inc(&sbinfo->used_blocks);
 		}
-
-		page = shmem_alloc_page(gfp, info, index);
-		if (!page) {
-			error = -ENOMEM;
-			goto decused;
+		if (!huge && sgp == SGP_HUGE) {
+			error = -EAGAIN;
+			goto failed;
 		}
+		if (!huge) {
+			hindex = index;
+			page = shmem_alloc_and_acct_page(gfp, inode, index,
+							 false);
+		}
+		if (IS_ERR(page)) {
+			error = PTR_ERR(page);
+			page = NULL;
+			goto failed;
+		}
+		nr = hpage_nr_pages(page);
 
-		__SetPageSwapBacked(page);
 		__set_page_locked(page);
 		if (sgp == SGP_WRITE)
 			init_page_accessed(page);
+		if (PageTransHuge(page)) {
+			int i;
+
+			/*
+			 * The subpages are visible to lookups as soon as
+			 * they are in the page cache, and only the head is
+			 * locked: so they must be uptodate before that.
+			 */
+			clear_huge_page(page, 0, HPAGE_PMD_NR);
+			for (i = 0; i < HPAGE_PMD_NR; i++) {
+				SetPageUptodate(page + i);
+				SetPageDirty(page + i);
+			}
+		}
 
 		error = mem_cgroup_cache_charge(page, current->mm,
 						gfp & GFP_RECLAIM_MASK);
@@ -1159,7 +1519,7 @@ repeat:
 			goto decused;
 		error = radix_tree_maybe_preload(gfp & GFP_RECLAIM_MASK);
 		if (!error) {
-			error = shmem_add_to_page_cache(page, mapping, index,
+			error = shmem_add_to_page_cache(page, mapping, hindex,
 							gfp, NULL);
 			radix_tree_preload_end();
 		}
@@ -1170,12 +1530,18 @@ repeat:
 		lru_cache_add_anon(page);
 
 		spin_lock(&info->lock);
-		info->alloced++;
-		inode->i_blocks += BLOCKS_PER_PAGE;
+		info->alloced += nr;
+		inode->i_blocks += BLOCKS_PER_PAGE * nr;
 		shmem_recalc_inode(inode);
 		spin_unlock(&info->lock);
 		alloced = true;
 
+		if (PageTransHuge(page)) {
+			/* it was cleared and made uptodate before being added */
+			count_vm_event(THP_FILE_ALLOC);
+			goto check_size;
+		}
+
 		/*
 		 * Let SGP_FALLOC use the SGP_WRITE optimization on a new page.
 		 */
@@ -1196,6 +1562,7 @@ clear:
 			set_page_dirty(page);
 	}
 
+check_size:
 	/* Perhaps the file has been truncated since we checked */
 	if (sgp != SGP_WRITE && sgp != SGP_FALLOC &&
 	    ((loff_t)index << PAGE_CACHE_SHIFT) >= i_size_read(inode)) {
@@ -1205,6 +1572,17 @@ clear:
 		else
 			goto failed;
 	}
+
+	/* A huge page was allocated: hand out the subpage asked for */
+	if (PageTransHuge(page) && page->index != index) {
+		struct page *head = page;
+
+		page = head + index - head->index;
+		get_page(page);
+		lock_page(page);
+		unlock_page(head);
+		page_cache_release(head);
+	}
 	*pagep = page;
 	return 0;
 
@@ -1213,18 +1591,21 @@ clear:
 	 */
 trunc:
 	info = SHMEM_I(inode);
-	ClearPageDirty(page);
-	delete_from_page_cache(page);
+	if (PageTransHuge(page)) {
+		shmem_delete_huge_from_page_cache(page);
+	} else {
+		ClearPageDirty(page);
+		delete_from_page_cache(page);
+	}
 	spin_lock(&info->lock);
-	info->alloced--;
-	inode->i_blocks -= BLOCKS_PER_PAGE;
+	info->alloced -= nr;
+	inode->i_blocks -= BLOCKS_PER_PAGE * nr;
 	spin_unlock(&info->lock);
 decused:
 	sbinfo = SHMEM_SB(inode->i_sb);
 	if (sbinfo->max_blocks)
-		percpu_counter_add(&sbinfo->used_blocks, -1);
-unacct:
-	shmem_unacct_blocks(info->flags, 1);
+		percpu_counter_add(&sbinfo->used_blocks, -nr);
+	shmem_unacct_blocks(info->flags, nr);
 failed:
 	if (swap.val && error != -EINVAL &&
 	    !shmem_confirm_swap(mapping, index, swap))
@@ -1321,6 +1702,169 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Map a huge page with a pmd, allocating it if the range is still empty.
+ * Only shared mappings of whole, pmd-aligned huge pages within i_size
+ * qualify: anything else falls back to shmem_fault(), which splits the
+ * huge page if it needs a subpage.
+ */
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = file_inode(vma->vm_file);
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgoff_t hindex = linear_page_index(vma, haddr);
+	struct page *page;
+	loff_t i_size;
+	int ret;
+
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return VM_FAULT_FALLBACK;
+	if (shmem_huge != SHMEM_HUGE_FORCE) {
+		switch (SHMEM_SB(inode->i_sb)->huge) {
+		case SHMEM_HUGE_NEVER:
+			return VM_FAULT_FALLBACK;
+		case SHMEM_HUGE_ADVISE:
+			if (!(vma->vm_flags & VM_HUGEPAGE))
+				return VM_FAULT_FALLBACK;
+			break;
+		}
+	}
+
+	if (!(vma->vm_flags & VM_SHARED) || (vma->vm_flags & VM_NONLINEAR))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	if (hindex & (HPAGE_PMD_NR - 1))
+		return VM_FAULT_FALLBACK;
+	/* leave faults into a hole being punched to shmem_fault() */
+	if (unlikely(inode->i_private))
+		return VM_FAULT_FALLBACK;
+	/* beyond i_size the fault must SIGBUS, a pmd would allow access */
+	i_size = round_up(i_size_read(inode), PAGE_CACHE_SIZE);
+	if (hindex + HPAGE_PMD_NR > (i_size >> PAGE_CACHE_SHIFT))
+		return VM_FAULT_FALLBACK;
+
+	if (shmem_getpage(inode, hindex, &page, SGP_HUGE, NULL))
+		return VM_FAULT_FALLBACK;
+	if (!PageTransHuge(page)) {
+		unlock_page(page);
+		page_cache_release(page);
+		return VM_FAULT_FALLBACK;
+	}
+
+	/*
+	 * Truncation splits the page under its lock, taking down our pmd,
+	 * so it cannot leave the pmd mapping pages beyond i_size.
+	 */
+	i_size = round_up(i_size_read(inode), PAGE_CACHE_SIZE);
+	if (hindex + HPAGE_PMD_NR > (i_size >> PAGE_CACHE_SHIFT)) {
+		unlock_page(page);
+		page_cache_release(page);
+		return VM_FAULT_FALLBACK;
+	}
+
+	get_page(page);
+	ret = do_huge_pmd_file_page(vma, address, pmd, page);
+	unlock_page(page);
+	page_cache_release(page);
+	return ret;
+}
+#endif
+
+/*
+ * Place mappings of objects which may get huge pages so that file offset
+ * and virtual address agree modulo HPAGE_PMD_SIZE: shmem_pmd_fault() can
+ * never map a huge page otherwise.
+ */
+unsigned long shmem_get_unmapped_area(struct file *file,
+				      unsigned long uaddr, unsigned long len,
+				      unsigned long pgoff, unsigned long flags)
+{
+	unsigned long (*get_area)(struct file *,
+		unsigned long, unsigned long, unsigned long, unsigned long);
+	unsigned long addr;
+	unsigned long offset;
+	unsigned long inflated_len;
+	unsigned long inflated_addr;
+	unsigned long inflated_offset;
+
+	if (len > TASK_SIZE)
+		return -ENOMEM;
+
+	get_area = current->mm->get_unmapped_area;
+	addr = get_area(file, uaddr, len, pgoff, flags);
+
+	if (!IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE))
+		return addr;
+	if (IS_ERR_VALUE(addr))
+		return addr;
+	if (addr & ~PAGE_MASK)
+		return addr;
+	if (addr > TASK_SIZE - len)
+		return addr;
+
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return addr;
+	if (len < HPAGE_PMD_SIZE)
+		return addr;
+	if (flags & MAP_FIXED)
+		return addr;
+	/*
+	 * Only MAP_SHARED is mapped hugely, but aligning MAP_PRIVATE costs
+	 * nothing.  If caller specified an address hint, respect that.
+	 */
+	if (uaddr)
+		return addr;
+
+	if (shmem_huge != SHMEM_HUGE_FORCE) {
+		struct super_block *sb;
+
+		if (file) {
+			VM_BUG_ON(file->f_op != &shmem_file_operations);
+			sb = file_inode(file)->i_sb;
+		} else {
+			/*
+			 * Called directly from mm/mmap.c, or drivers/char/mem.c
+			 * for "/dev/zero", to create a shared anonymous object.
+			 */
+			if (IS_ERR(shm_mnt))
+				return addr;
+			sb = shm_mnt->mnt_sb;
+		}
+		if (SHMEM_SB(sb)->huge == SHMEM_HUGE_NEVER)
+			return addr;
+	}
+
+	offset = (pgoff << PAGE_SHIFT) & (HPAGE_PMD_SIZE-1);
+	if (offset && offset + len < 2 * HPAGE_PMD_SIZE)
+		return addr;
+	if ((addr & (HPAGE_PMD_SIZE-1)) == offset)
+		return addr;
+
+	inflated_len = len + HPAGE_PMD_SIZE - PAGE_SIZE;
+	if (inflated_len > TASK_SIZE)
+		return addr;
+	if (inflated_len < len)
+		return addr;
+
+	inflated_addr = get_area(NULL, 0, inflated_len, 0, flags);
+	if (IS_ERR_VALUE(inflated_addr))
+		return addr;
+	if (inflated_addr & ~PAGE_MASK)
+		return addr;
+
+	inflated_offset = inflated_addr & (HPAGE_PMD_SIZE-1);
+	inflated_addr += offset - inflated_offset;
+	if (inflated_offset > offset)
+		inflated_addr += HPAGE_PMD_SIZE;
+
+	if (inflated_addr > TASK_SIZE - len)
+		return addr;
+	return inflated_addr;
+}
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol)
 {
@@ -2531,6 +3075,15 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 			mpol = NULL;
 			if (mpol_parse_str(value, &mpol))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		} else if (!strcmp(this_char, "huge")) {
+			int huge;
+
+			huge = shmem_parse_huge(value);
+			if (huge < 0)
+				goto bad_val;
+			sbinfo->huge = huge;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2580,6 +3133,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge = config.huge;
 
 	/*
 	 * Preserve previous mempolicy unless mpol remount option was specified.
@@ -2610,6 +3164,11 @@ static int shmem_show_options(struct seq_file *seq, struct dentry *root)
 	if (!gid_eq(sbinfo->gid, GLOBAL_ROOT_GID))
 		seq_printf(seq, ",gid=%u",
 				from_kgid_munged(&init_user_ns, sbinfo->gid));
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/* Rightly or wrongly, show huge mount option unmasked by shmem_huge */
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=%s", shmem_format_huge(sbinfo->huge));
+#endif
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2753,6 +3312,7 @@ static const struct address_space_operations shmem_aops = {
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+	.get_unmapped_area = shmem_get_unmapped_area,
 #ifdef CONFIG_TMPFS
 	.llseek		= shmem_file_llseek,
 	.read		= do_sync_read,
@@ -2827,6 +3387,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2889,6 +3452,57 @@ out4:
 	return error;
 }
 
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && defined(CONFIG_SYSFS)
+static ssize_t shmem_enabled_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	int values[] = {
+		SHMEM_HUGE_ALWAYS,
+		SHMEM_HUGE_WITHIN_SIZE,
+		SHMEM_HUGE_ADVISE,
+		SHMEM_HUGE_NEVER,
+		SHMEM_HUGE_DENY,
+		SHMEM_HUGE_FORCE,
+	};
+	int i, count;
+
+	for (i = 0, count = 0; i < ARRAY_SIZE(values); i++) {
+		const char *fmt = shmem_huge == values[i] ? "[%s] " : "%s ";
+
+		count += sprintf(buf + count, fmt,
+				shmem_format_huge(values[i]));
+	}
+	buf[count - 1] = '\n';
+	return count;
+}
+
+static ssize_t shmem_enabled_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	char tmp[16];
+	int huge;
+
+	if (count + 1 > sizeof(tmp))
+		return -EINVAL;
+	memcpy(tmp, buf, count);
+	tmp[count] = '\0';
+	if (count && tmp[count - 1] == '\n')
+		tmp[count - 1] = '\0';
+
+	huge = shmem_parse_huge(tmp);
+	if (huge == -EINVAL)
+		return -EINVAL;
+
+	shmem_huge = huge;
+	if (shmem_huge > SHMEM_HUGE_DENY)
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
+	return count;
+}
+
+struct kobj_attribute shmem_enabled_attr =
+	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE && CONFIG_SYSFS */
+
 #else /* !CONFIG_SHMEM */
 
 /*
@@ -2917,6 +3531,15 @@ int __init shmem_init(void)
 	return 0;
 }
 
+#ifdef CONFIG_MMU
+unsigned long shmem_get_unmapped_area(struct file *file,
+				      unsigned long addr, unsigned long len,
+				      unsigned long pgoff, unsigned long flags)
+{
+	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+}
+#endif
+
 int shmem_unuse(swp_entry_t swap, struct page *page)
 {
 	return 0;
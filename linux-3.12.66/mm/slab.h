@@ -92,6 +92,10 @@ __kmem_cache_alias(struct mem_cgroup *memcg, const char *name, size_t size,
 
 int __kmem_cache_shutdown(struct kmem_cache *);
 
+/* Bulk operations for allocators without a native implementation */
+void __kmem_cache_free_bulk(struct kmem_cache *, size_t, void **);
+int __kmem_cache_alloc_bulk(struct kmem_cache *, gfp_t, size_t, void **);
+
 struct seq_file;
 struct file;
 
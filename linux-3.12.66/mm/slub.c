@@ -1270,6 +1270,24 @@ static inline void slab_free_hook(struct kmem_cache *s, void *x) {}
 
 #endif /* CONFIG_SLUB_DEBUG */
 
+/*
+ * Run the free hook on every object of a detached freelist. The list
+ * ends at @tail; a NULL @tail means @head is a single object.
+ */
+static inline void slab_free_freelist_hook(struct kmem_cache *s,
+					   void *head, void *tail)
+{
+#if defined(CONFIG_KMEMCHECK) || defined(CONFIG_LOCKDEP) || \
+	defined(CONFIG_DEBUG_KMEMLEAK) || defined(CONFIG_DEBUG_OBJECTS_FREE)
+	void *object = head;
+	void *tail_obj = tail ? : head;
+
+	do {
+		slab_free_hook(s, object);
+	} while (object != tail_obj && (object = get_freepointer(s, object)));
+#endif
+}
+
 /*
  * Slab allocation and freeing
  */
@@ -2437,6 +2455,76 @@ void *kmem_cache_alloc(struct kmem_cache *s, gfp_t gfpflags)
 }
 EXPORT_SYMBOL(kmem_cache_alloc);
 
+/*
+ * Allocate @size objects of cache @s into @p. Objects are taken straight
+ * off the cpu freelist with interrupts disabled and a single transaction
+ * id bump, instead of one cmpxchg per object. Either all objects are
+ * allocated or none; returns the number allocated.
+ *
+ * Must be called with interrupts enabled.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	int i;
+
+	if (slab_pre_alloc_hook(s, flags))
+		return 0;
+
+	s = memcg_kmem_get_cache(s, flags);
+
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+			/*
+			 * The slow path may enable interrupts to allocate a
+			 * new slab. Bump the tid first so that a fastpath
+			 * cmpxchg that raced with the objects we already
+			 * took fails.
+			 */
+			c->tid = next_tid(c->tid);
+			p[i] = __slab_alloc(s, flags, NUMA_NO_NODE,
+					    _RET_IP_, c);
+			if (unlikely(!p[i]))
+				goto error;
+
+			/* The slow path refilled the cpu freelist */
+			c = this_cpu_ptr(s->cpu_slab);
+			continue;
+		}
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+	}
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+
+	for (i = 0; i < size; i++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[i], 0, s->object_size);
+		slab_post_alloc_hook(s, flags, p[i]);
+		trace_kmem_cache_alloc(_RET_IP_, p[i], s->object_size,
+				       s->size, flags);
+	}
+	return i;
+
+error:
+	local_irq_enable();
+	if (i) {
+		int j;
+
+		for (j = 0; j < i; j++)
+			slab_post_alloc_hook(s, flags, p[j]);
+		kmem_cache_free_bulk(s, i, p);
+	}
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
 #ifdef CONFIG_TRACING
 void *kmem_cache_alloc_trace(struct kmem_cache *s, gfp_t gfpflags, size_t size)
 {
@@ -2483,10 +2571,10 @@ EXPORT_SYMBOL(kmem_cache_alloc_node_trace);
  * handling required then we can return immediately.
  */
 static void __slab_free(struct kmem_cache *s, struct page *page,
-			void *x, unsigned long addr)
+			void *head, void *tail, int cnt, unsigned long addr)
 {
 	void *prior;
-	void **object = (void *)x;
+	void **object = (void *)head;
 	int was_frozen;
 	struct page new;
 	unsigned long counters;
@@ -2495,8 +2583,9 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 
 	stat(s, FREE_SLOWPATH);
 
+	/* Debug caches never hand in detached freelists, see bulk free */
 	if (kmem_cache_debug(s) &&
-		!(n = free_debug_processing(s, page, x, addr, &flags)))
+		!(n = free_debug_processing(s, page, head, addr, &flags)))
 		return;
 
 	do {
@@ -2506,10 +2595,10 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 		}
 		prior = page->freelist;
 		counters = page->counters;
-		set_freepointer(s, object, prior);
+		set_freepointer(s, tail ? : head, prior);
 		new.counters = counters;
 		was_frozen = new.frozen;
-		new.inuse--;
+		new.inuse -= cnt;
 		if ((!new.inuse || !prior) && !was_frozen) {
 
 			if (kmem_cache_has_cpu_partial(s) && !prior)
@@ -2604,15 +2693,21 @@ slab_empty:
  *
  * If fastpath is not possible then fall back to __slab_free where we deal
  * with all sorts of special processing.
+ *
+ * Bulk free can hand in a list of @cnt objects of the same slab page that
+ * are already linked through their free pointers, from @head to @tail.
+ * The whole list is spliced onto the freelist with a single cmpxchg.
  */
 static __always_inline void slab_free(struct kmem_cache *s,
-			struct page *page, void *x, unsigned long addr)
+			struct page *page, void *head, void *tail, int cnt,
+			unsigned long addr)
 {
-	void **object = (void *)x;
+	void **object = (void *)head;
+	void *tail_obj = tail ? : head;
 	struct kmem_cache_cpu *c;
 	unsigned long tid;
 
-	slab_free_hook(s, x);
+	slab_free_freelist_hook(s, head, tail);
 
 redo:
 	/*
@@ -2628,7 +2723,7 @@ redo:
 	preempt_enable();
 
 	if (likely(page == c->page)) {
-		set_freepointer(s, object, c->freelist);
+		set_freepointer(s, tail_obj, c->freelist);
 
 		if (unlikely(!this_cpu_cmpxchg_double(
 				s->cpu_slab->freelist, s->cpu_slab->tid,
@@ -2640,7 +2735,7 @@ redo:
 		}
 		stat(s, FREE_FASTPATH);
 	} else
-		__slab_free(s, page, x, addr);
+		__slab_free(s, page, head, tail, cnt, addr);
 
 }
 
@@ -2649,11 +2744,102 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 	s = cache_from_obj(s, x);
 	if (!s)
 		return;
-	slab_free(s, virt_to_head_page(x), x, _RET_IP_);
+	slab_free(s, virt_to_head_page(x), x, NULL, 1, _RET_IP_);
 	trace_kmem_cache_free(_RET_IP_, x);
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+struct detached_freelist {
+	struct kmem_cache *s;
+	struct page *page;
+	void *freelist;
+	void *tail;
+	int cnt;
+};
+
+/*
+ * Gather the objects of @p that live on the same slab page as the last
+ * one into a freelist detached from any cpu or node. Objects that were
+ * taken are cleared in @p. Only a few objects of other pages are stepped
+ * over before giving up, so that a badly mixed array does not turn this
+ * into a quadratic scan.
+ *
+ * Returns the number of entries of @p still to be looked at.
+ */
+static size_t build_detached_freelist(struct kmem_cache *s, size_t size,
+				      void **p, struct detached_freelist *df)
+{
+	size_t first_skipped_index = 0;
+	int lookahead = 3;
+	void *object;
+
+	df->page = NULL;
+
+	do {
+		object = p[--size];
+	} while (!object && size);
+
+	if (!object)
+		return 0;
+
+	df->s = cache_from_obj(s, object);
+	df->page = virt_to_head_page(object);
+	df->freelist = object;
+	df->tail = object;
+	df->cnt = 1;
+	set_freepointer(df->s, object, NULL);
+	p[size] = NULL;
+
+	/* Debug caches check every object on its own in __slab_free */
+	if (kmem_cache_debug(df->s))
+		return size;
+
+	while (size) {
+		object = p[--size];
+		if (!object)
+			continue;
+
+		if (virt_to_head_page(object) == df->page) {
+			set_freepointer(df->s, object, df->freelist);
+			df->freelist = object;
+			df->cnt++;
+			p[size] = NULL;
+			continue;
+		}
+
+		if (!--lookahead)
+			break;
+
+		if (!first_skipped_index)
+			first_skipped_index = size + 1;
+	}
+
+	return first_skipped_index;
+}
+
+/*
+ * Free @size objects of cache @s. The objects are grouped per slab page
+ * and each group goes back with one freelist update. The entries of @p
+ * are cleared on return.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	if (WARN_ON(!size))
+		return;
+
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, p, &df);
+		if (unlikely(!df.page))
+			continue;
+
+		slab_free(df.s, df.page, df.freelist,
+			  df.cnt > 1 ? df.tail : NULL, df.cnt, _RET_IP_);
+	} while (likely(size));
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 /*
  * Object placement in a slab is made very easy because we always start at
  * offset 0. If we tune the size of the object to the alignment then we can
@@ -3338,7 +3524,7 @@ void kfree(const void *x)
 		__free_memcg_kmem_pages(page, compound_order(page));
 		return;
 	}
-	slab_free(page->slab_cache, page, object, _RET_IP_);
+	slab_free(page->slab_cache, page, object, NULL, 1, _RET_IP_);
 }
 EXPORT_SYMBOL(kfree);
 
@@ -0,0 +1,288 @@
+/*
+ * Manage cache of swap slots to be used for and returned from
+ * swap.
+ *
+ * Allocating and freeing a swap slot normally goes through the swap
+ * device lock for every page. With many CPUs reclaiming to a fast
+ * device that lock, not the device, limits swap throughput.
+ *
+ * Each CPU keeps a small cache of slots reserved from one swap device
+ * with get_swap_pages(), SWAP_SLOTS_CACHE_SIZE at a time, so that
+ * get_swap_page() usually only takes the per cpu alloc_lock. Slots whose
+ * last reference is dropped are parked, still marked SWAP_HAS_CACHE, in
+ * a per cpu return cache and released to their devices in one batch by
+ * swapcache_free_entries().
+ *
+ * The caches are turned off when swap runs low, so that the remaining
+ * free slots are not stranded on other CPUs, and during swapoff, which
+ * cannot deal with parked slots.
+ */
+
+#include <linux/swap_slots.h>
+#include <linux/swapfile.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/notifier.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static bool swap_slot_cache_active;
+bool swap_slot_cache_enabled;
+static bool swap_slot_cache_initialized;
+/* Serialize activation and deactivation when swap runs low */
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+/* Serialize swap slots cache enable/disable operations */
+static DEFINE_MUTEX(swap_slots_cache_enable_mutex);
+
+#define use_swap_slot_cache (swap_slot_cache_active && \
+		swap_slot_cache_enabled && swap_slot_cache_initialized)
+#define SLOTS_CACHE	0x1
+#define SLOTS_CACHE_RET	0x2
+
+static void drain_slots_cache_cpu(unsigned int cpu, unsigned int type)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+	unsigned long flags;
+
+	if ((type & SLOTS_CACHE) && cache->slots) {
+		mutex_lock(&cache->alloc_lock);
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->cur = 0;
+		cache->nr = 0;
+		mutex_unlock(&cache->alloc_lock);
+	}
+	if ((type & SLOTS_CACHE_RET) && cache->slots_ret) {
+		spin_lock_irqsave(&cache->free_lock, flags);
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+		spin_unlock_irqrestore(&cache->free_lock, flags);
+	}
+}
+
+static void __drain_swap_slots_cache(unsigned int type)
+{
+	unsigned int cpu;
+
+	/*
+	 * The caches of offline CPUs are drained when they go down, but
+	 * walking all possible CPUs keeps this free of hotplug locking.
+	 */
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu, type);
+}
+
+static void deactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = false;
+	__drain_swap_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static void reactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static bool has_usable_swap(void)
+{
+	bool ret;
+
+	spin_lock(&swap_lock);
+	ret = !plist_head_empty(&swap_active_head);
+	spin_unlock(&swap_lock);
+	return ret;
+}
+
+static void __reenable_swap_slots_cache(void)
+{
+	swap_slot_cache_enabled = has_usable_swap();
+}
+
+/* Must not be called with cpu hot plug lock */
+void disable_swap_slots_cache_lock(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = false;
+	if (swap_slot_cache_initialized)
+		__drain_swap_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	__reenable_swap_slots_cache();
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+static bool check_cache_active(void)
+{
+	long pages;
+
+	if (!swap_slot_cache_enabled || !swap_slot_cache_initialized)
+		return false;
+
+	pages = get_nr_swap_pages();
+	if (!swap_slot_cache_active) {
+		if (pages > num_online_cpus() *
+		    THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE)
+			reactivate_swap_slots_cache();
+		goto out;
+	}
+
+	/* if global pool of slot caches too low, deactivate cache */
+	if (pages < num_online_cpus() * THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE)
+		deactivate_swap_slots_cache();
+out:
+	return swap_slot_cache_active;
+}
+
+static int alloc_swap_slot_cache(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+	swp_entry_t *slots, *slots_ret;
+
+	if (cache->slots)
+		return 0;
+
+	slots = kzalloc_node(sizeof(swp_entry_t) * SWAP_SLOTS_CACHE_SIZE,
+			     GFP_KERNEL, cpu_to_node(cpu));
+	if (!slots)
+		return -ENOMEM;
+
+	slots_ret = kzalloc_node(sizeof(swp_entry_t) * SWAP_SLOTS_CACHE_SIZE,
+				 GFP_KERNEL, cpu_to_node(cpu));
+	if (!slots_ret) {
+		kfree(slots);
+		return -ENOMEM;
+	}
+
+	mutex_init(&cache->alloc_lock);
+	spin_lock_init(&cache->free_lock);
+	cache->nr = 0;
+	cache->cur = 0;
+	cache->n_ret = 0;
+	cache->slots_ret = slots_ret;
+	/* the caches are only looked at once slots is set */
+	smp_wmb();
+	cache->slots = slots;
+	return 0;
+}
+
+static int swap_slots_cpu_callback(struct notifier_block *nfb,
+				   unsigned long action, void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu(cpu, SLOTS_CACHE | SLOTS_CACHE_RET);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block swap_slots_cpu_notifier = {
+	.notifier_call = swap_slots_cpu_callback,
+};
+
+/* Called after a swap device has been enabled */
+void enable_swap_slots_cache(void)
+{
+	unsigned int cpu;
+
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	if (!swap_slot_cache_initialized) {
+		for_each_possible_cpu(cpu) {
+			if (alloc_swap_slot_cache(cpu)) {
+				pr_err("%s: failed to allocate swap slots cache, using direct swap slot allocation\n",
+				       __func__);
+				goto out_unlock;
+			}
+		}
+		register_hotcpu_notifier(&swap_slots_cpu_notifier);
+		smp_wmb();
+		swap_slot_cache_initialized = true;
+		swap_slot_cache_active = true;
+	}
+	__reenable_swap_slots_cache();
+out_unlock:
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/* called with swap slot cache's alloc lock held */
+static int refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	if (!use_swap_slot_cache || cache->nr)
+		return 0;
+
+	cache->cur = 0;
+	cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+
+	return cache->nr;
+}
+
+void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+	unsigned long flags;
+
+	cache = __this_cpu_ptr(&swp_slots);
+	if (use_swap_slot_cache && cache->slots) {
+		spin_lock_irqsave(&cache->free_lock, flags);
+		/* Swap slots cache may be deactivated before acquiring lock */
+		if (!use_swap_slot_cache) {
+			spin_unlock_irqrestore(&cache->free_lock, flags);
+			goto direct_free;
+		}
+		if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+			/*
+			 * Return slots to global pool.
+			 * The current swap_map value is SWAP_HAS_CACHE.
+			 * Set it to 0 to indicate it is available for
+			 * allocation in global pool
+			 */
+			swapcache_free_entries(cache->slots_ret, cache->n_ret);
+			cache->n_ret = 0;
+		}
+		cache->slots_ret[cache->n_ret++] = entry;
+		spin_unlock_irqrestore(&cache->free_lock, flags);
+		return;
+	}
+direct_free:
+	swapcache_free_entries(&entry, 1);
+}
+
+swp_entry_t get_swap_page(void)
+{
+	swp_entry_t entry, *pentry;
+	struct swap_slots_cache *cache;
+
+	entry.val = 0;
+
+	/*
+	 * Preemption is allowed here: the cache of the CPU we started on
+	 * is protected by its mutex wherever we end up running.
+	 */
+	if (check_cache_active()) {
+		cache = __this_cpu_ptr(&swp_slots);
+		if (cache->slots) {
+			mutex_lock(&cache->alloc_lock);
+repeat:
+			if (cache->nr) {
+				pentry = &cache->slots[cache->cur++];
+				entry = *pentry;
+				pentry->val = 0;
+				cache->nr--;
+			} else if (refill_swap_slots_cache(cache)) {
+				goto repeat;
+			}
+			mutex_unlock(&cache->alloc_lock);
+			if (entry.val)
+				return entry;
+		}
+	}
+
+	get_swap_pages(1, &entry);
+
+	return entry;
+}
@@ -18,6 +18,7 @@
 #include <linux/pagevec.h>
 #include <linux/migrate.h>
 #include <linux/page_cgroup.h>
+#include <linux/swap_slots.h>
 
 #include <asm/pgtable.h>
 
@@ -189,13 +190,15 @@ int add_to_swap(struct page *page, struct list_head *list)
 	 * deadlock in the swap out path.
 	 */
 	/*
-	 * Add it to the swap cache and mark it dirty
+	 * Add it to the swap cache. The page is not marked dirty here:
+	 * try_to_unmap() moves the dirty bit over from the ptes, and a
+	 * page that stays clean was freed with MADV_FREE and need not
+	 * be written out at all.
 	 */
 	err = add_to_swap_cache(page, entry,
 			__GFP_HIGH|__GFP_NOMEMALLOC|__GFP_NOWARN);
 
 	if (!err) {	/* Success */
-		SetPageDirty(page);
 		return 1;
 	} else {	/* -ENOMEM radix-tree allocation failure */
 		/*
@@ -321,6 +324,15 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		if (found_page)
 			break;
 
+		/*
+		 * Skip readahead of unused slots: a slot parked in a swap
+		 * slots cache holds SWAP_HAS_CACHE but will never get a
+		 * page, so swapcache_prepare() below would spin on it.
+		 * swapoff disables the cache and must not bail out here.
+		 */
+		if (swap_slot_cache_enabled && !__swp_swapcount(entry))
+			break;
+
 		/*
 		 * Get a new page to read into from swap.
 		 */
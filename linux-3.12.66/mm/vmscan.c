@@ -49,6 +49,7 @@
 
 #include <linux/swapops.h>
 #include <linux/balloon_compaction.h>
+#include <linux/migrate.h>
 
 #include "internal.h"
 
@@ -78,6 +79,9 @@ struct scan_control {
 	/* Can pages be swapped as part of reclaim? */
 	int may_swap;
 
+	/* Must cold pages be reclaimed rather than demoted to a slower node? */
+	int no_demotion;
+
 	int order;
 
 	/* Scan (total_size >> priority) pages at once */
@@ -524,7 +528,8 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -570,10 +575,23 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		swapcache_free(swap, page);
 	} else {
 		void (*freepage)(struct page *);
+		void *shadow = NULL;
 
 		freepage = mapping->a_ops->freepage;
-
-		__delete_from_page_cache(page);
+		/*
+		 * Remember a shadow entry for reclaimed file cache in
+		 * order to detect refaults, thus thrashing, later on.
+		 *
+		 * But don't store shadows in an address space that is
+		 * already exiting.  This is not just an optimization,
+		 * inode reclaim needs to empty out the radix tree or
+		 * the nodes are lost.  Don't plant shadows behind its
+		 * back.
+		 */
+		if (reclaimed && page_is_file_cache(page) &&
+		    !mapping_exiting(mapping))
+			shadow = workingset_eviction(mapping, page);
+		__delete_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 
@@ -596,7 +614,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -771,6 +789,87 @@ static void page_check_dirty_writeback(struct page *page,
 		mapping->a_ops->is_dirty_writeback(page, dirty, writeback);
 }
 
+struct demote_control {
+	int nid;
+	unsigned long nr_allocated;
+	unsigned long nr_failed;
+};
+
+static struct page *alloc_demote_page(struct page *page, unsigned long private,
+				      int **result)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+	struct page *newpage;
+
+	/*
+	 * Don't enter reclaim or touch the reserves to make room on the
+	 * slower node: if it is full, the page is reclaimed as usual.
+	 */
+	newpage = alloc_pages_exact_node(dc->nid,
+				(GFP_HIGHUSER_MOVABLE & ~__GFP_WAIT) |
+				GFP_THISNODE | __GFP_NOMEMALLOC, 0);
+	if (newpage)
+		dc->nr_allocated++;
+
+	return newpage;
+}
+
+static void free_demote_page(struct page *newpage, unsigned long private)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+
+	dc->nr_failed++;
+	put_page(newpage);
+}
+
+static bool can_demote(struct zone *zone, struct scan_control *sc)
+{
+	if (!numa_demotion_enabled || sc->no_demotion)
+		return false;
+	/* The memcg charge moves with the page, so it can't help a memcg limit */
+	if (!global_reclaim(sc))
+		return false;
+	return next_demotion_node(zone_to_nid(zone)) != NUMA_NO_NODE;
+}
+
+/*
+ * Migrate the pages on @demote_pages to the demotion target of @zone's
+ * node and return how many were moved.  Pages that could not be moved
+ * are either put back on the LRU by migrate_pages() or left on the list
+ * for the caller to reclaim normally.
+ */
+static unsigned long demote_page_list(struct list_head *demote_pages,
+				      struct zone *zone)
+{
+	struct demote_control dc = {
+		.nid = next_demotion_node(zone_to_nid(zone)),
+	};
+	struct page *page;
+
+	if (list_empty(demote_pages) || dc.nid == NUMA_NO_NODE)
+		return 0;
+
+	/*
+	 * The pages are accounted as isolated by our caller, and
+	 * migrate_pages() drops that count for each page it finishes
+	 * with, so account them once more for it.
+	 */
+	list_for_each_entry(page, demote_pages, lru)
+		inc_zone_page_state(page, NR_ISOLATED_ANON +
+				    page_is_file_cache(page));
+
+	migrate_pages(demote_pages, alloc_demote_page, free_demote_page,
+		      (unsigned long)&dc, MIGRATE_ASYNC, MR_DEMOTION);
+
+	list_for_each_entry(page, demote_pages, lru)
+		dec_zone_page_state(page, NR_ISOLATED_ANON +
+				    page_is_file_cache(page));
+
+	count_vm_events(PGDEMOTE, dc.nr_allocated - dc.nr_failed);
+
+	return dc.nr_allocated - dc.nr_failed;
+}
+
 /*
  * shrink_page_list() returns the number of reclaimed pages
  */
@@ -787,7 +886,10 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 {
 	LIST_HEAD(ret_pages);
 	LIST_HEAD(free_pages);
+	LIST_HEAD(demote_pages);
 	int pgactivate = 0;
+	bool do_demote_pass;
+	bool demote_retry = false;
 	unsigned long nr_unqueued_dirty = 0;
 	unsigned long nr_dirty = 0;
 	unsigned long nr_congested = 0;
@@ -797,13 +899,17 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 
 	cond_resched();
 
+	do_demote_pass = can_demote(zone, sc);
+
 	mem_cgroup_uncharge_start();
+retry:
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
 		struct page *page;
 		int may_enter_fs;
 		enum page_references references = PAGEREF_RECLAIM_CLEAN;
 		bool dirty, writeback;
+		bool lazyfree = false, lazyfreed = false;
 
 		cond_resched();
 
@@ -816,7 +922,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		VM_BUG_ON(PageActive(page));
 		VM_BUG_ON(page_zone(page) != zone);
 
-		sc->nr_scanned++;
+		/*
+		 * Pages that failed demotion come around a second time and
+		 * were already accounted on the first pass.
+		 */
+		if (!demote_retry)
+			sc->nr_scanned++;
 
 		if (unlikely(!page_evictable(page)))
 			goto cull_mlocked;
@@ -825,7 +936,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			goto keep_locked;
 
 		/* Double the slab pressure for mapped and swapcache pages */
-		if (page_mapped(page) || PageSwapCache(page))
+		if (!demote_retry && (page_mapped(page) || PageSwapCache(page)))
 			sc->nr_scanned++;
 
 		may_enter_fs = (sc->gfp_mask & __GFP_FS) ||
@@ -838,10 +949,10 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * is all dirty unqueued pages.
 		 */
 		page_check_dirty_writeback(page, &dirty, &writeback);
-		if (dirty || writeback)
+		if (!demote_retry && (dirty || writeback))
 			nr_dirty++;
 
-		if (dirty && !writeback)
+		if (!demote_retry && dirty && !writeback)
 			nr_unqueued_dirty++;
 
 		/*
@@ -851,8 +962,9 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * end of the LRU a second time.
 		 */
 		mapping = page_mapping(page);
-		if ((mapping && bdi_write_congested(mapping->backing_dev_info)) ||
-		    (writeback && PageReclaim(page)))
+		if (!demote_retry &&
+		    ((mapping && bdi_write_congested(mapping->backing_dev_info)) ||
+		     (writeback && PageReclaim(page))))
 			nr_congested++;
 
 		/*
@@ -893,7 +1005,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			if (current_is_kswapd() &&
 			    PageReclaim(page) &&
 			    zone_is_reclaim_writeback(zone)) {
-				nr_immediate++;
+				if (!demote_retry)
+					nr_immediate++;
 				goto keep_locked;
 
 			/* Case 2 above */
@@ -911,7 +1024,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 				 * and it's also appropriate in global reclaim.
 				 */
 				SetPageReclaim(page);
-				nr_writeback++;
+				if (!demote_retry)
+					nr_writeback++;
 
 				goto keep_locked;
 
@@ -934,6 +1048,17 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * Before swapping or dropping the page, try to move it to
+		 * a slower memory node.  Demotion happens in one batch
+		 * after the loop.
+		 */
+		if (do_demote_pass) {
+			unlock_page(page);
+			list_add(&page->lru, &demote_pages);
+			continue;
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -943,18 +1068,39 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 				goto keep_locked;
 			if (!add_to_swap(page, page_list))
 				goto activate_locked;
+			lazyfree = true;
 			may_enter_fs = 1;
 
 			/* Adding to swap updated mapping */
 			mapping = page_mapping(page);
 		}
 
+		/*
+		 * A huge page of shmem is written out and reclaimed as
+		 * small pages: its tail pages join page_list.
+		 */
+		if (PageTransHuge(page) && !PageAnon(page)) {
+			if (split_huge_page_to_list(page, page_list))
+				goto activate_locked;
+		}
+
 		/*
 		 * The page is mapped into the page tables of one or more
 		 * processes. Try to unmap it here.
 		 */
 		if (page_mapped(page) && mapping) {
-			switch (try_to_unmap(page, ttu_flags)) {
+			int ret = try_to_unmap(page, lazyfree ?
+					(ttu_flags | TTU_BATCH_FLUSH | TTU_LZFREE) :
+					(ttu_flags | TTU_BATCH_FLUSH));
+
+			/*
+			 * add_to_swap() left the page clean. If it stays
+			 * mapped, it must be written out next time around.
+			 */
+			if (lazyfree && ret != SWAP_SUCCESS)
+				SetPageDirty(page);
+
+			switch (ret) {
 			case SWAP_FAIL:
 				goto activate_locked;
 			case SWAP_AGAIN:
@@ -966,6 +1112,9 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
+		/* Nobody wrote to it since MADV_FREE: drop it unwritten */
+		lazyfreed = lazyfree && !PageDirty(page);
+
 		if (PageDirty(page)) {
 			/*
 			 * Only kswapd can writeback filesystem pages to
@@ -994,7 +1143,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			if (!sc->may_writepage)
 				goto keep_locked;
 
-			/* Page is dirty, try to write it out here */
+			/*
+			 * Page is dirty. Flush the TLB if a writable entry
+			 * potentially exists to avoid CPU writes after IO
+			 * starts and then write it out here.
+			 */
+			try_to_unmap_flush_dirty();
 			switch (pageout(page, mapping, sc)) {
 			case PAGE_KEEP:
 				goto keep_locked;
@@ -1062,7 +1216,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -1073,6 +1227,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * waiting on the page lock, because there are no references.
 		 */
 		__clear_page_locked(page);
+		if (lazyfreed)
+			count_vm_event(PGLAZYFREED);
 free_it:
 		nr_reclaimed++;
 
@@ -1104,6 +1260,17 @@ keep:
 		VM_BUG_ON(PageLRU(page) || PageUnevictable(page));
 	}
 
+	/* Demoted pages count as reclaimed; the rest go through reclaim */
+	nr_reclaimed += demote_page_list(&demote_pages, zone);
+	if (!list_empty(&demote_pages)) {
+		list_splice_init(&demote_pages, page_list);
+		do_demote_pass = false;
+		demote_retry = true;
+		goto retry;
+	}
+
+	/* No stale TLB entry may point at a page once it is freed */
+	try_to_unmap_flush();
 	free_hot_cold_page_list(&free_pages, true);
 
 	list_splice(&ret_pages, page_list);
@@ -1124,6 +1291,7 @@ unsigned long reclaim_clean_pages_from_list(struct zone *zone,
 		.gfp_mask = GFP_KERNEL,
 		.priority = DEF_PRIORITY,
 		.may_unmap = 1,
+		.no_demotion = 1,
 	};
 	unsigned long ret, dummy1, dummy2, dummy3, dummy4, dummy5;
 	struct page *page, *next;
@@ -2882,9 +3050,16 @@ static bool prepare_kswapd_sleep(pg_data_t *pgdat, int order, long remaining,
 	return pgdat_balanced(pgdat, order, classzone_idx);
 }
 
+/*
+ * Number of kswapd threads per node, set through
+ * /sys/kernel/mm/kswapd/nr_threads. Protected by lock_memory_hotplug().
+ */
+static int kswapd_threads __read_mostly = 1;
+
 /*
  * kswapd shrinks the zone by the number of pages required to reach
- * the high watermark.
+ * the high watermark. With several kswapd threads per node each one
+ * takes an equal share of that target.
  *
  * Returns true if kswapd scanned at least the requested number of pages to
  * reclaim or if the lack of progress was due to pages under writeback.
@@ -2893,8 +3068,7 @@ static bool prepare_kswapd_sleep(pg_data_t *pgdat, int order, long remaining,
 static bool kswapd_shrink_zone(struct zone *zone,
 			       int classzone_idx,
 			       struct scan_control *sc,
-			       unsigned long lru_pages,
-			       unsigned long *nr_attempted)
+			       unsigned long lru_pages)
 {
 	int testorder = sc->order;
 	unsigned long balance_gap;
@@ -2905,7 +3079,8 @@ static bool kswapd_shrink_zone(struct zone *zone,
 	bool lowmem_pressure;
 
 	/* Reclaim above the high watermark. */
-	sc->nr_to_reclaim = max(SWAP_CLUSTER_MAX, high_wmark_pages(zone));
+	sc->nr_to_reclaim = max(SWAP_CLUSTER_MAX,
+				high_wmark_pages(zone) / kswapd_threads);
 
 	/*
 	 * Kswapd reclaims only single pages with compaction enabled. Trying
@@ -2945,9 +3120,6 @@ static bool kswapd_shrink_zone(struct zone *zone,
 	shrink_slab(&shrink, sc->nr_scanned, lru_pages);
 	sc->nr_reclaimed += reclaim_state->reclaimed_slab;
 
-	/* Account for the number of pages attempted to reclaim */
-	*nr_attempted += sc->nr_to_reclaim;
-
 	zone_clear_flag(zone, ZONE_WRITEBACK);
 
 	/*
@@ -2986,9 +3158,10 @@ static bool kswapd_shrink_zone(struct zone *zone,
  * interoperates with the page allocator fallback scheme to ensure that aging
  * of pages is balanced across the zones.
  */
-static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
+static unsigned long balance_pgdat(struct kswapd_thread *kt, int order,
 							int *classzone_idx)
 {
+	pg_data_t *pgdat = kt->pgdat;
 	int i;
 	int end_zone = 0;	/* Inclusive.  0 = ZONE_DMA */
 	unsigned long nr_soft_reclaimed;
@@ -3006,9 +3179,7 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 
 	do {
 		unsigned long lru_pages = 0;
-		unsigned long nr_attempted = 0;
 		bool raise_priority = true;
-		bool pgdat_needs_compaction = (order > 0);
 
 		sc.nr_reclaimed = 0;
 
@@ -3066,17 +3237,6 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 				continue;
 
 			lru_pages += zone_reclaimable_pages(zone);
-
-			/*
-			 * If any zone is currently balanced then kswapd will
-			 * not call compaction as it is expected that the
-			 * necessary pages are already available.
-			 */
-			if (pgdat_needs_compaction &&
-					zone_watermark_ok(zone, order,
-						low_wmark_pages(zone),
-						*classzone_idx, 0))
-				pgdat_needs_compaction = false;
 		}
 
 		/*
@@ -3122,10 +3282,11 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 			 * that that high watermark would be met at 100%
 			 * efficiency.
 			 */
-			if (kswapd_shrink_zone(zone, end_zone, &sc,
-					lru_pages, &nr_attempted))
+			if (kswapd_shrink_zone(zone, end_zone, &sc, lru_pages))
 				raise_priority = false;
+			kt->nr_scanned += sc.nr_scanned;
 		}
+		kt->nr_reclaimed += sc.nr_reclaimed;
 
 		/*
 		 * If the low watermark is met there is no need for processes
@@ -3151,13 +3312,6 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 		if (try_to_freeze() || kthread_should_stop())
 			break;
 
-		/*
-		 * Compact if necessary and kswapd is reclaiming at least the
-		 * high watermark number of pages as requsted
-		 */
-		if (pgdat_needs_compaction && sc.nr_reclaimed > nr_attempted)
-			compact_pgdat(pgdat, order);
-
 		/*
 		 * Raise priority if scanning rate is too low or there was no
 		 * progress in reclaiming pages
@@ -3178,8 +3332,10 @@ out:
 	return order;
 }
 
-static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
+static void kswapd_try_to_sleep(struct kswapd_thread *kt, int alloc_order,
+				int order, int classzone_idx)
 {
+	pg_data_t *pgdat = kt->pgdat;
 	long remaining = 0;
 	DEFINE_WAIT(wait);
 
@@ -3202,6 +3358,13 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 	if (prepare_kswapd_sleep(pgdat, order, remaining, classzone_idx)) {
 		trace_mm_vmscan_kswapd_sleep(pgdat->node_id);
 
+		/* Node wide state is left to the primary thread */
+		if (kt->id) {
+			if (!kthread_should_stop())
+				schedule();
+			goto out;
+		}
+
 		/*
 		 * vmstat counters are not perfectly accurate and the estimated
 		 * value for counters such as NR_FREE_PAGES can deviate from the
@@ -3220,6 +3383,12 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 		 */
 		reset_isolation_suitable(pgdat);
 
+		/*
+		 * We have freed the memory, now we should compact it to make
+		 * allocation of the requested order possible.
+		 */
+		wakeup_kcompactd(pgdat, alloc_order, classzone_idx);
+
 		if (!kthread_should_stop())
 			schedule();
 
@@ -3230,6 +3399,7 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 		else
 			count_vm_event(KSWAPD_HIGH_WMARK_HIT_QUICKLY);
 	}
+out:
 	finish_wait(&pgdat->kswapd_wait, &wait);
 }
 
@@ -3245,6 +3415,11 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
  *
  * If there are applications that are active memory-allocators
  * (most normal use), this basically shouldn't matter.
+ *
+ * All kswapd threads of a node sleep on the same waitqueue and are woken
+ * together. They run balance_pgdat() concurrently, each isolating its own
+ * batches off the shared LRU lists. Only the primary thread consumes the
+ * order and classzone requested by wakeup_kswapd().
  */
 static int kswapd(void *p)
 {
@@ -3252,7 +3427,9 @@ static int kswapd(void *p)
 	unsigned balanced_order;
 	int classzone_idx, new_classzone_idx;
 	int balanced_classzone_idx;
-	pg_data_t *pgdat = (pg_data_t*)p;
+	struct kswapd_thread *kt = p;
+	pg_data_t *pgdat = kt->pgdat;
+	bool primary = !kt->id;
 	struct task_struct *tsk = current;
 
 	struct reclaim_state reclaim_state = {
@@ -3297,8 +3474,10 @@ static int kswapd(void *p)
 					balanced_order == new_order) {
 			new_order = pgdat->kswapd_max_order;
 			new_classzone_idx = pgdat->classzone_idx;
-			pgdat->kswapd_max_order =  0;
-			pgdat->classzone_idx = pgdat->nr_zones - 1;
+			if (primary) {
+				pgdat->kswapd_max_order =  0;
+				pgdat->classzone_idx = pgdat->nr_zones - 1;
+			}
 		}
 
 		if (order < new_order || classzone_idx > new_classzone_idx) {
@@ -3309,14 +3488,16 @@ static int kswapd(void *p)
 			order = new_order;
 			classzone_idx = new_classzone_idx;
 		} else {
-			kswapd_try_to_sleep(pgdat, balanced_order,
+			kswapd_try_to_sleep(kt, order, balanced_order,
 						balanced_classzone_idx);
 			order = pgdat->kswapd_max_order;
 			classzone_idx = pgdat->classzone_idx;
 			new_order = order;
 			new_classzone_idx = classzone_idx;
-			pgdat->kswapd_max_order = 0;
-			pgdat->classzone_idx = pgdat->nr_zones - 1;
+			if (primary) {
+				pgdat->kswapd_max_order = 0;
+				pgdat->classzone_idx = pgdat->nr_zones - 1;
+			}
 		}
 
 		ret = try_to_freeze();
@@ -3329,8 +3510,9 @@ static int kswapd(void *p)
 		 */
 		if (!ret) {
 			trace_mm_vmscan_kswapd_wake(pgdat->node_id, order);
+			kt->nr_wakeups++;
 			balanced_classzone_idx = classzone_idx;
-			balanced_order = balance_pgdat(pgdat, order,
+			balanced_order = balance_pgdat(kt, order,
 						&balanced_classzone_idx);
 		}
 	}
@@ -3428,14 +3610,60 @@ static int cpu_callback(struct notifier_block *nfb, unsigned long action,
 
 			mask = cpumask_of_node(pgdat->node_id);
 
-			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
+			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids) {
 				/* One of our CPUs online: restore mask */
-				set_cpus_allowed_ptr(pgdat->kswapd, mask);
+				int i;
+
+				for (i = 0; i < MAX_KSWAPD_THREADS; i++) {
+					struct task_struct *tsk;
+
+					tsk = pgdat->kswapd_threads[i].task;
+					if (tsk)
+						set_cpus_allowed_ptr(tsk, mask);
+				}
+			}
 		}
 	}
 	return NOTIFY_OK;
 }
 
+static int kswapd_start_thread(pg_data_t *pgdat, int id)
+{
+	struct kswapd_thread *kt = &pgdat->kswapd_threads[id];
+	struct task_struct *tsk;
+
+	if (kt->task)
+		return 0;
+
+	kt->pgdat = pgdat;
+	kt->id = id;
+	if (id)
+		tsk = kthread_run(kswapd, kt, "kswapd%d:%d",
+				  pgdat->node_id, id);
+	else
+		tsk = kthread_run(kswapd, kt, "kswapd%d", pgdat->node_id);
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+
+	kt->task = tsk;
+	if (!id)
+		pgdat->kswapd = tsk;
+	return 0;
+}
+
+static void kswapd_stop_thread(pg_data_t *pgdat, int id)
+{
+	struct kswapd_thread *kt = &pgdat->kswapd_threads[id];
+
+	if (!kt->task)
+		return;
+
+	kthread_stop(kt->task);
+	kt->task = NULL;
+	if (!id)
+		pgdat->kswapd = NULL;
+}
+
 /*
  * This kswapd start function will be called by init and node-hot-add.
  * On node-hot-add, kswapd will moved to proper cpus if cpus are hot-added.
@@ -3443,20 +3671,25 @@ static int cpu_callback(struct notifier_block *nfb, unsigned long action,
 int kswapd_run(int nid)
 {
 	pg_data_t *pgdat = NODE_DATA(nid);
-	int ret = 0;
-
-	if (pgdat->kswapd)
-		return 0;
+	int i, ret;
 
-	pgdat->kswapd = kthread_run(kswapd, pgdat, "kswapd%d", nid);
-	if (IS_ERR(pgdat->kswapd)) {
+	ret = kswapd_start_thread(pgdat, 0);
+	if (ret) {
 		/* failure at boot is fatal */
 		BUG_ON(system_state == SYSTEM_BOOTING);
 		pr_err("Failed to start kswapd on node %d\n", nid);
-		ret = PTR_ERR(pgdat->kswapd);
-		pgdat->kswapd = NULL;
+		return ret;
 	}
-	return ret;
+
+	/* The extra threads are best effort */
+	for (i = 1; i < kswapd_threads; i++) {
+		if (kswapd_start_thread(pgdat, i)) {
+			pr_err("Failed to start kswapd thread %d on node %d\n",
+			       i, nid);
+			break;
+		}
+	}
+	return 0;
 }
 
 /*
@@ -3465,13 +3698,110 @@ int kswapd_run(int nid)
  */
 void kswapd_stop(int nid)
 {
-	struct task_struct *kswapd = NODE_DATA(nid)->kswapd;
+	int i;
+
+	for (i = MAX_KSWAPD_THREADS - 1; i >= 0; i--)
+		kswapd_stop_thread(NODE_DATA(nid), i);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t nr_threads_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", kswapd_threads);
+}
+
+static ssize_t nr_threads_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long nr;
+	int nid, i, err;
+
+	err = kstrtoul(buf, 10, &nr);
+	if (err)
+		return err;
+	if (nr < 1 || nr > MAX_KSWAPD_THREADS)
+		return -EINVAL;
+
+	lock_memory_hotplug();
+	kswapd_threads = nr;
+	for_each_node_state(nid, N_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		for (i = MAX_KSWAPD_THREADS - 1; i >= (int)nr; i--)
+			kswapd_stop_thread(pgdat, i);
+
+		/* Nodes without a primary kswapd are being offlined */
+		if (!pgdat->kswapd)
+			continue;
+
+		for (i = 1; i < nr; i++) {
+			err = kswapd_start_thread(pgdat, i);
+			if (err)
+				break;
+		}
+		if (err)
+			break;
+	}
+	unlock_memory_hotplug();
+
+	return err ? err : count;
+}
+
+static struct kobj_attribute nr_threads_attr =
+	__ATTR(nr_threads, 0644, nr_threads_show, nr_threads_store);
+
+/* One line per running thread: name, wakeups, pages scanned and reclaimed */
+static ssize_t stats_show(struct kobject *kobj,
+			  struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	int nid, i;
+
+	lock_memory_hotplug();
+	for_each_node_state(nid, N_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		for (i = 0; i < MAX_KSWAPD_THREADS; i++) {
+			struct kswapd_thread *kt = &pgdat->kswapd_threads[i];
 
-	if (kswapd) {
-		kthread_stop(kswapd);
-		NODE_DATA(nid)->kswapd = NULL;
+			if (!kt->task)
+				continue;
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					 "%s %lu %lu %lu\n", kt->task->comm,
+					 kt->nr_wakeups, kt->nr_scanned,
+					 kt->nr_reclaimed);
+		}
 	}
+	unlock_memory_hotplug();
+
+	return len;
+}
+
+static struct kobj_attribute stats_attr = __ATTR_RO(stats);
+
+static struct attribute *kswapd_attrs[] = {
+	&nr_threads_attr.attr,
+	&stats_attr.attr,
+	NULL,
+};
+
+static struct attribute_group kswapd_attr_group = {
+	.attrs = kswapd_attrs,
+	.name = "kswapd",
+};
+
+static void __init kswapd_init_sysfs(void)
+{
+	if (sysfs_create_group(mm_kobj, &kswapd_attr_group))
+		pr_err("kswapd: failed to register sysfs group\n");
+}
+#else
+static inline void kswapd_init_sysfs(void)
+{
 }
+#endif /* CONFIG_SYSFS */
 
 static int __init kswapd_init(void)
 {
@@ -3481,6 +3811,7 @@ static int __init kswapd_init(void)
 	for_each_node_state(nid, N_MEMORY)
  		kswapd_run(nid);
 	hotcpu_notifier(cpu_callback, 0);
+	kswapd_init_sysfs();
 	return 0;
 }
 
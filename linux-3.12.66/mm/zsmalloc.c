@@ -12,7 +12,7 @@
 
 
 /*
- * This allocator is designed for use with zcache and zram. Thus, the
+ * This allocator is designed for use with zram and zswap. Thus, the
  * allocator is supposed to work well under low memory conditions. In
  * particular, it never attempts higher order page allocation which is
  * very likely to fail under memory pressure. On the other hand, if we
@@ -79,7 +79,8 @@
 #include <linux/spinlock.h>
 #include <linux/types.h>
 
-#include "zsmalloc.h"
+#include <linux/zsmalloc.h>
+#include <linux/zpool.h>
 
 /*
  * This must be power of 2 and greater than of equal to sizeof(link_free).
@@ -128,6 +129,10 @@
 	MAX(32, (ZS_MAX_PAGES_PER_ZSPAGE << PAGE_SHIFT >> OBJ_INDEX_BITS))
 #define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
 
+/* Upper bound on first_page->objects, for sizing zs_reclaim_page's bitmap */
+#define ZS_MAX_OBJS_PER_ZSPAGE \
+	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / ZS_MIN_ALLOC_SIZE)
+
 /*
  * On systems with 4K page size, this gives 254 size classes! There is a
  * trader-off here:
@@ -146,15 +151,18 @@
 					ZS_SIZE_CLASS_DELTA + 1)
 
 /*
- * We do not maintain any list for completely empty or full pages
+ * We do not maintain any list for completely empty pages, nor for those
+ * taken off their list by zs_reclaim_page().  Full pages are listed only
+ * so that they can be found for reclaim: they are never allocated from.
  */
 enum fullness_group {
 	ZS_ALMOST_FULL,
 	ZS_ALMOST_EMPTY,
+	ZS_FULL,
 	_ZS_NR_FULLNESS_GROUPS,
 
 	ZS_EMPTY,
-	ZS_FULL
+	ZS_RECLAIM
 };
 
 /*
@@ -207,6 +215,12 @@ struct zs_pool {
 	struct size_class size_class[ZS_SIZE_CLASSES];
 
 	gfp_t flags;	/* allocation flags used when growing pool */
+	struct zs_ops *ops;	/* user defined operations, may be NULL */
+
+#ifdef CONFIG_ZPOOL
+	struct zpool *zpool;
+	struct zpool_ops *zpool_ops;
+#endif
 };
 
 /*
@@ -355,6 +369,9 @@ static enum fullness_group fix_fullness_group(struct zs_pool *pool,
 	BUG_ON(!is_first_page(page));
 
 	get_zspage_mapping(page, &class_idx, &currfg);
+	/* zs_reclaim_page() puts it back on the right list when done */
+	if (currfg == ZS_RECLAIM)
+		return currfg;
 	newfg = get_fullness_group(page);
 	if (newfg == currfg)
 		goto out;
@@ -622,7 +639,8 @@ static struct page *find_get_zspage(struct size_class *class)
 	int i;
 	struct page *page;
 
-	for (i = 0; i < _ZS_NR_FULLNESS_GROUPS; i++) {
+	/* Only the partially used zspages have room */
+	for (i = ZS_ALMOST_FULL; i <= ZS_ALMOST_EMPTY; i++) {
 		page = class->fullness_list[i];
 		if (page)
 			break;
@@ -776,10 +794,124 @@ static struct notifier_block zs_cpu_nb = {
 	.notifier_call = zs_cpu_notifier
 };
 
+#ifdef CONFIG_ZPOOL
+
+static int zs_zpool_evict(struct zs_pool *pool, unsigned long handle)
+{
+	if (pool->zpool && pool->zpool_ops && pool->zpool_ops->evict)
+		return pool->zpool_ops->evict(pool->zpool, handle);
+	else
+		return -ENOENT;
+}
+
+static struct zs_ops zs_zpool_ops = {
+	.evict =	zs_zpool_evict
+};
+
+static void *zs_zpool_create(gfp_t gfp, struct zpool_ops *zpool_ops,
+			     struct zpool *zpool)
+{
+	struct zs_pool *pool;
+
+	pool = zs_create_pool(gfp, zpool_ops ? &zs_zpool_ops : NULL);
+	if (pool) {
+		pool->zpool = zpool;
+		pool->zpool_ops = zpool_ops;
+	}
+	return pool;
+}
+
+static void zs_zpool_destroy(void *pool)
+{
+	zs_destroy_pool(pool);
+}
+
+static int zs_zpool_malloc(void *pool, size_t size, gfp_t gfp,
+			unsigned long *handle)
+{
+	if (size > ZS_MAX_ALLOC_SIZE)
+		return -ENOSPC;
+	*handle = zs_malloc(pool, size);
+	return *handle ? 0 : -ENOMEM;
+}
+static void zs_zpool_free(void *pool, unsigned long handle)
+{
+	zs_free(pool, handle);
+}
+
+static int zs_zpool_shrink(void *pool, unsigned int pages,
+			unsigned int *reclaimed)
+{
+	unsigned int total = 0;
+	int ret = -EINVAL;
+
+	while (total < pages) {
+		ret = zs_reclaim_page(pool, 8);
+		if (ret < 0)
+			break;
+		total++;
+	}
+
+	if (reclaimed)
+		*reclaimed = total;
+
+	return ret;
+}
+
+static void *zs_zpool_map(void *pool, unsigned long handle,
+			enum zpool_mapmode mm)
+{
+	enum zs_mapmode zs_mm;
+
+	switch (mm) {
+	case ZPOOL_MM_RO:
+		zs_mm = ZS_MM_RO;
+		break;
+	case ZPOOL_MM_WO:
+		zs_mm = ZS_MM_WO;
+		break;
+	case ZPOOL_MM_RW: /* fallthru */
+	default:
+		zs_mm = ZS_MM_RW;
+		break;
+	}
+
+	return zs_map_object(pool, handle, zs_mm);
+}
+static void zs_zpool_unmap(void *pool, unsigned long handle)
+{
+	zs_unmap_object(pool, handle);
+}
+
+static u64 zs_zpool_total_size(void *pool)
+{
+	return zs_get_total_size_bytes(pool);
+}
+
+static struct zpool_driver zs_zpool_driver = {
+	.type =		"zsmalloc",
+	.owner =	THIS_MODULE,
+	.create =	zs_zpool_create,
+	.destroy =	zs_zpool_destroy,
+	.malloc =	zs_zpool_malloc,
+	.free =		zs_zpool_free,
+	.shrink =	zs_zpool_shrink,
+	.map =		zs_zpool_map,
+	.unmap =	zs_zpool_unmap,
+	.total_size =	zs_zpool_total_size,
+};
+
+MODULE_ALIAS("zpool-zsmalloc");
+#endif /* CONFIG_ZPOOL */
+
 static void zs_exit(void)
 {
 	int cpu;
 
+#ifdef CONFIG_ZPOOL
+	zpool_unregister_driver(&zs_zpool_driver);
+#endif
+
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
@@ -789,6 +921,10 @@ static int zs_init(void)
 {
 	int cpu, ret;
 
+#ifdef CONFIG_ZPOOL
+	zpool_register_driver(&zs_zpool_driver);
+#endif
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
@@ -803,7 +939,8 @@ fail:
 
 /**
  * zs_create_pool - Creates an allocation pool to work from.
- * @flags: allocation flags used to allocate pool metadata
+ * @flags: allocation flags used when growing the pool
+ * @ops: user-defined operations for the pool, or NULL
  *
  * This function must be called before anything when using
  * the zsmalloc allocator.
@@ -811,7 +948,7 @@ fail:
  * On success, a pointer to the newly created pool is returned,
  * otherwise NULL.
  */
-struct zs_pool *zs_create_pool(gfp_t flags)
+struct zs_pool *zs_create_pool(gfp_t flags, struct zs_ops *ops)
 {
 	int i, ovhd_size;
 	struct zs_pool *pool;
@@ -838,6 +975,7 @@ struct zs_pool *zs_create_pool(gfp_t flags)
 	}
 
 	pool->flags = flags;
+	pool->ops = ops;
 
 	return pool;
 }
@@ -963,6 +1101,191 @@ void zs_free(struct zs_pool *pool, unsigned long obj)
 }
 EXPORT_SYMBOL_GPL(zs_free);
 
+/*
+ * Number of the object at obj_idx within page, counting from the start
+ * of its zspage, in the order in which init_zspage() linked them.
+ */
+static unsigned long obj_location_to_index(struct page *page,
+				unsigned long obj_idx, int class_size)
+{
+	struct page *cursor = get_first_page(page);
+	unsigned long index = 0;
+
+	for (; cursor != page; cursor = get_next_page(cursor)) {
+		unsigned long off = 0;
+
+		if (!is_first_page(cursor))
+			off = cursor->index;
+		index += DIV_ROUND_UP(PAGE_SIZE - off, class_size);
+	}
+
+	return index + obj_idx;
+}
+
+/*
+ * Take a zspage off its fullness list for zs_reclaim_page(), so that
+ * zs_malloc() will not allocate from it and zs_free() will not free it.
+ *
+ * Rather than keep an LRU (struct page has no room for another list),
+ * pick the zspage which should need the fewest evictions to free it: an
+ * almost empty one before an almost full one before a full one, and the
+ * largest size class first, where compression saved least.  Within a
+ * fullness list, the oldest zspage is taken.
+ */
+static struct page *isolate_zspage(struct zs_pool *pool,
+				struct size_class **classp)
+{
+	static const enum fullness_group order[] = {
+		ZS_ALMOST_EMPTY, ZS_ALMOST_FULL, ZS_FULL
+	};
+	struct size_class *class;
+	struct page *first_page;
+	int i, class_idx;
+
+	for (i = 0; i < ARRAY_SIZE(order); i++) {
+		for (class_idx = ZS_SIZE_CLASSES - 1; class_idx >= 0;
+		     class_idx--) {
+			class = &pool->size_class[class_idx];
+			if (!class->fullness_list[order[i]])
+				continue;
+
+			spin_lock(&class->lock);
+			first_page = class->fullness_list[order[i]];
+			if (first_page) {
+				first_page = list_entry(first_page->lru.prev,
+							struct page, lru);
+				remove_zspage(first_page, class, order[i]);
+				set_zspage_mapping(first_page, class->index,
+							ZS_RECLAIM);
+				spin_unlock(&class->lock);
+				*classp = class;
+				return first_page;
+			}
+			spin_unlock(&class->lock);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Evict all the objects allocated in an isolated zspage: returns 0 if it
+ * was then freed, -EAGAIN if it was put back because an eviction failed.
+ */
+static int reclaim_zspage(struct zs_pool *pool, struct size_class *class,
+				struct page *first_page, unsigned long *free_map)
+{
+	struct page *page, *f_page;
+	struct link_free *link;
+	unsigned long obj, f_objidx, f_offset, index, objects;
+	enum fullness_group fullness;
+	int ret = 0;
+
+	/*
+	 * Note which objects are free.  No object can be allocated from the
+	 * zspage while it is isolated, but one may be freed at any time:
+	 * so the owner's evict handler must cope with a handle which has
+	 * just been freed.
+	 */
+	objects = first_page->objects;
+	bitmap_zero(free_map, objects);
+	spin_lock(&class->lock);
+	obj = (unsigned long)first_page->freelist;
+	while (obj) {
+		obj_handle_to_location(obj, &f_page, &f_objidx);
+		index = obj_location_to_index(f_page, f_objidx, class->size);
+		if (index < objects)
+			__set_bit(index, free_map);
+		f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+		link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
+							+ f_offset);
+		obj = (unsigned long)link->next;
+		kunmap_atomic(link);
+	}
+	spin_unlock(&class->lock);
+
+	/* Issue the eviction callbacks, in the order objects lie */
+	index = 0;
+	for (page = first_page; page && index < objects;
+	     page = get_next_page(page)) {
+		unsigned long off = 0, obj_idx;
+
+		if (!is_first_page(page))
+			off = page->index;
+		for (obj_idx = 0; off < PAGE_SIZE && index < objects;
+		     obj_idx++, off += class->size, index++) {
+			if (test_bit(index, free_map))
+				continue;
+			ret = pool->ops->evict(pool,
+				(unsigned long)obj_location_to_handle(page,
+								obj_idx));
+			if (ret)
+				goto out;
+		}
+	}
+out:
+	spin_lock(&class->lock);
+	fullness = get_fullness_group(first_page);
+	if (fullness == ZS_EMPTY)
+		class->pages_allocated -= class->pages_per_zspage;
+	else
+		insert_zspage(first_page, class, fullness);
+	set_zspage_mapping(first_page, class->index, fullness);
+	spin_unlock(&class->lock);
+
+	if (fullness == ZS_EMPTY) {
+		free_zspage(first_page);
+		return 0;
+	}
+	return -EAGAIN;
+}
+
+/**
+ * zs_reclaim_page - evicts allocations from a zspage and frees it
+ * @pool: pool from which a zspage will attempt to be evicted
+ * @retries: number of zspages to try before giving up
+ *
+ * zs_reclaim_page() takes a zspage out of use (see isolate_zspage()), and
+ * calls the user-defined evict handler with the pool and handle of each
+ * object allocated in it.  As with zbud_reclaim_page(), the handler should
+ * write the object back, free it with zs_free() and return 0; or return
+ * non-zero if it cannot, when the zspage is put back and the next tried.
+ *
+ * Returns: 0 if a zspage was freed, -EINVAL if there is nothing to evict
+ * or no evict handler, -ENOMEM if out of memory, -EAGAIN if the retries
+ * were exhausted.
+ */
+int zs_reclaim_page(struct zs_pool *pool, unsigned int retries)
+{
+	struct size_class *class;
+	struct page *first_page;
+	unsigned long *free_map;
+	int i, ret = -EINVAL;
+
+	if (!pool->ops || !pool->ops->evict)
+		return -EINVAL;
+
+	free_map = kmalloc(BITS_TO_LONGS(ZS_MAX_OBJS_PER_ZSPAGE) *
+				sizeof(unsigned long), GFP_NOIO | __GFP_NOWARN);
+	if (!free_map)
+		return -ENOMEM;
+
+	for (i = 0; i < retries; i++) {
+		first_page = isolate_zspage(pool, &class);
+		if (!first_page) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = reclaim_zspage(pool, class, first_page, free_map);
+		if (!ret)
+			break;
+	}
+
+	kfree(free_map);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(zs_reclaim_page);
+
 /**
  * zs_map_object - get address of allocated object from handle.
  * @pool: pool from which the object was allocated
@@ -60,6 +60,7 @@
 #include <linux/rtnetlink.h>
 #include <linux/init.h>
 #include <linux/scatterlist.h>
+#include <linux/cpu.h>
 #include <linux/errqueue.h>
 #include <linux/prefetch.h>
 #include <linux/if_vlan.h>
@@ -278,6 +279,79 @@ nodata:
 }
 EXPORT_SYMBOL(__alloc_skb);
 
+/*
+ * Per cpu stash of sk_buff heads for the softirq receive and completion
+ * paths. It is refilled and drained with the slab bulk API, so the
+ * allocator is entered once per SKB_HEAD_CACHE_BULK heads instead of
+ * once per packet. Hard interrupts never touch it, which makes softirq
+ * context with interrupts enabled enough to serialize access.
+ */
+#define SKB_HEAD_CACHE_SIZE	64
+#define SKB_HEAD_CACHE_BULK	16
+
+struct skb_head_cache {
+	unsigned int	count;
+	void		*heads[SKB_HEAD_CACHE_SIZE];
+};
+static DEFINE_PER_CPU(struct skb_head_cache, skb_head_cache);
+
+static inline bool skb_head_cache_usable(void)
+{
+	return in_serving_softirq() && !in_irq() && !irqs_disabled();
+}
+
+static struct sk_buff *skb_head_alloc(gfp_t gfp_mask)
+{
+	struct skb_head_cache *hc;
+
+	if (!skb_head_cache_usable())
+		return kmem_cache_alloc(skbuff_head_cache, gfp_mask);
+
+	hc = &__get_cpu_var(skb_head_cache);
+	if (unlikely(!hc->count)) {
+		hc->count = kmem_cache_alloc_bulk(skbuff_head_cache, gfp_mask,
+						  SKB_HEAD_CACHE_BULK,
+						  hc->heads);
+		if (unlikely(!hc->count))
+			return NULL;
+	}
+	return hc->heads[--hc->count];
+}
+
+static void skb_head_free(struct sk_buff *skb)
+{
+	struct skb_head_cache *hc;
+
+	if (!skb_head_cache_usable()) {
+		kmem_cache_free(skbuff_head_cache, skb);
+		return;
+	}
+
+	hc = &__get_cpu_var(skb_head_cache);
+	if (unlikely(hc->count == SKB_HEAD_CACHE_SIZE)) {
+		hc->count -= SKB_HEAD_CACHE_BULK;
+		kmem_cache_free_bulk(skbuff_head_cache, SKB_HEAD_CACHE_BULK,
+				     hc->heads + hc->count);
+	}
+	hc->heads[hc->count++] = skb;
+}
+
+/* Nothing runs on a dead cpu any more, so its stash can be freed here. */
+static int skb_head_cache_cpu_notify(struct notifier_block *self,
+				     unsigned long action, void *hcpu)
+{
+	struct skb_head_cache *hc;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	hc = &per_cpu(skb_head_cache, (unsigned long)hcpu);
+	if (hc->count)
+		kmem_cache_free_bulk(skbuff_head_cache, hc->count, hc->heads);
+	hc->count = 0;
+	return NOTIFY_OK;
+}
+
 /**
  * __build_skb - build a network buffer
  * @data: data buffer provided by caller
@@ -303,7 +377,7 @@ struct sk_buff *__build_skb(void *data, unsigned int frag_size)
 	struct sk_buff *skb;
 	unsigned int size = frag_size ? : ksize(data);
 
-	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
+	skb = skb_head_alloc(GFP_ATOMIC);
 	if (!skb)
 		return NULL;
 
@@ -538,7 +612,7 @@ static void kfree_skbmem(struct sk_buff *skb)
 
 	switch (skb->fclone) {
 	case SKB_FCLONE_UNAVAILABLE:
-		kmem_cache_free(skbuff_head_cache, skb);
+		skb_head_free(skb);
 		break;
 
 	case SKB_FCLONE_ORIG:
@@ -3114,6 +3188,7 @@ void __init skb_init(void)
 						0,
 						SLAB_HWCACHE_ALIGN|SLAB_PANIC,
 						NULL);
+	hotcpu_notifier(skb_head_cache_cpu_notify, 0);
 }
 
 /**